@@ -52,26 +52,128 @@ struct TBoundingBox {
     double t1;
   };
 
+  // minPoint for 0, maxPoint for 1
+  const TVector<T>& GetCorner(int index) const
+  {
+    return index == 0 ? minPoint : maxPoint;
+  }
+
+  // Branchless slab test. The ray enters the slab through the plane selected
+  // by the direction sign, so no swap is needed. When the origin is on the
+  // plane and the direction is parallel to it the slab distance is NaN
+  // (0 * infinity), the comparisons are written to ignore NaNs.
   Intersection Intersect(const Ray& ray) const
   {
-    double t0 = 0.0;
-    double t1 = std::numeric_limits<double>::infinity();
+#ifdef VECTOR_SSE2
+    const Vector& origin = ray.GetOrigin();
+    const Vector& invDirection = ray.GetInvDirection();
+
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d originXY = _mm_loadu_pd(&origin.x);
+    const __m128d originZ = _mm_set1_pd(origin.z);
+    const __m128d invXY = _mm_loadu_pd(&invDirection.x);
+    const __m128d invZ = _mm_set1_pd(invDirection.z);
+
+    // invDirection is negative exactly where the direction sign is 1
+    __m128d t0, t1;
+    SlabDistances(_mm_set_pd(minPoint.y, minPoint.x),
+                  _mm_set_pd(maxPoint.y, maxPoint.x), originXY, invXY,
+                  _mm_cmplt_pd(invXY, zero), t0, t1);
+
+    __m128d t0Z, t1Z;
+    SlabDistances(_mm_set1_pd(minPoint.z), _mm_set1_pd(maxPoint.z), originZ,
+                  invZ, _mm_cmplt_pd(invZ, zero), t0Z, t1Z);
+
+    // max and min return the second operand for NaNs
+    t0 = _mm_max_pd(t0, zero);
+    t0 = _mm_max_pd(t0Z, t0);
+    t0 = _mm_max_sd(t0, _mm_unpackhi_pd(t0, t0));
+
+    t1 = _mm_min_pd(t1, _mm_set1_pd(std::numeric_limits<double>::infinity()));
+    t1 = _mm_min_pd(t1Z, t1);
+    t1 = _mm_min_sd(t1, _mm_unpackhi_pd(t1, t1));
+
+    double tNear = _mm_cvtsd_f64(t0);
+    double tFar = _mm_cvtsd_f64(t1);
+#else
+    double tNear = 0.0;
+    double tFar = std::numeric_limits<double>::infinity();
 
     for (int i = 0; i < 3; i++) {
-      double tNear =
-          (minPoint[i] - ray.GetOrigin()[i]) * ray.GetInvDirection()[i];
-      double tFar =
-          (maxPoint[i] - ray.GetOrigin()[i]) * ray.GetInvDirection()[i];
-
-      if (tNear > tFar)
-        std::swap(tNear, tFar);
-
-      t0 = tNear > t0 ? tNear : t0;
-      t1 = tFar < t1 ? tFar : t1;
-      if (t0 > t1)
-        return {false, 0.0, 0.0};
+      const int sign = ray.GetDirectionSign(i);
+      double tEntry = (GetCorner(sign)[i] - ray.GetOrigin()[i]) *
+                      ray.GetInvDirection()[i];
+      double tExit = (GetCorner(1 - sign)[i] - ray.GetOrigin()[i]) *
+                     ray.GetInvDirection()[i];
+
+      tNear = tEntry > tNear ? tEntry : tNear;
+      tFar = tExit < tFar ? tExit : tFar;
     }
-    return {true, t0, t1};
+#endif
+    const bool found = tNear <= tFar;
+    return {found, found ? tNear : 0.0, found ? tFar : 0.0};
+  }
+
+  // Slab test for the rays of the packet, bit i of the result is set if ray
+  // i hits the box. t0[i] and t1[i] are the values Intersect returns.
+  int Intersect(const RayPacket& packet, double t0[RayPacket::size],
+                double t1[RayPacket::size]) const
+  {
+    int hitMask = 0;
+#ifdef VECTOR_SSE2
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d infinity =
+        _mm_set1_pd(std::numeric_limits<double>::infinity());
+
+    for (int i = 0; i < RayPacket::size; i += 2) {
+      __m128d tNear = zero;
+      __m128d tFar = infinity;
+
+      for (int axis = 0; axis < 3; axis++) {
+        const __m128d invDirection =
+            _mm_loadu_pd(&packet.invDirection[axis][i]);
+
+        __m128d tEntry, tExit;
+        SlabDistances(_mm_set1_pd(minPoint[axis]),
+                      _mm_set1_pd(maxPoint[axis]),
+                      _mm_loadu_pd(&packet.origin[axis][i]), invDirection,
+                      _mm_cmplt_pd(invDirection, zero), tEntry, tExit);
+
+        tNear = _mm_max_pd(tEntry, tNear);
+        tFar = _mm_min_pd(tExit, tFar);
+      }
+
+      const __m128d hit = _mm_cmple_pd(tNear, tFar);
+      _mm_storeu_pd(&t0[i], _mm_and_pd(hit, tNear));
+      _mm_storeu_pd(&t1[i], _mm_and_pd(hit, tFar));
+      hitMask |= _mm_movemask_pd(hit) << i;
+    }
+#else
+    for (int i = 0; i < RayPacket::size; i++) {
+      double tNear = 0.0;
+      double tFar = std::numeric_limits<double>::infinity();
+
+      for (int axis = 0; axis < 3; axis++) {
+        const double invDirection = packet.invDirection[axis][i];
+        const auto& entryCorner = GetCorner(std::signbit(invDirection));
+        const auto& exitCorner = GetCorner(!std::signbit(invDirection));
+
+        double tEntry =
+            (entryCorner[axis] - packet.origin[axis][i]) * invDirection;
+        double tExit =
+            (exitCorner[axis] - packet.origin[axis][i]) * invDirection;
+
+        tNear = tEntry > tNear ? tEntry : tNear;
+        tFar = tExit < tFar ? tExit : tFar;
+      }
+
+      const bool found = tNear <= tFar;
+      t0[i] = found ? tNear : 0.0;
+      t1[i] = found ? tFar : 0.0;
+      hitMask |= int(found) << i;
+    }
+#endif
+    return hitMask & ((1 << packet.count) - 1);
   }
 
   static TBoundingBox<T> Union(const TBoundingBox<T>& bounds,
@@ -85,6 +187,26 @@ struct TBoundingBox {
                    std::max(bounds.maxPoint.y, bounds2.maxPoint.y),
                    std::max(bounds.maxPoint.z, bounds2.maxPoint.z)));
   }
+
+private:
+#ifdef VECTOR_SSE2
+  // Entry and exit distances of the slabs, negativeMask selects the lanes
+  // where the ray enters through the max plane.
+  static void SlabDistances(__m128d minPlane, __m128d maxPlane,
+                            __m128d origin, __m128d invDirection,
+                            __m128d negativeMask, __m128d& tEntry,
+                            __m128d& tExit)
+  {
+    const __m128d entryPlane =
+        _mm_or_pd(_mm_and_pd(negativeMask, maxPlane),
+                  _mm_andnot_pd(negativeMask, minPlane));
+    const __m128d exitPlane =
+        _mm_or_pd(_mm_and_pd(negativeMask, minPlane),
+                  _mm_andnot_pd(negativeMask, maxPlane));
+    tEntry = _mm_mul_pd(_mm_sub_pd(entryPlane, origin), invDirection);
+    tExit = _mm_mul_pd(_mm_sub_pd(exitPlane, origin), invDirection);
+  }
+#endif
 };
 
 using BoundingBox = TBoundingBox<double>;
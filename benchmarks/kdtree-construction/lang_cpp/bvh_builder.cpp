@@ -0,0 +1,228 @@
+#include "bvh_builder.h"
+#include "common.h"
+#include "triangle_mesh.h"
+#include <algorithm>
+#include <limits>
+
+BvhBuilder::BvhBuilder(const TriangleMesh& mesh, BuildParams buildParams)
+: mesh(mesh)
+, buildParams(buildParams)
+{
+  if (mesh.GetTrianglesCount() == 0)
+    RuntimeError("can't build bvh for empty mesh");
+}
+
+Bvh BvhBuilder::BuildBvh()
+{
+  const auto trianglesCount = mesh.GetTrianglesCount();
+
+  triangleBounds.resize(trianglesCount);
+  triangleCentroids.resize(trianglesCount);
+  triangleIndices.resize(trianglesCount);
+
+  for (auto i = 0; i < trianglesCount; i++) {
+    triangleBounds[i] = mesh.GetTriangleBounds(i);
+    triangleCentroids[i] =
+        (triangleBounds[i].minPoint + triangleBounds[i].maxPoint) * 0.5f;
+    triangleIndices[i] = i;
+  }
+  bins.resize(buildParams.binsCount);
+
+  binaryNodes.reserve(2 * trianglesCount);
+  BuildBinaryNode(0, trianglesCount, Bvh::maxTraversalDepth);
+
+  // The root of 4-wide BVH is always an interior node, so if the whole
+  // mesh fits into a single leaf then the root has one leaf child.
+  if (binaryNodes[0].trianglesCount > 0) {
+    Bvh::Node root;
+    std::fill(&root.children[0], &root.children[4], Bvh::Node::unusedChild);
+    for (int axis = 0; axis < 3; axis++) {
+      root.boundsMin[axis][0] = binaryNodes[0].bounds.minPoint[axis];
+      root.boundsMax[axis][0] = binaryNodes[0].bounds.maxPoint[axis];
+    }
+    root.children[0] = binaryNodes[0].index;
+    root.trianglesCount[0] = binaryNodes[0].trianglesCount;
+    nodes.push_back(root);
+  }
+  else {
+    CollapseNode(0);
+  }
+
+  std::vector<BinaryNode>().swap(binaryNodes);
+  return Bvh(std::move(nodes), std::move(triangleIndices), mesh);
+}
+
+void BvhBuilder::BuildBinaryNode(int32_t begin, int32_t end, int depth)
+{
+  const int32_t trianglesCount = end - begin;
+
+  BoundingBox_f bounds;
+  BoundingBox_f centroidBounds;
+  for (int32_t i = begin; i < end; i++) {
+    bounds = BoundingBox_f::Union(bounds, triangleBounds[triangleIndices[i]]);
+    centroidBounds.Extend(triangleCentroids[triangleIndices[i]]);
+  }
+
+  const auto nodeIndex = static_cast<int32_t>(binaryNodes.size());
+  binaryNodes.push_back({bounds, begin, trianglesCount});
+
+  if (trianglesCount == 1 || depth == 0)
+    return;
+
+  // select the axis with the largest centroids extent
+  Vector_f extent = centroidBounds.maxPoint - centroidBounds.minPoint;
+  int axis = 0;
+  if (extent.y > extent[axis])
+    axis = 1;
+  if (extent.z > extent[axis])
+    axis = 2;
+
+  if (extent[axis] == 0.0f) { // all centroids are in the same point
+    if (trianglesCount <= buildParams.maxLeafTriangles)
+      return;
+    // split in the middle, this happens only for degenerate meshes
+    int32_t middle = begin + trianglesCount / 2;
+    binaryNodes[nodeIndex].trianglesCount = 0;
+    BuildBinaryNode(begin, middle, depth - 1);
+    binaryNodes[nodeIndex].index = static_cast<int32_t>(binaryNodes.size());
+    BuildBinaryNode(middle, end, depth - 1);
+    return;
+  }
+
+  // bin triangles
+  const int binsCount = buildParams.binsCount;
+  const float binScale = binsCount * (1.0f - 1e-5f) / extent[axis];
+  const float axisStart = centroidBounds.minPoint[axis];
+
+  auto getBin = [&](int32_t triangle) {
+    int bin = static_cast<int>(
+        (triangleCentroids[triangle][axis] - axisStart) * binScale);
+    return std::min(std::max(bin, 0), binsCount - 1);
+  };
+
+  std::fill(bins.begin(), bins.end(), Bin());
+  for (int32_t i = begin; i < end; i++) {
+    int32_t triangle = triangleIndices[i];
+    Bin& bin = bins[getBin(triangle)];
+    bin.bounds = BoundingBox_f::Union(bin.bounds, triangleBounds[triangle]);
+    bin.trianglesCount++;
+  }
+
+  // evaluate SAH for the splits between bins
+  std::vector<float> aboveAreas(binsCount);
+  std::vector<int32_t> aboveCounts(binsCount);
+  BoundingBox_f aboveBounds;
+  int32_t aboveCount = 0;
+  for (int i = binsCount - 1; i > 0; i--) {
+    aboveBounds = BoundingBox_f::Union(aboveBounds, bins[i].bounds);
+    aboveCount += bins[i].trianglesCount;
+    aboveAreas[i] = GetSurfaceArea(aboveBounds);
+    aboveCounts[i] = aboveCount;
+  }
+
+  const float invArea = 1.0f / GetSurfaceArea(bounds);
+  float bestCost = std::numeric_limits<float>::infinity();
+  int bestSplit = -1; // bins [0, bestSplit) go below
+
+  BoundingBox_f belowBounds;
+  int32_t belowCount = 0;
+  for (int i = 1; i < binsCount; i++) {
+    belowBounds = BoundingBox_f::Union(belowBounds, bins[i - 1].bounds);
+    belowCount += bins[i - 1].trianglesCount;
+
+    if (belowCount == 0 || aboveCounts[i] == 0)
+      continue;
+
+    float cost = buildParams.traversalCost +
+                 buildParams.intersectionCost * invArea *
+                     (GetSurfaceArea(belowBounds) * belowCount +
+                      aboveAreas[i] * aboveCounts[i]);
+
+    if (cost < bestCost) {
+      bestCost = cost;
+      bestSplit = i;
+    }
+  }
+
+  const float leafCost = buildParams.intersectionCost * trianglesCount;
+  if (bestSplit == -1 ||
+      (leafCost <= bestCost &&
+       trianglesCount <= buildParams.maxLeafTriangles))
+    return;
+
+  // partition and build children
+  auto middle = std::partition(
+      triangleIndices.begin() + begin, triangleIndices.begin() + end,
+      [&](int32_t triangle) { return getBin(triangle) < bestSplit; });
+  auto middleIndex = static_cast<int32_t>(middle - triangleIndices.begin());
+
+  binaryNodes[nodeIndex].trianglesCount = 0;
+  BuildBinaryNode(begin, middleIndex, depth - 1);
+  binaryNodes[nodeIndex].index = static_cast<int32_t>(binaryNodes.size());
+  BuildBinaryNode(middleIndex, end, depth - 1);
+}
+
+int32_t BvhBuilder::CollapseNode(int32_t binaryNodeIndex)
+{
+  // Gather up to 4 children by repeatedly opening the interior child with
+  // the largest surface area.
+  int32_t children[4] = {binaryNodeIndex + 1,
+                         binaryNodes[binaryNodeIndex].index};
+  int childrenCount = 2;
+
+  while (childrenCount < 4) {
+    int bestChild = -1;
+    float bestArea = -1.0f;
+    for (int i = 0; i < childrenCount; i++) {
+      const BinaryNode& child = binaryNodes[children[i]];
+      if (child.trianglesCount == 0 &&
+          GetSurfaceArea(child.bounds) > bestArea) {
+        bestChild = i;
+        bestArea = GetSurfaceArea(child.bounds);
+      }
+    }
+    if (bestChild == -1)
+      break;
+
+    int32_t opened = children[bestChild];
+    children[bestChild] = opened + 1;
+    children[childrenCount++] = binaryNodes[opened].index;
+  }
+
+  const auto nodeIndex = static_cast<int32_t>(nodes.size());
+  nodes.push_back(Bvh::Node());
+
+  Bvh::Node node;
+  std::fill(&node.children[0], &node.children[4], Bvh::Node::unusedChild);
+  std::fill(&node.trianglesCount[0], &node.trianglesCount[4], 0);
+
+  for (int i = 0; i < 4; i++) {
+    for (int axis = 0; axis < 3; axis++) {
+      node.boundsMin[axis][i] = std::numeric_limits<float>::infinity();
+      node.boundsMax[axis][i] = -std::numeric_limits<float>::infinity();
+    }
+  }
+
+  for (int i = 0; i < childrenCount; i++) {
+    const BinaryNode& child = binaryNodes[children[i]];
+    for (int axis = 0; axis < 3; axis++) {
+      node.boundsMin[axis][i] = child.bounds.minPoint[axis];
+      node.boundsMax[axis][i] = child.bounds.maxPoint[axis];
+    }
+    if (child.trianglesCount > 0) {
+      node.children[i] = child.index;
+      node.trianglesCount[i] = child.trianglesCount;
+    }
+    else {
+      node.children[i] = CollapseNode(children[i]);
+    }
+  }
+  nodes[nodeIndex] = node;
+  return nodeIndex;
+}
+
+float BvhBuilder::GetSurfaceArea(const BoundingBox_f& bounds)
+{
+  Vector_f d = bounds.maxPoint - bounds.minPoint;
+  return 2.0f * (d.x * d.y + d.x * d.z + d.y * d.z);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "bvh.h"
+#include <cstdint>
+#include <vector>
+
+class TriangleMesh;
+
+// Builds binary BVH using binned SAH and then collapses it to 4-wide BVH.
+class BvhBuilder {
+public:
+  struct BuildParams;
+
+  BvhBuilder(const TriangleMesh& mesh, BuildParams buildParams);
+
+  Bvh BuildBvh();
+
+public:
+  struct BuildParams {
+    float intersectionCost = 80;
+    float traversalCost = 1;
+    int binsCount = 16;
+    // leaves with more triangles are created only when the depth limit is
+    // reached or triangles can't be separated
+    int maxLeafTriangles = 8;
+  };
+
+private:
+  struct BinaryNode {
+    BoundingBox_f bounds;
+    // for interior node: index of the second child (first child follows
+    // the node), for leaf: offset in triangleIndices
+    int32_t index;
+    int32_t trianglesCount; // 0 for interior nodes
+  };
+
+  struct Bin {
+    BoundingBox_f bounds;
+    int32_t trianglesCount = 0;
+  };
+
+private:
+  void BuildBinaryNode(int32_t begin, int32_t end, int depth);
+  int32_t CollapseNode(int32_t binaryNodeIndex);
+
+  static float GetSurfaceArea(const BoundingBox_f& bounds);
+
+private:
+  const TriangleMesh& mesh;
+  BuildParams buildParams;
+
+  std::vector<BoundingBox_f> triangleBounds;
+  std::vector<Vector_f> triangleCentroids;
+  std::vector<Bin> bins;
+  std::vector<BinaryNode> binaryNodes;
+
+  std::vector<Bvh::Node> nodes;
+  std::vector<int32_t> triangleIndices;
+};
@@ -0,0 +1,26 @@
+#include "file_format.h"
+
+uint64_t AlignOffset(uint64_t offset)
+{
+  return (offset + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+}
+
+void WriteSection(std::ofstream& file, uint64_t& position, uint64_t offset,
+                  const void* data, uint64_t size)
+{
+  const char padding[sectionAlignment] = {};
+  file.write(padding, offset - position);
+  file.write(static_cast<const char*>(data), size);
+  position = offset + size;
+}
+
+bool ReplaceWithTemporaryFile(const std::string& temporaryFileName,
+                              const std::string& fileName)
+{
+  std::remove(fileName.c_str());
+  if (std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0) {
+    std::remove(temporaryFileName.c_str());
+    return false;
+  }
+  return true;
+}
@@ -35,12 +35,23 @@ KdTree KdTreeBuilder::BuildTree()
 {
   const auto trianglesCount = mesh.GetTrianglesCount();
 
-  // initialize bounding boxes
+  // initialize bounding boxes, the same min/max sequence as
+  // TriangleMesh::GetTriangleBounds written as one loop over the axes
   triangleBounds.resize(trianglesCount);
   BoundingBox_f meshBounds;
 
   for (auto i = 0; i < trianglesCount; i++) {
-    triangleBounds[i] = mesh.GetTriangleBounds(i);
+    const auto& p = mesh.triangles[i].points;
+    const Vector_f& p0 = mesh.vertices[p[0].vertexIndex];
+    const Vector_f& p1 = mesh.vertices[p[1].vertexIndex];
+    const Vector_f& p2 = mesh.vertices[p[2].vertexIndex];
+    for (int axis = 0; axis < 3; axis++) {
+      float v0 = p0[axis];
+      float v1 = p1[axis];
+      float v2 = p2[axis];
+      triangleBounds[i].minPoint[axis] = std::min(std::min(v0, v1), v2);
+      triangleBounds[i].maxPoint[axis] = std::max(std::max(v0, v1), v2);
+    }
     meshBounds = BoundingBox_f::Union(meshBounds, triangleBounds[i]);
   }
 
@@ -283,6 +294,17 @@ KdTreeBuilder::Split KdTreeBuilder::SelectSplitForAxis(
   return bestSplit;
 }
 
+uint64_t KdTreeBuilder::BuildParams::GetHash() const
+{
+  uint64_t hash = HashBytes(&intersectionCost, sizeof(intersectionCost));
+  hash = HashBytes(&traversalCost, sizeof(traversalCost), hash);
+  hash = HashBytes(&emptyBonus, sizeof(emptyBonus), hash);
+  hash = HashBytes(&maxDepth, sizeof(maxDepth), hash);
+  hash = HashBytes(&splitAlongTheLongestAxis, sizeof(splitAlongTheLongestAxis),
+                   hash);
+  return HashBytes(&leafTrianglesLimit, sizeof(leafTrianglesLimit), hash);
+}
+
 KdTreeBuilder::BuildStats::BuildStats(bool enabled)
 : enabled(enabled)
 {
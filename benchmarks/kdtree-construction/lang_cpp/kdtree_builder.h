@@ -27,6 +27,9 @@ public:
     // the actual amout of leaf triangles can be larger
     int leafTrianglesLimit = 2;
     bool collectStats = true;
+
+    // Hash of the parameters that affect the tree structure.
+    uint64_t GetHash() const;
   };
 
   struct BuildStats {
@@ -108,6 +111,6 @@ private:
   std::vector<BoundEdge> edgesBuffer;
   std::vector<int32_t> trianglesBuffer;
 
-  std::vector<KdTree::Node> nodes;
-  std::vector<int32_t> triangleIndices;
+  LargeVector<KdTree::Node> nodes;
+  LargeVector<int32_t> triangleIndices;
 };
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class KdTree;
+class TriangleMesh;
+
+// Compressed kdtree file for storage and transfer. Node fields are split into
+// streams: 2 bit node types, raw split positions and varints for the rest.
+// Above child links are stored relative to the node, leaf triangle references
+// relative to the value predicted from the previous leaf, triangle indices
+// as deltas. The streams are cut into blocks of fixed node and index count
+// that are decoded independently, so decoding runs on multiple threads.
+//
+// Header checks are the same as for the mapped kdtree file (kdtree_file.h).
+bool SaveCompressedKdTreeFile(const std::string& fileName,
+                              const KdTree& kdTree, uint64_t buildParamsHash);
+
+// Returns nullptr if the file is missing, corrupted (when verifyChecksum is
+// set), or was built for a different mesh or different build parameters.
+// Decoded node links and triangle references are always range checked, so
+// even without verifyChecksum the tree never reads outside of its arrays.
+std::unique_ptr<KdTree> LoadCompressedKdTreeFile(const std::string& fileName,
+                                                 const TriangleMesh& mesh,
+                                                 uint64_t buildParamsHash,
+                                                 bool verifyChecksum,
+                                                 int threadsCount);
@@ -0,0 +1,143 @@
+#include "common.h"
+#include "file_format.h"
+#include "kdtree.h"
+#include "kdtree_file.h"
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+namespace {
+enum : uint32_t { kdTreeFileVersion = 1 };
+
+const char kdTreeFileMagic[8] = {'L', 'A', 'K', 'D', 'T', 'R', 'E', 'E'};
+
+struct KdTreeFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrderMark;
+  uint64_t meshHash; // TriangleMesh::GetHash()
+  uint64_t buildParamsHash;
+  uint64_t nodesCount;
+  uint64_t nodesOffset;
+  uint64_t triangleIndicesCount;
+  uint64_t triangleIndicesOffset;
+  double meshBounds[6];
+  uint64_t checksum; // header with zero checksum and both arrays
+};
+
+static_assert(sizeof(KdTreeFileHeader) == 120, "unexpected header layout");
+
+uint64_t GetChecksum(KdTreeFileHeader header, const void* nodes,
+                     const void* triangleIndices)
+{
+  header.checksum = 0;
+  uint64_t hash = HashBytes(&header, sizeof(header));
+  hash = HashBytes(nodes, header.nodesCount * 8, hash);
+  return HashBytes(triangleIndices, header.triangleIndicesCount * 4, hash);
+}
+} // namespace
+
+bool SaveKdTreeFile(const std::string& fileName, const KdTree& kdTree,
+                    uint64_t buildParamsHash)
+{
+  static_assert(sizeof(KdTree::Node) == 8, "unexpected node layout");
+
+  KdTreeFileHeader header;
+  InitFileHeader(header, kdTreeFileMagic, kdTreeFileVersion);
+  header.meshHash = kdTree.mesh.GetHash();
+  header.buildParamsHash = buildParamsHash;
+  header.nodesCount = kdTree.nodes.size();
+  header.nodesOffset = AlignOffset(sizeof(header));
+  header.triangleIndicesCount = kdTree.triangleIndices.size();
+  header.triangleIndicesOffset =
+      AlignOffset(header.nodesOffset + header.nodesCount * 8);
+  for (int axis = 0; axis < 3; axis++) {
+    header.meshBounds[axis] = kdTree.meshBounds.minPoint[axis];
+    header.meshBounds[axis + 3] = kdTree.meshBounds.maxPoint[axis];
+  }
+  header.checksum = GetChecksum(header, kdTree.nodes.data(),
+                                kdTree.triangleIndices.data());
+
+  return WriteFileAtomically(fileName, [&](std::ofstream& file) {
+    uint64_t position = 0;
+    WriteSection(file, position, 0, &header, sizeof(header));
+    WriteSection(file, position, header.nodesOffset, kdTree.nodes.data(),
+                 header.nodesCount * 8);
+    WriteSection(file, position, header.triangleIndicesOffset,
+                 kdTree.triangleIndices.data(),
+                 header.triangleIndicesCount * 4);
+  });
+}
+
+std::unique_ptr<KdTree> LoadKdTreeFile(const std::string& fileName,
+                                       const TriangleMesh& mesh,
+                                       uint64_t buildParamsHash,
+                                       bool verifyContent)
+{
+  auto file = std::unique_ptr<MappedFile>(new MappedFile());
+  KdTreeFileHeader header;
+  if (!file->Open(fileName) || !ReadFileHeader(*file, header))
+    return nullptr;
+
+  if (!CheckFileHeader(header, kdTreeFileMagic, kdTreeFileVersion) ||
+      header.buildParamsHash != buildParamsHash ||
+      header.meshHash != mesh.GetHash())
+    return nullptr;
+
+  // sizes are checked without overflow for any header values
+  const uint64_t fileSize = file->GetSize();
+  if (header.nodesCount == 0 ||
+      header.nodesCount > uint64_t(KdTree::Node::maxNodesCount) ||
+      header.triangleIndicesCount > fileSize / 4 ||
+      header.nodesOffset != AlignOffset(sizeof(header)) ||
+      header.triangleIndicesOffset !=
+          AlignOffset(header.nodesOffset + header.nodesCount * 8) ||
+      header.triangleIndicesOffset + header.triangleIndicesCount * 4 !=
+          fileSize)
+    return nullptr;
+
+  const auto* nodes = reinterpret_cast<const KdTree::Node*>(
+      file->GetData() + header.nodesOffset);
+  const auto* triangleIndices = reinterpret_cast<const int32_t*>(
+      file->GetData() + header.triangleIndicesOffset);
+
+  if (verifyContent) {
+    if (GetChecksum(header, nodes, triangleIndices) != header.checksum)
+      return nullptr;
+
+    const int32_t trianglesCount = mesh.GetTrianglesCount();
+    for (uint64_t i = 0; i < header.nodesCount; i++) {
+      const KdTree::Node& node = nodes[i];
+      if (node.IsInteriorNode()) {
+        if (node.GetAboveChild() <= int64_t(i) ||
+            uint64_t(node.GetAboveChild()) >= header.nodesCount)
+          return nullptr;
+      }
+      else if (node.GetTrianglesCount() == 1) {
+        if (node.GetIndex() < 0 || node.GetIndex() >= trianglesCount)
+          return nullptr;
+      }
+      else if (node.GetTrianglesCount() > 1) {
+        if (node.GetIndex() < 0 ||
+            uint64_t(node.GetIndex()) + node.GetTrianglesCount() >
+                header.triangleIndicesCount)
+          return nullptr;
+      }
+    }
+    for (uint64_t i = 0; i < header.triangleIndicesCount; i++) {
+      if (triangleIndices[i] < 0 || triangleIndices[i] >= trianglesCount)
+        return nullptr;
+    }
+  }
+
+  BoundingBox meshBounds;
+  for (int axis = 0; axis < 3; axis++) {
+    meshBounds.minPoint[axis] = header.meshBounds[axis];
+    meshBounds.maxPoint[axis] = header.meshBounds[axis + 3];
+  }
+
+  ConstArrayView<KdTree::Node> nodesView(nodes, header.nodesCount);
+  ConstArrayView<int32_t> indicesView(triangleIndices,
+                                      header.triangleIndicesCount);
+  return std::unique_ptr<KdTree>(new KdTree(std::move(file), nodesView,
+                                            indicesView, mesh, meshBounds));
+}
@@ -0,0 +1,217 @@
+#include "large_array.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+enum : size_t { hugePageSize = 2 * 1024 * 1024 };
+
+LargeArrayPolicy policy;
+LargeArrayStats stats;
+
+size_t RoundUpToHugePage(size_t bytesCount)
+{
+  return (bytesCount + hugePageSize - 1) & ~(hugePageSize - 1);
+}
+
+#ifndef _WIN32
+// mbind is called through syscall to avoid dependency on libnuma
+enum { mpolBind = 2, mpolInterleave = 3 };
+
+bool PlaceOnNumaNodes(void* address, size_t bytesCount)
+{
+#ifdef SYS_mbind
+  int nodesCount = GetNumaNodesCount();
+  if (policy.numa == LargeArrayPolicy::Numa::Default || nodesCount < 2 ||
+      nodesCount > 64)
+    return false;
+
+  unsigned long nodeMask;
+  int mode;
+  if (policy.numa == LargeArrayPolicy::Numa::Interleave) {
+    nodeMask = (nodesCount == 64) ? ~0ul : (1ul << nodesCount) - 1;
+    mode = mpolInterleave;
+  }
+  else {
+    nodeMask = 1ul << (policy.numaNode % nodesCount);
+    mode = mpolBind;
+  }
+  return syscall(SYS_mbind, address, bytesCount, mode, &nodeMask,
+                 sizeof(nodeMask) * 8, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+void* MapAnonymousMemory(size_t bytesCount, int extraFlags)
+{
+  void* address = mmap(nullptr, bytesCount, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | extraFlags, -1, 0);
+  return (address == MAP_FAILED) ? nullptr : address;
+}
+
+// Returns memory aligned to huge page size.
+void* MapAlignedMemory(size_t bytesCount)
+{
+  uint8_t* address =
+      static_cast<uint8_t*>(MapAnonymousMemory(bytesCount + hugePageSize, 0));
+  if (address == nullptr)
+    return nullptr;
+
+  auto offset = reinterpret_cast<uintptr_t>(address) & (hugePageSize - 1);
+  size_t headSize = (offset == 0) ? 0 : hugePageSize - offset;
+  if (headSize > 0)
+    munmap(address, headSize);
+  munmap(address + headSize + bytesCount, hugePageSize - headSize);
+  return address + headSize;
+}
+#endif
+} // namespace
+
+LargeArrayPolicy SetLargeArrayPolicy(const LargeArrayPolicy& newPolicy)
+{
+  LargeArrayPolicy previousPolicy = policy;
+  policy = newPolicy;
+  return previousPolicy;
+}
+
+const LargeArrayStats& GetLargeArrayStats()
+{
+  return stats;
+}
+
+void ResetLargeArrayStats()
+{
+  stats = LargeArrayStats();
+}
+
+int GetNumaNodesCount()
+{
+#ifdef _WIN32
+  ULONG highestNodeNumber;
+  if (!GetNumaHighestNodeNumber(&highestNodeNumber))
+    return 1;
+  return static_cast<int>(highestNodeNumber) + 1;
+#else
+  // the file contains node ranges, for example: 0-1
+  static int nodesCount = 0;
+  if (nodesCount == 0) {
+    nodesCount = 1;
+    std::ifstream file("/sys/devices/system/node/online");
+    std::string ranges;
+    if (file >> ranges) {
+      auto lastSeparator = ranges.find_last_of("-,");
+      auto lastNode = (lastSeparator == std::string::npos)
+                          ? ranges
+                          : ranges.substr(lastSeparator + 1);
+      nodesCount = std::max(1, atoi(lastNode.c_str()) + 1);
+    }
+  }
+  return nodesCount;
+#endif
+}
+
+int GetCurrentNumaNode()
+{
+#if defined(_WIN32)
+  PROCESSOR_NUMBER processor;
+  GetCurrentProcessorNumberEx(&processor);
+  USHORT node;
+  if (!GetNumaProcessorNodeEx(&processor, &node))
+    return 0;
+  return node;
+#elif defined(SYS_getcpu)
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    return 0;
+  return static_cast<int>(node);
+#else
+  return 0;
+#endif
+}
+
+void* AllocateLargeArray(size_t bytesCount)
+{
+  const size_t mappingSize = RoundUpToHugePage(bytesCount);
+  void* address = nullptr;
+
+#ifdef _WIN32
+  // Large pages on Windows need SeLockMemoryPrivilege, without it
+  // regular pages are used.
+  if (policy.pages != LargeArrayPolicy::Pages::Default &&
+      GetLargePageMinimum() == hugePageSize) {
+    address = VirtualAlloc(nullptr, mappingSize,
+                           MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                           PAGE_READWRITE);
+    if (address != nullptr)
+      stats.explicitHugePagesBytes += mappingSize;
+  }
+  if (address == nullptr)
+    address = VirtualAlloc(nullptr, mappingSize, MEM_RESERVE | MEM_COMMIT,
+                           PAGE_READWRITE);
+#else
+  if (policy.pages == LargeArrayPolicy::Pages::Explicit) {
+#ifdef MAP_HUGETLB
+    address = MapAnonymousMemory(mappingSize, MAP_HUGETLB);
+    if (address != nullptr)
+      stats.explicitHugePagesBytes += mappingSize;
+#endif
+  }
+
+  if (address == nullptr) {
+    address = MapAlignedMemory(mappingSize);
+
+#ifdef MADV_HUGEPAGE
+    if (address != nullptr &&
+        policy.pages != LargeArrayPolicy::Pages::Default &&
+        madvise(address, mappingSize, MADV_HUGEPAGE) == 0)
+      stats.transparentHugePagesBytes += mappingSize;
+#endif
+  }
+
+  if (address != nullptr && PlaceOnNumaNodes(address, mappingSize))
+    stats.numaPlacedBytes += mappingSize;
+#endif
+
+  if (address == nullptr)
+    throw std::bad_alloc();
+
+  stats.allocatedBytes += mappingSize;
+  return address;
+}
+
+void FreeLargeArray(void* pointer, size_t bytesCount)
+{
+#ifdef _WIN32
+  VirtualFree(pointer, 0, MEM_RELEASE);
+#else
+  munmap(pointer, RoundUpToHugePage(bytesCount));
+#endif
+}
+
+int64_t GetPeakResidentSetSize()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return -1;
+  return static_cast<int64_t>(counters.PeakWorkingSetSize);
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+  return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
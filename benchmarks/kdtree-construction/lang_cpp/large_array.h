@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Memory placement policy for large arrays (kd-tree nodes, mesh data).
+// Arrays smaller than largeArrayThreshold always come from operator new.
+struct LargeArrayPolicy {
+  enum class Pages {
+    Default,     // regular pages
+    Transparent, // madvise(MADV_HUGEPAGE) on 2 MB aligned memory
+    Explicit     // MAP_HUGETLB, falls back to Transparent when not available
+  };
+
+  enum class Numa {
+    Default,    // first touch
+    Interleave, // pages are interleaved between all NUMA nodes
+    Bind        // pages are allocated on numaNode
+  };
+
+  Pages pages = Pages::Default;
+  Numa numa = Numa::Default;
+  int numaNode = 0;
+};
+
+// Describes how the memory was actually allocated, so fallbacks are visible.
+struct LargeArrayStats {
+  int64_t allocatedBytes = 0;
+  int64_t explicitHugePagesBytes = 0;
+  int64_t transparentHugePagesBytes = 0;
+  int64_t numaPlacedBytes = 0;
+};
+
+enum : size_t { largeArrayThreshold = 2 * 1024 * 1024 };
+
+// Sets the policy for subsequent allocations and returns the previous one.
+// The policy is process-wide and is not synchronized between threads.
+LargeArrayPolicy SetLargeArrayPolicy(const LargeArrayPolicy& policy);
+const LargeArrayStats& GetLargeArrayStats();
+void ResetLargeArrayStats();
+
+// Peak resident set size of the process in bytes, -1 if not available.
+int64_t GetPeakResidentSetSize();
+
+int GetNumaNodesCount();
+int GetCurrentNumaNode();
+
+void* AllocateLargeArray(size_t bytesCount);
+void FreeLargeArray(void* pointer, size_t bytesCount);
+
+template <typename T>
+struct LargeArrayAllocator {
+  using value_type = T;
+
+  LargeArrayAllocator() = default;
+
+  template <typename T2>
+  LargeArrayAllocator(const LargeArrayAllocator<T2>&)
+  {
+  }
+
+  T* allocate(size_t n)
+  {
+    if (n * sizeof(T) < largeArrayThreshold)
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(AllocateLargeArray(n * sizeof(T)));
+  }
+
+  void deallocate(T* pointer, size_t n)
+  {
+    if (n * sizeof(T) < largeArrayThreshold)
+      ::operator delete(pointer);
+    else
+      FreeLargeArray(pointer, n * sizeof(T));
+  }
+
+  bool operator==(const LargeArrayAllocator&) const
+  {
+    return true;
+  }
+
+  bool operator!=(const LargeArrayAllocator&) const
+  {
+    return false;
+  }
+};
+
+template <typename T>
+using LargeVector = std::vector<T, LargeArrayAllocator<T>>;
+
+// Sets the policy for the lifetime of the object.
+class ScopedLargeArrayPolicy {
+public:
+  explicit ScopedLargeArrayPolicy(const LargeArrayPolicy& policy)
+  : previousPolicy(SetLargeArrayPolicy(policy))
+  {
+  }
+
+  ~ScopedLargeArrayPolicy()
+  {
+    SetLargeArrayPolicy(previousPolicy);
+  }
+
+private:
+  LargeArrayPolicy previousPolicy;
+};
@@ -1,9 +1,18 @@
+#include "bvh_builder.h"
 #include "common.h"
 #include "kdtree_builder.h"
+#include "kdtree_codec.h"
+#include "kdtree_file.h"
+#include "large_array.h"
+#include "mapped_file.h"
+#include "mesh_generator.h"
+#include "mesh_reorder.h"
 #include "triangle_mesh.h"
 #include "triangle_mesh_loader.h"
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 int main(int argc, char* argv[])
@@ -13,9 +22,50 @@ int main(int argc, char* argv[])
                               JoinPath(argv[1], "bunny.stl"),
                               JoinPath(argv[1], "dragon.stl")};
 
+  // the dragon model is not distributed with the sources, the generated mesh
+  // of the same size can be used instead
+  const bool generateData = HasCommandLineOption(argc, argv, "--generate-data");
+  if (generateData && !FileExists(modelFiles[2])) {
+    MeshGeneratorParams params;
+    params.trianglesCount = 871414;
+    int64_t trianglesCount = GenerateMeshStl(modelFiles[2], params);
+    printf("generated %s: %lld triangles\n", modelFiles[2].c_str(),
+           static_cast<long long>(trianglesCount));
+  }
+
+  MeshLoadOptions loadOptions;
+  loadOptions.useFileMapping = !HasCommandLineOption(argc, argv, "--no-mmap");
+  loadOptions.pipelined = HasCommandLineOption(argc, argv, "--pipelined-load");
+  loadOptions.loadNormals = HasCommandLineOption(argc, argv, "--load-normals");
+  if (HasCommandLineOption(argc, argv, "--mesh-cache"))
+    loadOptions.cacheDirectory = GetDirectoryPath(argv[0]);
+
   std::vector<std::unique_ptr<TriangleMesh>> meshes;
+  std::vector<int> loadTimesMsec;
+  std::vector<MeshLoadStats> loadStats;
   for (const auto& modelFile : modelFiles) {
-    meshes.push_back(LoadTriangleMesh(modelFile));
+    Timer loadTimer;
+    loadStats.push_back(MeshLoadStats());
+    meshes.push_back(
+        LoadTriangleMesh(modelFile, loadOptions, &loadStats.back()));
+    loadTimesMsec.push_back(loadTimer.ElapsedMilliseconds());
+  }
+
+  // peak memory is queried before the benchmark allocates anything else
+  if (HasCommandLineOption(argc, argv, "--load-stats")) {
+    for (size_t i = 0; i < meshes.size(); i++) {
+      double seconds = std::max(loadTimesMsec[i], 1) / 1000.0;
+      printf("mesh load [%-6s, %s, %s]: %d ms, %.1f MB/sec\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             loadStats[i].format.c_str(),
+             loadStats[i].pipelined
+                 ? "pipelined"
+                 : (loadStats[i].fileMapped ? "mmap" : "read"),
+             loadTimesMsec[i],
+             (loadStats[i].fileSize / (1024.0 * 1024.0)) / seconds);
+    }
+    printf("peak resident set size after loading: %.2f MB\n",
+           GetPeakResidentSetSize() / (1024.0 * 1024.0));
   }
 
   // run benchmark
@@ -36,7 +86,262 @@ int main(int argc, char* argv[])
                   "model 0: invalid kdtree hash");
   AssertEqualsHex(kdTrees[1].GetHash(), uint64_t(0xc3491ba1f8689922),
                   "model 1: invalid kdtree hash");
-  AssertEqualsHex(kdTrees[2].GetHash(), uint64_t(0x255732f17a964439),
+  AssertEqualsHex(kdTrees[2].GetHash(),
+                  IsGeneratedMeshFile(modelFiles[2])
+                      ? uint64_t(0x0f3faf898a8a846d)
+                      : uint64_t(0x255732f17a964439),
                   "model 2: invalid kdtree hash");
+
+  // kdtree files are the input data for kdtree-raycast benchmark
+  if (generateData) {
+    for (size_t i = 0; i < kdTrees.size(); i++) {
+      const auto kdtreeFile = StripExtension(modelFiles[i]) + ".kdtree";
+      if (!FileExists(kdtreeFile)) {
+        kdTrees[i].SaveToFile(kdtreeFile);
+        printf("generated %s\n", kdtreeFile.c_str());
+      }
+    }
+  }
+
+  // optional measurements, they are not part of the benchmark timing
+  if (HasCommandLineOption(argc, argv, "--bvh")) {
+    for (size_t i = 0; i < meshes.size(); i++) {
+      Timer kdTreeTimer;
+      auto kdTreeBuilder =
+          KdTreeBuilder(*meshes[i], KdTreeBuilder::BuildParams());
+      KdTree kdTree = kdTreeBuilder.BuildTree();
+      int kdTreeTimeMsec = kdTreeTimer.ElapsedMilliseconds();
+
+      Timer bvhTimer;
+      auto bvhBuilder = BvhBuilder(*meshes[i], BvhBuilder::BuildParams());
+      Bvh bvh = bvhBuilder.BuildBvh();
+      int bvhTimeMsec = bvhTimer.ElapsedMilliseconds();
+
+      printf("build [%-6s]: kdtree %d ms, %.2f MB; bvh %d ms, %.2f MB\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             kdTreeTimeMsec, kdTree.GetMemoryUsage() / (1024.0 * 1024.0),
+             bvhTimeMsec, bvh.GetMemoryUsage() / (1024.0 * 1024.0));
+    }
+  }
+
+  // the pass runs before the build, so the tree is built for the new order
+  if (HasCommandLineOption(argc, argv, "--reorder")) {
+    for (size_t i = 0; i < meshes.size(); i++) {
+      Timer reorderTimer;
+      TriangleMesh reorderedMesh(*meshes[i]);
+      ReorderMeshForLocality(reorderedMesh);
+      int reorderTimeMsec = reorderTimer.ElapsedMilliseconds();
+
+      int buildTimesMsec[2];
+      const TriangleMesh* testedMeshes[2] = {meshes[i].get(), &reorderedMesh};
+      for (int k = 0; k < 2; k++) {
+        Timer buildTimer;
+        auto builder =
+            KdTreeBuilder(*testedMeshes[k], KdTreeBuilder::BuildParams());
+        KdTree kdTree = builder.BuildTree();
+        buildTimesMsec[k] = buildTimer.ElapsedMilliseconds();
+      }
+
+      printf("reordered mesh [%-6s]: reorder %d ms, kdtree build %d ms "
+             "(original order %d ms)\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             reorderTimeMsec, buildTimesMsec[1], buildTimesMsec[0]);
+    }
+  }
+
+  // compares loading of the raw kdtree format with the mapped kdtree file,
+  // the files are written next to the executable
+  if (HasCommandLineOption(argc, argv, "--mapped-kdtree")) {
+    const uint64_t buildParamsHash = KdTreeBuilder::BuildParams().GetHash();
+    for (size_t i = 0; i < kdTrees.size(); i++) {
+      const auto name = StripExtension(GetFileName(modelFiles[i]));
+      const auto rawFile =
+          JoinPath(GetDirectoryPath(argv[0]), name + ".kdtree");
+      const auto mappedFile = rawFile + ".mapped";
+
+      kdTrees[i].SaveToFile(rawFile);
+      Timer saveTimer;
+      if (!SaveKdTreeFile(mappedFile, kdTrees[i], buildParamsHash))
+        RuntimeError("failed to write kdtree file: " + mappedFile);
+      int saveTimeMsec = saveTimer.ElapsedMilliseconds();
+
+      Timer rawTimer;
+      KdTree rawKdTree(rawFile, *meshes[i]);
+      int rawTimeMsec = rawTimer.ElapsedMilliseconds();
+
+      Timer mappedTimer;
+      auto mappedKdTree =
+          LoadKdTreeFile(mappedFile, *meshes[i], buildParamsHash, false);
+      double mappedTimeMsec = mappedTimer.ElapsedSeconds() * 1000.0;
+
+      Timer verifiedTimer;
+      auto verifiedKdTree =
+          LoadKdTreeFile(mappedFile, *meshes[i], buildParamsHash, true);
+      int verifiedTimeMsec = verifiedTimer.ElapsedMilliseconds();
+
+      if (mappedKdTree == nullptr || verifiedKdTree == nullptr)
+        RuntimeError("failed to load kdtree file: " + mappedFile);
+      AssertEqualsHex(rawKdTree.GetHash(), kdTrees[i].GetHash(),
+                      "raw kdtree file: different tree for " + name);
+      AssertEqualsHex(mappedKdTree->GetHash(), kdTrees[i].GetHash(),
+                      "mapped kdtree file: different tree for " + name);
+
+      printf("kdtree file [%-6s]: %.2f MB, save %d ms, raw load %d ms, "
+             "mapped load %.3f ms, verified %d ms\n",
+             name.c_str(), kdTrees[i].GetMemoryUsage() / (1024.0 * 1024.0),
+             saveTimeMsec, rawTimeMsec, mappedTimeMsec, verifiedTimeMsec);
+    }
+  }
+
+  // compares the compressed kdtree file with the raw kdtree format, decoding
+  // speed is measured as raw tree bytes produced per second
+  if (HasCommandLineOption(argc, argv, "--compressed-kdtree")) {
+    const uint64_t buildParamsHash = KdTreeBuilder::BuildParams().GetHash();
+    const int threadsCount =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    for (size_t i = 0; i < kdTrees.size(); i++) {
+      const auto name = StripExtension(GetFileName(modelFiles[i]));
+      const auto rawFile =
+          JoinPath(GetDirectoryPath(argv[0]), name + ".kdtree");
+      const auto compressedFile = rawFile + ".z";
+
+      kdTrees[i].SaveToFile(rawFile);
+      Timer encodeTimer;
+      if (!SaveCompressedKdTreeFile(compressedFile, kdTrees[i],
+                                    buildParamsHash))
+        RuntimeError("failed to write kdtree file: " + compressedFile);
+      int encodeTimeMsec = encodeTimer.ElapsedMilliseconds();
+
+      const double rawSize = static_cast<double>(GetFileSize(rawFile));
+      const double compressedSize =
+          static_cast<double>(GetFileSize(compressedFile));
+
+      Timer rawTimer;
+      KdTree rawKdTree(rawFile, *meshes[i]);
+      double rawSeconds = rawTimer.ElapsedSeconds();
+
+      double decodeSeconds[2];
+      const int decodeThreads[2] = {1, threadsCount};
+      for (int k = 0; k < 2; k++) {
+        Timer decodeTimer;
+        auto kdTree = LoadCompressedKdTreeFile(compressedFile, *meshes[i],
+                                               buildParamsHash, false,
+                                               decodeThreads[k]);
+        decodeSeconds[k] = decodeTimer.ElapsedSeconds();
+        if (kdTree == nullptr)
+          RuntimeError("failed to load kdtree file: " + compressedFile);
+        AssertEqualsHex(kdTree->GetHash(), kdTrees[i].GetHash(),
+                        "compressed kdtree file: different tree for " + name);
+      }
+
+      const double gigabyte = 1024.0 * 1024.0 * 1024.0;
+      printf("compressed kdtree [%-6s]: %.2f MB -> %.2f MB (%.1f%%), "
+             "encode %d ms, raw load %.2f GB/sec, decode %.2f GB/sec, "
+             "%d threads %.2f GB/sec\n",
+             name.c_str(), rawSize / (1024.0 * 1024.0),
+             compressedSize / (1024.0 * 1024.0),
+             100.0 * compressedSize / rawSize, encodeTimeMsec,
+             rawSize / gigabyte / rawSeconds,
+             rawSize / gigabyte / decodeSeconds[0], threadsCount,
+             rawSize / gigabyte / decodeSeconds[1]);
+    }
+  }
+
+  // files are evicted from the page cache before each load, so the loaders
+  // are compared on reading the data from the disk
+  if (HasCommandLineOption(argc, argv, "--cold-load")) {
+    std::vector<std::string> files(std::begin(modelFiles),
+                                   std::end(modelFiles));
+    for (int64_t trianglesCount : sizeSweepTrianglesCounts) {
+      auto file = JoinPath(argv[1], GetSizeSweepMeshName(trianglesCount));
+      if (FileExists(file + ".stl"))
+        files.push_back(file + ".stl");
+    }
+
+    struct LoadMode {
+      const char* name;
+      bool useFileMapping;
+      bool pipelined;
+    };
+    LoadMode modes[] = {{"read", false, false},
+                        {"mmap", true, false},
+                        {"pipelined", false, true}};
+
+    for (const auto& file : files) {
+      printf("cold load [%-10s]:", StripExtension(GetFileName(file)).c_str());
+      uint64_t expectedHash = 0;
+      for (const auto& mode : modes) {
+        MeshLoadOptions options;
+        options.useFileMapping = mode.useFileMapping;
+        options.pipelined = mode.pipelined;
+
+        bool evicted = EvictFileFromCache(file);
+        Timer timer;
+        MeshLoadStats stats;
+        auto mesh = LoadTriangleMesh(file, options, &stats);
+        int timeMsec = timer.ElapsedMilliseconds();
+
+        if (&mode == modes)
+          expectedHash = mesh->GetHash();
+        else
+          AssertEqualsHex(mesh->GetHash(), expectedHash,
+                          "cold load: different mesh for " + file);
+
+        double seconds = std::max(timeMsec, 1) / 1000.0;
+        bool last = (&mode == std::end(modes) - 1);
+        printf(" %s %d ms (%.1f MB/sec%s)%s", mode.name, timeMsec,
+               (stats.fileSize / (1024.0 * 1024.0)) / seconds,
+               evicted ? "" : ", warm", last ? "\n" : ",");
+      }
+    }
+  }
+
+  // generated meshes are stored in the data directory together with the
+  // kdtree files; kdtree-raycast --size-sweep generates the same meshes in
+  // its own data directory
+  if (HasCommandLineOption(argc, argv, "--size-sweep")) {
+    const bool large = HasCommandLineOption(argc, argv, "--size-sweep-large");
+    for (int64_t requestedCount : sizeSweepTrianglesCounts) {
+      if (requestedCount > 10000000 && !large)
+        continue;
+
+      const auto name = GetSizeSweepMeshName(requestedCount);
+      const auto meshFile = JoinPath(argv[1], name + ".stl");
+      const auto kdtreeFile = JoinPath(argv[1], name + ".kdtree");
+
+      Timer generateTimer;
+      bool generated = !FileExists(meshFile);
+      if (generated) {
+        MeshGeneratorParams params;
+        params.trianglesCount = requestedCount;
+        GenerateMeshStl(meshFile, params);
+      }
+      int generateTimeMsec = generateTimer.ElapsedMilliseconds();
+
+      Timer loadTimer;
+      auto mesh = LoadTriangleMesh(meshFile, loadOptions);
+      int loadTimeMsec = loadTimer.ElapsedMilliseconds();
+
+      Timer buildTimer;
+      auto builder = KdTreeBuilder(*mesh, KdTreeBuilder::BuildParams());
+      KdTree kdTree = builder.BuildTree();
+      int buildTimeMsec = buildTimer.ElapsedMilliseconds();
+
+      if (!FileExists(kdtreeFile))
+        kdTree.SaveToFile(kdtreeFile);
+
+      double buildSeconds = std::max(buildTimeMsec, 1) / 1000.0;
+      printf("size sweep [%-10s]: %d triangles, ", name.c_str(),
+             mesh->GetTrianglesCount());
+      if (generated)
+        printf("generate %d ms, ", generateTimeMsec);
+      printf("load %d ms, kdtree build %d ms, %.1f KTriangles/sec, "
+             "%.2f MB\n",
+             loadTimeMsec, buildTimeMsec,
+             (mesh->GetTrianglesCount() / 1000.0) / buildSeconds,
+             kdTree.GetMemoryUsage() / (1024.0 * 1024.0));
+    }
+  }
   return 0;
 }
@@ -0,0 +1,113 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+bool MappedFile::Open(const std::string& fileName, Access access)
+{
+  Close();
+
+#ifdef _WIN32
+  DWORD flags = (access == Access::Sequential) ? FILE_FLAG_SEQUENTIAL_SCAN
+                                               : FILE_ATTRIBUTE_NORMAL;
+  HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, flags, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr)
+    return false;
+
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (view == nullptr)
+    return false;
+
+  data = static_cast<const uint8_t*>(view);
+  size = static_cast<size_t>(fileSize.QuadPart);
+#else
+  int file = open(fileName.c_str(), O_RDONLY);
+  if (file == -1)
+    return false;
+
+  struct stat fileStat;
+  if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+    close(file);
+    return false;
+  }
+
+  void* address = mmap(nullptr, static_cast<size_t>(fileStat.st_size),
+                       PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (address == MAP_FAILED)
+    return false;
+
+  if (access == Access::Sequential)
+    madvise(address, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+  data = static_cast<const uint8_t*>(address);
+  size = static_cast<size_t>(fileStat.st_size);
+#endif
+  return true;
+}
+
+void MappedFile::Close()
+{
+  if (data == nullptr)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(const_cast<uint8_t*>(data), size);
+#endif
+  data = nullptr;
+  size = 0;
+}
+
+const uint8_t* MappedFile::GetData() const
+{
+  return data;
+}
+
+size_t MappedFile::GetSize() const
+{
+  return size;
+}
+
+bool EvictFileFromCache(const std::string& fileName)
+{
+#ifdef _WIN32
+  (void)fileName;
+  return false;
+#else
+  int file = open(fileName.c_str(), O_RDONLY);
+  if (file == -1)
+    return false;
+
+  bool evicted = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(file);
+  return evicted;
+#endif
+}
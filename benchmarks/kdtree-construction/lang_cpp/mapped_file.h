@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of the whole file.
+class MappedFile {
+public:
+  enum class Access { Random, Sequential };
+
+  MappedFile() = default;
+  ~MappedFile();
+
+  // Returns false if the file can't be mapped (this includes empty files).
+  bool Open(const std::string& fileName, Access access = Access::Random);
+  void Close();
+
+  const uint8_t* GetData() const;
+  size_t GetSize() const;
+
+private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+};
+
+// Drops cached pages of the file, so the next read comes from the disk.
+// Used to measure cold-cache loading; returns false if not supported.
+bool EvictFileFromCache(const std::string& fileName);
@@ -0,0 +1,219 @@
+#include "common.h"
+#include "mesh_generator.h"
+#include "vector.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+namespace {
+const char generatorSignature[] = "language-arena procedural mesh";
+
+enum { noiseOctaves = 4, facetSize = 50, facetsPerWrite = 16384 };
+
+const double noiseFrequency = 1.5;
+const double displacementAmplitude = 0.25;
+const double meshScale = 100.0;
+
+uint64_t MixBits(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return x;
+}
+
+// Pseudo-random value in [-1, 1] assigned to the integer lattice point.
+double LatticeValue(int64_t x, int64_t y, int64_t z, uint64_t seed)
+{
+  uint64_t hash = MixBits(seed ^ MixBits(uint64_t(x) * 0x9e3779b97f4a7c15ull ^
+                                         uint64_t(y) * 0xc2b2ae3d27d4eb4full ^
+                                         uint64_t(z) * 0x165667b19e3779f9ull));
+  return static_cast<double>(hash >> 11) / double(uint64_t(1) << 52) - 1.0;
+}
+
+double Smoothstep(double t)
+{
+  return t * t * (3.0 - 2.0 * t);
+}
+
+double ValueNoise(const Vector& p, uint64_t seed)
+{
+  double fx = std::floor(p.x), fy = std::floor(p.y), fz = std::floor(p.z);
+  int64_t x = static_cast<int64_t>(fx);
+  int64_t y = static_cast<int64_t>(fy);
+  int64_t z = static_cast<int64_t>(fz);
+  double tx = Smoothstep(p.x - fx);
+  double ty = Smoothstep(p.y - fy);
+  double tz = Smoothstep(p.z - fz);
+
+  double values[2][2][2];
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      for (int k = 0; k < 2; k++)
+        values[i][j][k] = LatticeValue(x + i, y + j, z + k, seed);
+
+  auto lerp = [](double a, double b, double t) { return a + (b - a) * t; };
+  double v00 = lerp(values[0][0][0], values[1][0][0], tx);
+  double v10 = lerp(values[0][1][0], values[1][1][0], tx);
+  double v01 = lerp(values[0][0][1], values[1][0][1], tx);
+  double v11 = lerp(values[0][1][1], values[1][1][1], tx);
+  return lerp(lerp(v00, v10, ty), lerp(v01, v11, ty), tz);
+}
+
+// Maps the point on the unit sphere to the point of the displaced surface.
+Vector DisplacePoint(const Vector& direction, uint64_t seed)
+{
+  double noise = 0.0;
+  double amplitude = 0.5;
+  double frequency = noiseFrequency;
+  for (int octave = 0; octave < noiseOctaves; octave++) {
+    noise += amplitude * ValueNoise(direction * frequency, seed + octave);
+    amplitude *= 0.5;
+    frequency *= 2.0;
+  }
+  return direction * (meshScale * (1.0 + displacementAmplitude * noise));
+}
+
+struct Icosahedron {
+  Vector vertices[12];
+  int faces[20][3];
+};
+
+Icosahedron CreateIcosahedron()
+{
+  const double phi = (1.0 + std::sqrt(5.0)) / 2.0;
+  Icosahedron icosahedron = {
+      {Vector(-1, phi, 0), Vector(1, phi, 0), Vector(-1, -phi, 0),
+       Vector(1, -phi, 0), Vector(0, -1, phi), Vector(0, 1, phi),
+       Vector(0, -1, -phi), Vector(0, 1, -phi), Vector(phi, 0, -1),
+       Vector(phi, 0, 1), Vector(-phi, 0, -1), Vector(-phi, 0, 1)},
+      {{0, 11, 5}, {0, 5, 1},  {0, 1, 7},   {0, 7, 10}, {0, 10, 11},
+       {1, 5, 9},  {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+       {3, 9, 4},  {3, 4, 2},  {3, 2, 6},   {3, 6, 8},  {3, 8, 9},
+       {4, 9, 5},  {2, 4, 11}, {6, 2, 10},  {8, 6, 7},  {9, 8, 1}}};
+  return icosahedron;
+}
+
+void WriteVector(uint8_t* data, const Vector& v)
+{
+  float f[3] = {static_cast<float>(v.x), static_cast<float>(v.y),
+                static_cast<float>(v.z)};
+  memcpy(data, f, sizeof(f));
+}
+} // namespace
+
+int64_t GenerateMeshStl(const std::string& fileName,
+                        const MeshGeneratorParams& params)
+{
+  const int64_t n = std::max<int64_t>(
+      1, std::llround(std::sqrt(params.trianglesCount / 20.0)));
+  const int64_t trianglesCount = 20 * n * n;
+  if (trianglesCount > std::numeric_limits<int32_t>::max())
+    RuntimeError("too many triangles requested for generated mesh");
+
+  std::ofstream file(fileName, std::ios_base::out | std::ios_base::binary);
+  if (!file)
+    RuntimeError("failed to open file for writing: " + fileName);
+
+  char header[80] = {};
+  snprintf(header, sizeof(header), "%s: seed %u, %lld triangles",
+           generatorSignature, params.seed,
+           static_cast<long long>(trianglesCount));
+  uint32_t trianglesCount32 = static_cast<uint32_t>(trianglesCount);
+  file.write(header, sizeof(header));
+  file.write(reinterpret_cast<const char*>(&trianglesCount32), 4);
+
+  const Icosahedron icosahedron = CreateIcosahedron();
+  std::vector<Vector> points;
+  std::vector<uint8_t> buffer;
+  buffer.reserve(facetsPerWrite * facetSize);
+
+  auto writeFacet = [&file, &buffer](const Vector& a, const Vector& b,
+                                     const Vector& c) {
+    Vector normal = CrossProduct(b - a, c - a);
+    double length = normal.Length();
+    if (length > 0.0)
+      normal = normal / length;
+
+    size_t offset = buffer.size();
+    buffer.resize(offset + facetSize);
+    WriteVector(&buffer[offset], normal);
+    WriteVector(&buffer[offset + 12], a);
+    WriteVector(&buffer[offset + 24], b);
+    WriteVector(&buffer[offset + 36], c);
+    buffer[offset + 48] = 0; // attribute byte count
+    buffer[offset + 49] = 0;
+
+    if (buffer.size() == facetsPerWrite * facetSize) {
+      file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+      buffer.clear();
+    }
+  };
+
+  for (const auto& face : icosahedron.faces) {
+    // Grid point (i, j) is (a * (n - i - j) + b * i + c * j) / n. The terms
+    // are summed in the order of icosahedron vertex indices and zero terms
+    // are skipped, so the points on the shared edges are bitwise equal for
+    // both faces and the STL loader welds them.
+    int order[3] = {0, 1, 2};
+    std::sort(order, order + 3,
+              [&face](int a, int b) { return face[a] < face[b]; });
+
+    points.resize(static_cast<size_t>((n + 1) * (n + 2) / 2));
+    auto pointIndex = [n](int64_t i, int64_t j) {
+      return static_cast<size_t>(i * (n + 1) - i * (i - 1) / 2 + j);
+    };
+
+    for (int64_t i = 0; i <= n; i++) {
+      for (int64_t j = 0; j <= n - i; j++) {
+        const int64_t weights[3] = {n - i - j, i, j};
+        Vector sum;
+        for (int k : order) {
+          if (weights[k] != 0)
+            sum += icosahedron.vertices[face[k]] * double(weights[k]);
+        }
+        Vector p = sum / double(n);
+        points[pointIndex(i, j)] = DisplacePoint(p / p.Length(), params.seed);
+      }
+    }
+
+    for (int64_t i = 0; i < n; i++) {
+      for (int64_t j = 0; j < n - i; j++) {
+        writeFacet(points[pointIndex(i, j)], points[pointIndex(i + 1, j)],
+                   points[pointIndex(i, j + 1)]);
+        if (i + j < n - 1)
+          writeFacet(points[pointIndex(i + 1, j)],
+                     points[pointIndex(i + 1, j + 1)],
+                     points[pointIndex(i, j + 1)]);
+      }
+    }
+  }
+
+  file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+  if (!file)
+    RuntimeError("failed to write generated mesh: " + fileName);
+  return trianglesCount;
+}
+
+std::string GetSizeSweepMeshName(int64_t trianglesCount)
+{
+  if (trianglesCount % 1000000 == 0)
+    return "sweep_" + std::to_string(trianglesCount / 1000000) + "m";
+  if (trianglesCount % 1000 == 0)
+    return "sweep_" + std::to_string(trianglesCount / 1000) + "k";
+  return "sweep_" + std::to_string(trianglesCount);
+}
+
+bool IsGeneratedMeshFile(const std::string& fileName)
+{
+  std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
+  char header[sizeof(generatorSignature) - 1];
+  file.read(header, sizeof(header));
+  return file && memcmp(header, generatorSignature, sizeof(header)) == 0;
+}
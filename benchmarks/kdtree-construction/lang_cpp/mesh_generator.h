@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct MeshGeneratorParams {
+  // Requested number of triangles, the generated mesh has 20 * n^2
+  // triangles where n is chosen to get the closest count.
+  int64_t trianglesCount = 1000000;
+  uint32_t seed = 1;
+};
+
+// Writes binary STL file with a closed, watertight surface: icosahedron with
+// each face split into n x n triangles, projected to the sphere and displaced
+// with fractal value noise. Only correctly rounded floating point operations
+// are used, so the file is the same on all platforms for the same parameters.
+// The mesh is streamed to the file, so the memory usage does not depend on
+// the number of triangles. Returns the number of written triangles.
+int64_t GenerateMeshStl(const std::string& fileName,
+                        const MeshGeneratorParams& params);
+
+// Triangle counts of the generated meshes used by --size-sweep option.
+// The last size is measured only with --size-sweep-large option.
+const int64_t sizeSweepTrianglesCounts[] = {10000, 100000, 1000000, 10000000,
+                                            50000000};
+
+// File name without extension, for example "sweep_100k" or "sweep_10m".
+std::string GetSizeSweepMeshName(int64_t trianglesCount);
+
+// Checks the STL header for the signature written by GenerateMeshStl.
+bool IsGeneratedMeshFile(const std::string& fileName);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class TriangleMesh;
+
+// Sorts triangles along the Morton curve of their centroids and renumbers
+// vertices in the order of first use, so triangles that are close in space
+// are also close in memory. Returns the mapping from the old triangle index
+// to the new one, structures built for the original order can be updated
+// with it (see KdTree constructor).
+std::vector<int32_t> ReorderMeshForLocality(TriangleMesh& mesh);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Splits a text buffer into tokens separated by whitespace (any byte <= ' ').
+// The buffer is scanned 16 bytes at a time with SSE2 when it is available.
+class TextParser {
+public:
+  struct Token {
+    const char* data = nullptr;
+    size_t size = 0;
+
+    bool IsEmpty() const
+    {
+      return size == 0;
+    }
+
+    // Tokens are short, so an inline loop is faster than strlen + memcmp.
+    bool operator==(const char* literal) const
+    {
+      for (size_t i = 0; i < size; i++) {
+        if (data[i] != literal[i])
+          return false;
+      }
+      return literal[size] == '\0';
+    }
+
+    bool operator!=(const char* literal) const
+    {
+      return !(*this == literal);
+    }
+  };
+
+  TextParser(const uint8_t* data, size_t size);
+
+  // Skips whitespace and returns true if there are no more tokens.
+  bool AtEnd();
+
+  // Returns an empty token when the end of the buffer is reached.
+  Token NextToken();
+
+  // Returns an empty token when the end of the current line is reached,
+  // the line terminator is not consumed.
+  Token NextTokenInLine();
+
+  // Parses the next token as a float, the result is correctly rounded.
+  bool ParseFloat(float& value);
+
+  // Skips the rest of the current line including the line terminator.
+  void SkipLine();
+
+  size_t GetOffset() const;
+
+private:
+  const char* begin;
+  const char* current;
+  const char* end;
+};
+
+// Parses [begin, end) as a decimal integer with an optional sign.
+bool ParseInteger(const char* begin, const char* end, int64_t& value);
+
+// Parses [begin, end) as a decimal floating point number. The common case of
+// at most 19 significant digits and a small exponent is handled with exact
+// double arithmetic, everything else is passed to strtof.
+bool ParseFloat(const char* begin, const char* end, float& value);
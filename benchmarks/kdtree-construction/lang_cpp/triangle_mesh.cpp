@@ -1,4 +1,5 @@
 #include "bounding_box.h"
+#include "common.h"
 #include "triangle_mesh.h"
 
 TriangleMesh::TriangleMesh()
@@ -27,3 +28,10 @@ BoundingBox_f TriangleMesh::GetBounds() const
   }
   return bounds;
 }
+
+uint64_t TriangleMesh::GetHash() const
+{
+  uint64_t hash =
+      HashBytes(vertices.data(), vertices.size() * sizeof(Vector_f));
+  return HashBytes(triangles.data(), triangles.size() * sizeof(Triangle), hash);
+}
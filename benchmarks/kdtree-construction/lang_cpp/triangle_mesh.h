@@ -1,6 +1,7 @@
 #pragma once
 
 #include "bounding_box.h"
+#include "large_array.h"
 #include "vector.h"
 #include <array>
 #include <cstdint>
@@ -23,8 +24,12 @@ public:
   BoundingBox_f GetTriangleBounds(int32_t triangleIndex) const;
   BoundingBox_f GetBounds() const;
 
+  // Hash of vertices and triangles, normals are not included.
+  uint64_t GetHash() const;
+
 public:
-  std::vector<Vector_f> vertices;
+  LargeVector<Vector_f> vertices;
+  // Facet normals are optional: either empty or one normal per triangle.
   std::vector<Vector_f> normals;
-  std::vector<Triangle> triangles;
+  LargeVector<Triangle> triangles;
 };
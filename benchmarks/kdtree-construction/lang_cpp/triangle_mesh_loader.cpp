@@ -1,34 +1,139 @@
 #include "common.h"
+#include "mapped_file.h"
+#include "mesh_file.h"
+#include "text_parser.h"
 #include "triangle_mesh.h"
 #include "triangle_mesh_loader.h"
 #include "vector.h"
 #include <algorithm>
 #include <array>
+#include <cctype>
+#include <condition_variable>
 #include <cstring>
+#include <exception>
 #include <fstream>
 #include <functional>
-#include <unordered_map>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
-std::unique_ptr<TriangleMesh> LoadTriangleMesh(const std::string& fileName)
-{
-  enum {
-    headerSize = 80,
-    facetSize = 50,
-    maxVerticesCount = static_cast<size_t>(std::numeric_limits<int32_t>::max()),
-    maxTrianglesCount = static_cast<size_t>(std::numeric_limits<int32_t>::max())
-  };
+namespace {
+enum {
+  headerSize = 80,
+  facetSize = 50,
+  maxVerticesCount = static_cast<size_t>(std::numeric_limits<int32_t>::max()),
+  maxTrianglesCount = static_cast<size_t>(std::numeric_limits<int32_t>::max()),
+  pipelineChunkFacets = 65536
+};
 
-  struct VectorHash {
-    std::size_t operator()(const Vector_f& v) const
-    {
-      size_t h1 = std::hash<float>()(v.x);
-      size_t h2 = std::hash<float>()(v.y);
-      size_t h3 = std::hash<float>()(v.z);
-      return CombineHashes(h1, CombineHashes(h2, h3));
+// Maps vertex positions to indices of the unique vertices. Open addressing
+// with linear probing; slots store only the index, positions are compared
+// against the vertex array, so the table stays small and cache friendly.
+// Positions are compared with operator== as before: -0.0 and +0.0 are the
+// same vertex and vertices with NaN coordinates are never merged.
+class VertexIndexMap {
+public:
+  VertexIndexMap(LargeVector<Vector_f>& vertices, size_t expectedCount)
+  : vertices(vertices)
+  {
+    size_t capacity = 16;
+    while (capacity < expectedCount * 2)
+      capacity *= 2;
+    slots.assign(capacity, emptySlot);
+  }
+
+  // Returns the index of the vertex equal to v, new vertices are appended
+  // to the vertex array, so indices follow first-seen order.
+  int32_t FindOrInsert(const Vector_f& v)
+  {
+    int32_t index;
+    if (!TryFindOrInsert(v, index))
+      RuntimeError("too large model: too many vertices");
+    return index;
+  }
+
+  // The same as FindOrInsert but returns false instead of reporting the
+  // error when a new vertex doesn't fit into the index range.
+  bool TryFindOrInsert(const Vector_f& v, int32_t& index)
+  {
+    size_t mask = slots.size() - 1;
+    size_t slot = Hash(v) & mask;
+    while (slots[slot] != emptySlot) {
+      if (vertices[slots[slot]] == v) {
+        index = slots[slot];
+        return true;
+      }
+      slot = (slot + 1) & mask;
     }
-  };
 
+    if (vertices.size() >= maxVerticesCount)
+      return false;
+
+    index = static_cast<int32_t>(vertices.size());
+    vertices.push_back(v);
+    slots[slot] = index;
+
+    if (vertices.size() * 2 > slots.size())
+      Grow();
+    return true;
+  }
+
+private:
+  enum : int32_t { emptySlot = -1 };
+
+  static uint32_t FloatBits(float f)
+  {
+    if (f == 0.0f) // -0.0 and +0.0 should have the same hash
+      return 0;
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+  }
+
+  static size_t Hash(const Vector_f& v)
+  {
+    uint64_t h = FloatBits(v.x);
+    h = h * 0x9e3779b97f4a7c15ull + FloatBits(v.y);
+    h = h * 0x9e3779b97f4a7c15ull + FloatBits(v.z);
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return static_cast<size_t>(h);
+  }
+
+  void Grow()
+  {
+    std::vector<int32_t> oldSlots(slots.size() * 2, emptySlot);
+    oldSlots.swap(slots);
+
+    size_t mask = slots.size() - 1;
+    for (int32_t index : oldSlots) {
+      if (index == emptySlot)
+        continue;
+      size_t slot = Hash(vertices[index]) & mask;
+      while (slots[slot] != emptySlot)
+        slot = (slot + 1) & mask;
+      slots[slot] = index;
+    }
+  }
+
+  LargeVector<Vector_f>& vertices;
+  std::vector<int32_t> slots;
+};
+
+// Facets are not 4-byte aligned in the file, so the values are copied
+// instead of being accessed through float pointers.
+Vector_f ReadVector(const uint8_t* data)
+{
+  float f[3];
+  memcpy(f, data, sizeof(f));
+  return Vector_f(f[0], f[1], f[2]);
+}
+
+std::vector<uint8_t> ReadFileContent(const std::string& fileName)
+{
   std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
   if (!file)
     RuntimeError("failed to open file: " + fileName);
@@ -47,16 +152,20 @@ std::unique_ptr<TriangleMesh> LoadTriangleMesh(const std::string& fileName)
   if (!file)
     RuntimeError("failed to read file content: " + fileName);
 
-  // validate file content
-  std::array<uint8_t, 5> asciiStlHeader = {0x73, 0x6f, 0x6c, 0x69, 0x64};
-  if (memcmp(fileContent.data(), asciiStlHeader.data(), 5) == 0)
-    RuntimeError("ascii stl files are not supported: " + fileName);
+  return fileContent;
+}
 
-  if (fileSize < headerSize + 4)
+std::unique_ptr<TriangleMesh> ParseBinaryStl(const uint8_t* data,
+                                             size_t dataSize,
+                                             const std::string& fileName,
+                                             bool loadNormals)
+{
+  // validate file content
+  if (dataSize < headerSize + 4)
     RuntimeError("invalid binary stl file: " + fileName);
 
-  uint32_t numTriangles =
-      *reinterpret_cast<uint32_t*>(fileContent.data() + headerSize);
+  uint32_t numTriangles;
+  memcpy(&numTriangles, data + headerSize, sizeof(numTriangles));
 
   if (numTriangles > maxTrianglesCount)
     RuntimeError("too large model: too many triangles: " + fileName);
@@ -64,43 +173,929 @@ std::unique_ptr<TriangleMesh> LoadTriangleMesh(const std::string& fileName)
   auto expectedSize =
       headerSize + 4 + static_cast<size_t>(numTriangles) * facetSize;
 
-  if (fileContent.size() != expectedSize)
+  if (dataSize != expectedSize)
     RuntimeError("incorrect size of binary stl file: " + fileName);
 
   // read mesh data
   auto mesh = std::unique_ptr<TriangleMesh>(new TriangleMesh());
-  mesh->normals.resize(numTriangles);
+  if (loadNormals)
+    mesh->normals.resize(numTriangles);
   mesh->triangles.resize(numTriangles);
 
-  std::unordered_map<Vector_f, int32_t, VectorHash> uniqueVertices;
-  uint8_t* dataPtr = fileContent.data() + headerSize + 4;
+  // closed meshes have about half as many vertices as triangles
+  VertexIndexMap uniqueVertices(mesh->vertices, numTriangles / 2);
+  const uint8_t* dataPtr = data + headerSize + 4;
   for (uint32_t i = 0; i < numTriangles; i++) {
-    float* f = reinterpret_cast<float*>(dataPtr);
-    mesh->normals[i] = Vector_f(f[0], f[1], f[2]);
-    f += 3;
+    const uint8_t* f = dataPtr;
+    if (loadNormals)
+      mesh->normals[i] = ReadVector(f);
+    f += 3 * sizeof(float);
 
     for (int k = 0; k < 3; ++k) {
-      Vector_f v(f[0], f[1], f[2]);
-      f += 3;
+      Vector_f v = ReadVector(f);
+      f += 3 * sizeof(float);
+      mesh->triangles[i].points[k].vertexIndex = uniqueVertices.FindOrInsert(v);
+    }
+    dataPtr += facetSize;
+  }
+  LargeVector<Vector_f>(mesh->vertices).swap(mesh->vertices);
+  return mesh;
+}
+
+std::unique_ptr<TriangleMesh> ParseAsciiStl(const uint8_t* data,
+                                            size_t dataSize,
+                                            const std::string& fileName,
+                                            bool loadNormals)
+{
+  // ascii facet takes about 250 bytes
+  const size_t expectedTrianglesCount = dataSize / 250;
+
+  auto mesh = std::unique_ptr<TriangleMesh>(new TriangleMesh());
+  if (loadNormals)
+    mesh->normals.reserve(expectedTrianglesCount);
+  mesh->triangles.reserve(expectedTrianglesCount);
+
+  VertexIndexMap uniqueVertices(mesh->vertices, expectedTrianglesCount / 2);
+  TextParser parser(data, dataSize);
+
+  auto parseError = [&parser, &fileName](const std::string& message) {
+    RuntimeError("invalid ascii stl file: " + message + " at offset " +
+                 std::to_string(parser.GetOffset()) + ": " + fileName);
+  };
+
+  auto expectKeyword = [&parser, &parseError](const char* keyword) {
+    if (parser.NextToken() != keyword)
+      parseError(std::string("expected '") + keyword + "'");
+  };
+
+  auto parseVector = [&parser, &parseError]() -> Vector_f {
+    Vector_f v;
+    if (!parser.ParseFloat(v.x) || !parser.ParseFloat(v.y) ||
+        !parser.ParseFloat(v.z))
+      parseError("invalid number");
+    return v;
+  };
+
+  while (!parser.AtEnd()) {
+    TextParser::Token token = parser.NextToken();
+
+    // solid names are arbitrary text, several solids might be present
+    if (token == "solid" || token == "endsolid") {
+      parser.SkipLine();
+      continue;
+    }
+
+    if (token != "facet")
+      parseError("expected 'facet'");
 
-      int32_t vertexIndex;
+    if (mesh->triangles.size() >= maxTrianglesCount)
+      RuntimeError("too large model: too many triangles: " + fileName);
 
-      auto iterator = uniqueVertices.find(v);
-      if (iterator == uniqueVertices.cend()) {
-        if (mesh->vertices.size() > maxVerticesCount) {
-          RuntimeError("too large model: too many vertices");
+    expectKeyword("normal");
+    Vector_f normal = parseVector();
+    expectKeyword("outer");
+    expectKeyword("loop");
+
+    TriangleMesh::Triangle triangle;
+    for (int k = 0; k < 3; ++k) {
+      expectKeyword("vertex");
+      triangle.points[k].vertexIndex =
+          uniqueVertices.FindOrInsert(parseVector());
+    }
+
+    expectKeyword("endloop");
+    expectKeyword("endfacet");
+
+    if (loadNormals)
+      mesh->normals.push_back(normal);
+    mesh->triangles.push_back(triangle);
+  }
+
+  std::vector<Vector_f>(mesh->normals).swap(mesh->normals);
+  LargeVector<TriangleMesh::Triangle>(mesh->triangles).swap(mesh->triangles);
+  LargeVector<Vector_f>(mesh->vertices).swap(mesh->vertices);
+  return mesh;
+}
+
+// Some binary files also start with "solid", so the file size is checked too.
+bool IsAsciiStl(const uint8_t* data, size_t dataSize)
+{
+  std::array<uint8_t, 5> asciiStlHeader = {0x73, 0x6f, 0x6c, 0x69, 0x64};
+  if (dataSize < asciiStlHeader.size() ||
+      memcmp(data, asciiStlHeader.data(), asciiStlHeader.size()) != 0)
+    return false;
+
+  if (dataSize < headerSize + 4)
+    return true;
+
+  uint32_t numTriangles;
+  memcpy(&numTriangles, data + headerSize, sizeof(numTriangles));
+  return dataSize !=
+         headerSize + 4 + static_cast<size_t>(numTriangles) * facetSize;
+}
+
+std::unique_ptr<TriangleMesh> ParseStl(const uint8_t* data, size_t dataSize,
+                                       const std::string& fileName,
+                                       bool loadNormals, MeshLoadStats* stats)
+{
+  bool ascii = IsAsciiStl(data, dataSize);
+  if (stats) {
+    stats->format = ascii ? "ascii stl" : "binary stl";
+    stats->fileSize = static_cast<int64_t>(dataSize);
+  }
+  return ascii ? ParseAsciiStl(data, dataSize, fileName, loadNormals)
+               : ParseBinaryStl(data, dataSize, fileName, loadNormals);
+}
+
+// Binary STL loading that overlaps file reads with parsing. The reader thread
+// fills a bounded ring of chunk buffers, parser threads weld each chunk into
+// chunk-local vertices and the calling thread merges the chunks in file
+// order, so the result is the same as ParseBinaryStl produces. Returns
+// nullptr if the file is not a valid binary STL file, the regular loader
+// reports the error in this case. Worker threads are stopped and joined
+// before any error is reported or exception is propagated.
+std::unique_ptr<TriangleMesh> LoadBinaryStlPipelined(
+    const std::string& fileName, bool loadNormals)
+{
+  std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
+  if (!file)
+    return nullptr;
+
+  file.seekg(0, std::ios_base::end);
+  auto fileSize = file.tellg();
+  file.seekg(0, std::ios_base::beg);
+
+  uint8_t header[headerSize + 4];
+  if (fileSize == std::streampos(-1) || fileSize < std::streampos(84) ||
+      !file.read(reinterpret_cast<char*>(header), sizeof(header)))
+    return nullptr;
+
+  if (IsAsciiStl(header, static_cast<size_t>(fileSize)))
+    return nullptr;
+
+  uint32_t numTriangles;
+  memcpy(&numTriangles, header + headerSize, sizeof(numTriangles));
+  if (numTriangles > maxTrianglesCount ||
+      static_cast<size_t>(fileSize) !=
+          headerSize + 4 + static_cast<size_t>(numTriangles) * facetSize)
+    return nullptr;
+
+  auto mesh = std::unique_ptr<TriangleMesh>(new TriangleMesh());
+  if (loadNormals)
+    mesh->normals.resize(numTriangles);
+  mesh->triangles.resize(numTriangles);
+
+  struct Chunk {
+    std::vector<uint8_t> data;
+    LargeVector<Vector_f> vertices;
+    bool parsed = false;
+  };
+
+  const uint32_t chunksCount =
+      (numTriangles + pipelineChunkFacets - 1) / pipelineChunkFacets;
+  const uint32_t parsersCount =
+      std::max(1u, std::thread::hardware_concurrency());
+  std::vector<Chunk> chunks(2 * parsersCount + 2);
+
+  std::mutex mutex;
+  std::condition_variable stateChanged;
+  uint32_t readCount = 0;
+  uint32_t parseCount = 0;
+  uint32_t mergedCount = 0;
+  bool readFailed = false;
+  bool stopped = false; // set when workers have to exit early
+  std::exception_ptr workerException;
+
+  auto getTrianglesCount = [numTriangles](uint32_t chunkIndex) {
+    return std::min<uint32_t>(pipelineChunkFacets,
+                              numTriangles - chunkIndex * pipelineChunkFacets);
+  };
+
+  // exceptions of the workers are passed to the calling thread
+  auto runWorker = [&](const std::function<void()>& work) {
+    try {
+      work();
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!workerException)
+        workerException = std::current_exception();
+      stopped = true;
+      stateChanged.notify_all();
+    }
+  };
+
+  auto read = [&]() {
+    for (uint32_t i = 0; i < chunksCount; i++) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        stateChanged.wait(lock, [&]() {
+          return i - mergedCount < chunks.size() || readFailed || stopped;
+        });
+        if (readFailed || stopped)
+          return;
+      }
+      Chunk& chunk = chunks[i % chunks.size()];
+      chunk.data.resize(getTrianglesCount(i) * facetSize);
+      bool success = static_cast<bool>(
+          file.read(reinterpret_cast<char*>(chunk.data.data()),
+                    static_cast<std::streamsize>(chunk.data.size())));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (success)
+        readCount = i + 1;
+      else
+        readFailed = true;
+      stateChanged.notify_all();
+      if (!success)
+        return;
+    }
+  };
+
+  auto parse = [&]() {
+    for (;;) {
+      uint32_t i;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        stateChanged.wait(lock, [&]() {
+          return parseCount < readCount || parseCount == chunksCount ||
+                 readFailed || stopped;
+        });
+        if (parseCount == chunksCount || readFailed || stopped)
+          return;
+        i = parseCount++;
+      }
+
+      // indices of chunk vertices are stored in the mesh and replaced with
+      // global indices during the merge
+      Chunk& chunk = chunks[i % chunks.size()];
+      const uint32_t trianglesCount = getTrianglesCount(i);
+      const size_t firstTriangle = size_t(i) * pipelineChunkFacets;
+      chunk.vertices.clear();
+      VertexIndexMap chunkVertices(chunk.vertices, trianglesCount);
+
+      const uint8_t* f = chunk.data.data();
+      for (uint32_t k = 0; k < trianglesCount; k++) {
+        if (loadNormals)
+          mesh->normals[firstTriangle + k] = ReadVector(f);
+        auto& points = mesh->triangles[firstTriangle + k].points;
+        for (int j = 0; j < 3; j++)
+          points[j].vertexIndex =
+              chunkVertices.FindOrInsert(ReadVector(f + 12 + j * 12));
+        f += facetSize;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      chunk.parsed = true;
+      stateChanged.notify_all();
+    }
+  };
+
+  // Stops and joins the workers when the merge is finished, also when it is
+  // left with an exception, so joinable threads are never destroyed.
+  struct WorkersJoiner {
+    std::mutex& mutex;
+    std::condition_variable& stateChanged;
+    bool& stopped;
+    std::vector<std::thread> threads;
+
+    void Join()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        stateChanged.notify_all();
+      }
+      for (auto& thread : threads) {
+        if (thread.joinable())
+          thread.join();
+      }
+    }
+
+    ~WorkersJoiner()
+    {
+      Join();
+    }
+  } workers{mutex, stateChanged, stopped, {}};
+
+  workers.threads.push_back(std::thread(runWorker, read));
+  for (uint32_t i = 0; i < parsersCount; i++)
+    workers.threads.push_back(std::thread(runWorker, parse));
+
+  VertexIndexMap uniqueVertices(mesh->vertices, numTriangles / 2);
+  std::vector<int32_t> vertexRemap;
+  bool tooManyVertices = false;
+  for (uint32_t i = 0; i < chunksCount && !tooManyVertices; i++) {
+    Chunk& chunk = chunks[i % chunks.size()];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stateChanged.wait(lock, [&]() {
+        return chunk.parsed || readFailed || workerException;
+      });
+      if (readFailed || workerException)
+        break;
+    }
+
+    vertexRemap.resize(chunk.vertices.size());
+    for (size_t k = 0; k < chunk.vertices.size() && !tooManyVertices; k++) {
+      tooManyVertices =
+          !uniqueVertices.TryFindOrInsert(chunk.vertices[k], vertexRemap[k]);
+    }
+    if (tooManyVertices)
+      break;
+
+    const size_t firstTriangle = size_t(i) * pipelineChunkFacets;
+    const size_t lastTriangle = firstTriangle + getTrianglesCount(i);
+    for (size_t k = firstTriangle; k < lastTriangle; k++) {
+      for (auto& point : mesh->triangles[k].points)
+        point.vertexIndex = vertexRemap[point.vertexIndex];
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    chunk.parsed = false;
+    mergedCount = i + 1;
+    stateChanged.notify_all();
+  }
+
+  workers.Join();
+
+  if (workerException)
+    std::rethrow_exception(workerException);
+  if (readFailed)
+    RuntimeError("failed to read file content: " + fileName);
+  if (tooManyVertices)
+    RuntimeError("too large model: too many vertices");
+
+  LargeVector<Vector_f>(mesh->vertices).swap(mesh->vertices);
+  return mesh;
+}
+
+// PLY and OBJ files store indexed triangles, so only facet normals have to be
+// computed to get the same mesh representation as for STL files.
+void ComputeFacetNormals(TriangleMesh& mesh)
+{
+  mesh.normals.resize(mesh.triangles.size());
+  for (size_t i = 0; i < mesh.triangles.size(); i++) {
+    const auto& points = mesh.triangles[i].points;
+    const Vector_f& p0 = mesh.vertices[points[0].vertexIndex];
+    const Vector_f& p1 = mesh.vertices[points[1].vertexIndex];
+    const Vector_f& p2 = mesh.vertices[points[2].vertexIndex];
+
+    Vector_f normal = CrossProduct(p1 - p0, p2 - p0);
+    float length = normal.Length();
+    mesh.normals[i] = (length > 0.0f) ? normal / length : Vector_f();
+  }
+}
+
+// Splits convex polygon into triangles that share the first vertex.
+void AddPolygon(TriangleMesh& mesh, const std::vector<int32_t>& polygon,
+                const std::string& fileName)
+{
+  if (polygon.size() < 3)
+    RuntimeError("invalid face: less than 3 vertices: " + fileName);
+
+  for (size_t i = 2; i < polygon.size(); i++) {
+    if (mesh.triangles.size() >= maxTrianglesCount)
+      RuntimeError("too large model: too many triangles: " + fileName);
+
+    TriangleMesh::Triangle triangle;
+    triangle.points[0].vertexIndex = polygon[0];
+    triangle.points[1].vertexIndex = polygon[i - 1];
+    triangle.points[2].vertexIndex = polygon[i];
+    mesh.triangles.push_back(triangle);
+  }
+}
+
+void ValidateVertexIndices(const TriangleMesh& mesh,
+                           const std::string& fileName)
+{
+  const int32_t verticesCount = static_cast<int32_t>(mesh.vertices.size());
+  for (const auto& triangle : mesh.triangles) {
+    for (const auto& point : triangle.points) {
+      if (point.vertexIndex < 0 || point.vertexIndex >= verticesCount)
+        RuntimeError("vertex index is out of range: " + fileName);
+    }
+  }
+}
+
+enum class PlyType {
+  Int8,
+  UInt8,
+  Int16,
+  UInt16,
+  Int32,
+  UInt32,
+  Float32,
+  Float64
+};
+
+struct PlyProperty {
+  enum class Role { Ignored, X, Y, Z, VertexIndices };
+
+  std::string name;
+  PlyType type = PlyType::Float32;
+  bool isList = false;
+  PlyType countType = PlyType::UInt8;
+  Role role = Role::Ignored;
+};
+
+struct PlyElement {
+  std::string name;
+  int64_t count = 0;
+  std::vector<PlyProperty> properties;
+};
+
+bool ParsePlyType(const TextParser::Token& token, PlyType& type)
+{
+  static const struct {
+    const char* name;
+    PlyType type;
+  } types[] = {{"char", PlyType::Int8},      {"int8", PlyType::Int8},
+               {"uchar", PlyType::UInt8},    {"uint8", PlyType::UInt8},
+               {"short", PlyType::Int16},    {"int16", PlyType::Int16},
+               {"ushort", PlyType::UInt16},  {"uint16", PlyType::UInt16},
+               {"int", PlyType::Int32},      {"int32", PlyType::Int32},
+               {"uint", PlyType::UInt32},    {"uint32", PlyType::UInt32},
+               {"float", PlyType::Float32},  {"float32", PlyType::Float32},
+               {"double", PlyType::Float64}, {"float64", PlyType::Float64}};
+
+  for (const auto& entry : types) {
+    if (token == entry.name) {
+      type = entry.type;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t GetPlyTypeSize(PlyType type)
+{
+  switch (type) {
+  case PlyType::Int8:
+  case PlyType::UInt8:
+    return 1;
+  case PlyType::Int16:
+  case PlyType::UInt16:
+    return 2;
+  case PlyType::Int32:
+  case PlyType::UInt32:
+  case PlyType::Float32:
+    return 4;
+  case PlyType::Float64:
+    return 8;
+  }
+  return 0;
+}
+
+template <typename T>
+T ReadPlyScalar(const uint8_t* data, bool bigEndian)
+{
+  uint8_t bytes[sizeof(T)];
+  memcpy(bytes, data, sizeof(T));
+  if (bigEndian)
+    std::reverse(bytes, bytes + sizeof(T));
+
+  T value;
+  memcpy(&value, bytes, sizeof(T));
+  return value;
+}
+
+// Reads a value of the given type, the result is exact for all PLY types.
+double ReadPlyValue(const uint8_t* data, PlyType type, bool bigEndian)
+{
+  switch (type) {
+  case PlyType::Int8:
+    return ReadPlyScalar<int8_t>(data, bigEndian);
+  case PlyType::UInt8:
+    return ReadPlyScalar<uint8_t>(data, bigEndian);
+  case PlyType::Int16:
+    return ReadPlyScalar<int16_t>(data, bigEndian);
+  case PlyType::UInt16:
+    return ReadPlyScalar<uint16_t>(data, bigEndian);
+  case PlyType::Int32:
+    return ReadPlyScalar<int32_t>(data, bigEndian);
+  case PlyType::UInt32:
+    return ReadPlyScalar<uint32_t>(data, bigEndian);
+  case PlyType::Float32:
+    return ReadPlyScalar<float>(data, bigEndian);
+  case PlyType::Float64:
+    return ReadPlyScalar<double>(data, bigEndian);
+  }
+  return 0.0;
+}
+
+std::unique_ptr<TriangleMesh> ParseBinaryPly(const uint8_t* data,
+                                             size_t dataSize,
+                                             const std::string& fileName)
+{
+  TextParser parser(data, dataSize);
+  auto headerError = [&fileName](const std::string& message) {
+    RuntimeError("invalid ply header: " + message + ": " + fileName);
+  };
+
+  // parse header
+  if (parser.NextToken() != "ply")
+    headerError("missing 'ply' signature");
+
+  bool bigEndian = false;
+  std::vector<PlyElement> elements;
+
+  for (;;) {
+    TextParser::Token token = parser.NextToken();
+    if (token.IsEmpty())
+      headerError("missing 'end_header'");
+
+    if (token == "end_header") {
+      parser.SkipLine();
+      break;
+    }
+
+    if (token == "format") {
+      TextParser::Token format = parser.NextToken();
+      if (format == "binary_big_endian")
+        bigEndian = true;
+      else if (format == "ascii")
+        RuntimeError("ascii ply files are not supported: " + fileName);
+      else if (format != "binary_little_endian")
+        headerError("unknown format");
+      parser.SkipLine();
+    }
+    else if (token == "element") {
+      TextParser::Token name = parser.NextToken();
+      TextParser::Token count = parser.NextToken();
+
+      PlyElement element;
+      element.name.assign(name.data, name.size);
+      if (!ParseInteger(count.data, count.data + count.size, element.count) ||
+          element.count < 0)
+        headerError("invalid element count");
+      elements.push_back(element);
+    }
+    else if (token == "property") {
+      if (elements.empty())
+        headerError("property without element");
+
+      PlyProperty property;
+      TextParser::Token type = parser.NextToken();
+      if (type == "list") {
+        property.isList = true;
+        if (!ParsePlyType(parser.NextToken(), property.countType))
+          headerError("invalid list count type");
+        type = parser.NextToken();
+      }
+      if (!ParsePlyType(type, property.type))
+        headerError("invalid property type");
+
+      TextParser::Token name = parser.NextToken();
+      property.name.assign(name.data, name.size);
+
+      // resolve property names once instead of per element
+      const std::string& elementName = elements.back().name;
+      if (elementName == "vertex" && !property.isList) {
+        if (property.name == "x")
+          property.role = PlyProperty::Role::X;
+        else if (property.name == "y")
+          property.role = PlyProperty::Role::Y;
+        else if (property.name == "z")
+          property.role = PlyProperty::Role::Z;
+      }
+      else if (elementName == "face" && property.isList &&
+               (property.name == "vertex_indices" ||
+                property.name == "vertex_index")) {
+        property.role = PlyProperty::Role::VertexIndices;
+      }
+      elements.back().properties.push_back(property);
+    }
+    else {
+      // comment, obj_info and unknown header lines
+      parser.SkipLine();
+    }
+  }
+
+  // parse data
+  auto mesh = std::unique_ptr<TriangleMesh>(new TriangleMesh());
+  const uint8_t* p = data + parser.GetOffset();
+  const uint8_t* end = data + dataSize;
+  std::vector<int32_t> polygon;
+
+  auto checkSize = [&p, end, &fileName](size_t size) {
+    if (static_cast<size_t>(end - p) < size)
+      RuntimeError("unexpected end of ply file: " + fileName);
+  };
+
+  for (const auto& element : elements) {
+    const bool isVertex = (element.name == "vertex");
+    const bool isFace = (element.name == "face");
+
+    // each vertex and face takes at least one byte, the counts are checked
+    // before the arrays are reserved
+    if ((isVertex || isFace) &&
+        static_cast<uint64_t>(element.count) > static_cast<uint64_t>(end - p))
+      RuntimeError("unexpected end of ply file: " + fileName);
+
+    if (isVertex) {
+      if (static_cast<uint64_t>(element.count) > maxVerticesCount)
+        RuntimeError("too large model: too many vertices: " + fileName);
+      mesh->vertices.reserve(static_cast<size_t>(element.count));
+    }
+    else if (isFace) {
+      if (static_cast<uint64_t>(element.count) > maxTrianglesCount)
+        RuntimeError("too large model: too many triangles: " + fileName);
+      mesh->triangles.reserve(static_cast<size_t>(element.count));
+    }
+
+    // vertices without list properties have fixed size
+    bool fixedSize = std::none_of(
+        element.properties.cbegin(), element.properties.cend(),
+        [](const PlyProperty& property) { return property.isList; });
+
+    if (isVertex && fixedSize) {
+      size_t stride = 0;
+      size_t offsets[3] = {0, 0, 0};
+      const PlyProperty* coordinates[3] = {nullptr, nullptr, nullptr};
+      for (const auto& property : element.properties) {
+        if (property.role != PlyProperty::Role::Ignored) {
+          int axis = static_cast<int>(property.role) -
+                     static_cast<int>(PlyProperty::Role::X);
+          offsets[axis] = stride;
+          coordinates[axis] = &property;
+        }
+        stride += GetPlyTypeSize(property.type);
+      }
+
+      if (static_cast<uint64_t>(element.count) * stride >
+          static_cast<uint64_t>(end - p))
+        RuntimeError("unexpected end of ply file: " + fileName);
+
+      for (int64_t i = 0; i < element.count; i++) {
+        Vector_f vertex;
+        for (int k = 0; k < 3; k++) {
+          if (coordinates[k] != nullptr)
+            vertex[k] = static_cast<float>(
+                ReadPlyValue(p + offsets[k], coordinates[k]->type, bigEndian));
         }
-        vertexIndex = static_cast<int32_t>(mesh->vertices.size());
-        uniqueVertices[v] = vertexIndex;
-        mesh->vertices.push_back(v);
+        mesh->vertices.push_back(vertex);
+        p += stride;
       }
-      else {
-        vertexIndex = iterator->second;
+      continue;
+    }
+
+    // the most common face layout: "property list uchar int vertex_indices"
+    const bool littleEndianTriangles =
+        isFace && !bigEndian && element.properties.size() == 1 &&
+        element.properties[0].role == PlyProperty::Role::VertexIndices &&
+        element.properties[0].countType == PlyType::UInt8 &&
+        (element.properties[0].type == PlyType::Int32 ||
+         element.properties[0].type == PlyType::UInt32);
+
+    if (littleEndianTriangles) {
+      for (int64_t i = 0; i < element.count; i++) {
+        checkSize(1);
+        const size_t count = *p++;
+        checkSize(count * sizeof(int32_t));
+
+        // indices above int32_t range become negative and are rejected
+        // by ValidateVertexIndices
+        if (count == 3) {
+          int32_t indices[3];
+          memcpy(indices, p, sizeof(indices));
+          TriangleMesh::Triangle triangle;
+          for (int k = 0; k < 3; k++)
+            triangle.points[k].vertexIndex = indices[k];
+          mesh->triangles.push_back(triangle);
+        }
+        else {
+          polygon.resize(count);
+          for (size_t k = 0; k < count; k++)
+            polygon[k] = ReadPlyScalar<int32_t>(p + k * sizeof(int32_t), false);
+          AddPolygon(*mesh, polygon, fileName);
+        }
+        p += count * sizeof(int32_t);
       }
-      mesh->triangles[i].points[k].vertexIndex = vertexIndex;
+      continue;
+    }
+
+    for (int64_t i = 0; i < element.count; i++) {
+      Vector_f vertex;
+
+      for (const auto& property : element.properties) {
+        if (property.isList) {
+          const size_t countSize = GetPlyTypeSize(property.countType);
+          checkSize(countSize);
+          double count = ReadPlyValue(p, property.countType, bigEndian);
+          p += countSize;
+
+          const size_t itemSize = GetPlyTypeSize(property.type);
+          if (count < 0.0 || count * itemSize > static_cast<double>(end - p))
+            RuntimeError("unexpected end of ply file: " + fileName);
+
+          if (property.role == PlyProperty::Role::VertexIndices) {
+            polygon.resize(static_cast<size_t>(count));
+            for (int32_t& index : polygon) {
+              double value = ReadPlyValue(p, property.type, bigEndian);
+              index = (value >= 0.0 && value < maxVerticesCount)
+                          ? static_cast<int32_t>(value)
+                          : -1;
+              p += itemSize;
+            }
+            AddPolygon(*mesh, polygon, fileName);
+          }
+          else {
+            p += static_cast<size_t>(count) * itemSize;
+          }
+        }
+        else {
+          const size_t size = GetPlyTypeSize(property.type);
+          checkSize(size);
+          if (property.role != PlyProperty::Role::Ignored) {
+            int axis = static_cast<int>(property.role) -
+                       static_cast<int>(PlyProperty::Role::X);
+            vertex[axis] =
+                static_cast<float>(ReadPlyValue(p, property.type, bigEndian));
+          }
+          p += size;
+        }
+      }
+
+      if (isVertex)
+        mesh->vertices.push_back(vertex);
+    }
+  }
+
+  ValidateVertexIndices(*mesh, fileName);
+  return mesh;
+}
+
+std::unique_ptr<TriangleMesh> ParseObj(const uint8_t* data, size_t dataSize,
+                                       const std::string& fileName)
+{
+  auto mesh = std::unique_ptr<TriangleMesh>(new TriangleMesh());
+  TextParser parser(data, dataSize);
+  std::vector<int32_t> polygon;
+
+  auto parseError = [&parser, &fileName](const std::string& message) {
+    RuntimeError("invalid obj file: " + message + " at offset " +
+                 std::to_string(parser.GetOffset()) + ": " + fileName);
+  };
+
+  while (!parser.AtEnd()) {
+    TextParser::Token token = parser.NextToken();
+
+    if (token == "v") {
+      Vector_f v;
+      for (int k = 0; k < 3; k++) {
+        TextParser::Token coordinate = parser.NextTokenInLine();
+        if (!ParseFloat(coordinate.data, coordinate.data + coordinate.size,
+                        v[k]))
+          parseError("invalid vertex coordinate");
+      }
+      if (mesh->vertices.size() >= maxVerticesCount)
+        RuntimeError("too large model: too many vertices: " + fileName);
+      mesh->vertices.push_back(v);
+    }
+    else if (token == "f") {
+      polygon.clear();
+      for (;;) {
+        // vertex reference is one of v, v/vt, v//vn, v/vt/vn
+        TextParser::Token reference = parser.NextTokenInLine();
+        if (reference.IsEmpty())
+          break;
+
+        const char* referenceEnd = reference.data;
+        while (referenceEnd != reference.data + reference.size &&
+               *referenceEnd != '/')
+          referenceEnd++;
+
+        int64_t index;
+        if (!ParseInteger(reference.data, referenceEnd, index) || index == 0)
+          parseError("invalid vertex index");
+
+        // negative indices are relative to the last defined vertex
+        if (index < 0)
+          index += static_cast<int64_t>(mesh->vertices.size());
+        else
+          index--;
+        polygon.push_back((index >= 0 && index < maxVerticesCount)
+                              ? static_cast<int32_t>(index)
+                              : -1);
+      }
+      AddPolygon(*mesh, polygon, fileName);
+    }
+    // vn, vt, comments, groups and materials are ignored
+    parser.SkipLine();
+  }
+
+  ValidateVertexIndices(*mesh, fileName);
+  return mesh;
+}
+
+std::string GetLowerCaseExtension(const std::string& fileName)
+{
+  size_t dotPos = fileName.rfind('.');
+  if (dotPos == std::string::npos)
+    return std::string();
+
+  std::string extension = fileName.substr(dotPos + 1);
+  for (char& c : extension)
+    c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  return extension;
+}
+
+std::unique_ptr<TriangleMesh> ParseMesh(const uint8_t* data, size_t dataSize,
+                                        const std::string& fileName,
+                                        bool loadNormals, MeshLoadStats* stats)
+{
+  const std::string extension = GetLowerCaseExtension(fileName);
+  if (extension == "stl")
+    return ParseStl(data, dataSize, fileName, loadNormals, stats);
+
+  if (stats)
+    stats->fileSize = static_cast<int64_t>(dataSize);
+
+  std::unique_ptr<TriangleMesh> mesh;
+  if (extension == "ply") {
+    if (stats)
+      stats->format = "binary ply";
+    mesh = ParseBinaryPly(data, dataSize, fileName);
+  }
+  else if (extension == "obj") {
+    if (stats)
+      stats->format = "obj";
+    mesh = ParseObj(data, dataSize, fileName);
+  }
+  else {
+    RuntimeError("unsupported mesh file format: " + fileName);
+  }
+
+  if (loadNormals)
+    ComputeFacetNormals(*mesh);
+  return mesh;
+}
+} // namespace
+
+std::unique_ptr<TriangleMesh> LoadTriangleMesh(const std::string& fileName,
+                                               const MeshLoadOptions& options,
+                                               MeshLoadStats* stats)
+{
+  MeshSourceInfo source;
+  std::string cacheFileName;
+  if (!options.cacheDirectory.empty() && GetMeshSourceInfo(fileName, source)) {
+    cacheFileName =
+        JoinPath(options.cacheDirectory, GetFileName(fileName) + ".mesh");
+
+    // the cache without normals can't be used when normals are requested
+    auto mesh = LoadMeshFile(cacheFileName, source);
+    if (mesh && (!options.loadNormals || !mesh->normals.empty())) {
+      if (stats) {
+        stats->format = "mesh cache";
+        stats->fileSize = static_cast<int64_t>(
+            GetMeshFileSize(*mesh, !mesh->normals.empty()));
+        stats->fileMapped = true;
+        stats->pipelined = false;
+        stats->cacheHit = true;
+      }
+      if (!options.loadNormals)
+        std::vector<Vector_f>().swap(mesh->normals);
+      return mesh;
     }
-    dataPtr += facetSize;
   }
-  std::vector<Vector_f>(mesh->vertices).swap(mesh->vertices);
+
+  if (stats) {
+    stats->cacheHit = false;
+    stats->pipelined = false;
+  }
+
+  std::unique_ptr<TriangleMesh> mesh;
+  if (options.pipelined && GetLowerCaseExtension(fileName) == "stl")
+    mesh = LoadBinaryStlPipelined(fileName, options.loadNormals);
+
+  MappedFile file;
+  if (mesh) {
+    if (stats) {
+      stats->format = "binary stl";
+      stats->fileSize = static_cast<int64_t>(
+          headerSize + 4 + mesh->triangles.size() * facetSize);
+      stats->fileMapped = false;
+      stats->pipelined = true;
+    }
+  }
+  else if (options.useFileMapping &&
+           file.Open(fileName, MappedFile::Access::Sequential)) {
+    if (stats)
+      stats->fileMapped = true;
+    mesh = ParseMesh(file.GetData(), file.GetSize(), fileName,
+                     options.loadNormals, stats);
+  }
+  else {
+    if (stats)
+      stats->fileMapped = false;
+    std::vector<uint8_t> fileContent = ReadFileContent(fileName);
+    mesh = ParseMesh(fileContent.data(), fileContent.size(), fileName,
+                     options.loadNormals, stats);
+  }
+
+  // the cache is an optimization, failure to write it is not an error
+  if (!cacheFileName.empty())
+    SaveMeshFile(cacheFileName, *mesh, source, options.cacheNormals);
   return mesh;
 }
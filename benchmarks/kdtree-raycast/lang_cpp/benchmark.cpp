@@ -1,18 +1,49 @@
 #include "benchmark.h"
+#include "brute_force_intersector.h"
+#include "bvh.h"
 #include "common.h"
+#include "compressed_kdtree.h"
 #include "kdtree.h"
+#include "large_array.h"
 #include "random.h"
+#include "rope_kdtree.h"
+#include "scene_bundle.h"
 #include "triangle.h"
 #include "vector.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
 
 namespace {
 const double PI = 3.14159265358979323846;
 
-Vector UniformSampleSphere()
+// Generator interface of the global random sequence. The benchmark and the
+// validation rays are defined by this sequence.
+struct GlobalRandomGenerator {
+  uint32_t NextUint32()
+  {
+    return RandUint32();
+  }
+
+  double NextDouble()
+  {
+    return RandDouble();
+  }
+
+  double NextFromRange(double a, double b)
+  {
+    return RandFromRange(a, b);
+  }
+};
+
+template <typename Generator>
+Vector UniformSampleSphere(Generator& generator)
 {
-  auto u1 = RandDouble();
-  auto u2 = RandDouble();
+  auto u1 = generator.NextDouble();
+  auto u2 = generator.NextDouble();
   assert(u1 >= 0.0 && u1 < 1.0);
   assert(u2 >= 0.0 && u2 < 1.0);
 
@@ -24,6 +55,12 @@ Vector UniformSampleSphere()
   return Vector(x, y, z);
 }
 
+Vector UniformSampleSphere()
+{
+  GlobalRandomGenerator generator;
+  return UniformSampleSphere(generator);
+}
+
 class RayGenerator {
 public:
   RayGenerator(const BoundingBox& meshBounds)
@@ -36,25 +73,36 @@ public:
   }
 
   Ray GenerateRay(const Vector& lastHit, double lastHitEpsilon) const
+  {
+    GlobalRandomGenerator generator;
+    return GenerateRay(lastHit, lastHitEpsilon, generator);
+  }
+
+  template <typename Generator>
+  Ray GenerateRay(const Vector& lastHit, double lastHitEpsilon,
+                  Generator& generator) const
   {
     // generate ray origin
     Vector origin;
-    origin.x = RandFromRange(raysBounds.minPoint.x, raysBounds.maxPoint.x);
-    origin.y = RandFromRange(raysBounds.minPoint.y, raysBounds.maxPoint.y);
-    origin.z = RandFromRange(raysBounds.minPoint.z, raysBounds.maxPoint.z);
+    origin.x =
+        generator.NextFromRange(raysBounds.minPoint.x, raysBounds.maxPoint.x);
+    origin.y =
+        generator.NextFromRange(raysBounds.minPoint.y, raysBounds.maxPoint.y);
+    origin.z =
+        generator.NextFromRange(raysBounds.minPoint.z, raysBounds.maxPoint.z);
 
-    const bool useLastHit = RandDouble() < 0.25;
+    const bool useLastHit = generator.NextDouble() < 0.25;
     if (useLastHit)
       origin = lastHit;
 
     // generate ray direction;
-    auto direction = UniformSampleSphere();
+    auto direction = UniformSampleSphere(generator);
 
-    if (RandDouble() < 1.0 / 32.0 && direction.z != 0.0)
+    if (generator.NextDouble() < 1.0 / 32.0 && direction.z != 0.0)
       direction.x = direction.y = 0.0;
-    else if (RandDouble() < 1.0 / 32.0 && direction.y != 0.0)
+    else if (generator.NextDouble() < 1.0 / 32.0 && direction.y != 0.0)
       direction.x = direction.z = 0.0;
-    else if (RandDouble() < 1.0 / 32.0 && direction.x != 0.0)
+    else if (generator.NextDouble() < 1.0 / 32.0 && direction.x != 0.0)
       direction.y = direction.z = 0.0;
     direction = direction.GetNormalized();
 
@@ -73,22 +121,21 @@ public:
 private:
   BoundingBox raysBounds;
 };
-} // namespace
-
-int BenchmarkKdTree(const KdTree& kdTree)
+template <typename Accelerator>
+int BenchmarkAccelerator(const Accelerator& accelerator)
 {
   Timer timer;
 
-  Vector lastHit =
-      (kdTree.GetMeshBounds().minPoint + kdTree.GetMeshBounds().maxPoint) * 0.5;
+  const BoundingBox& meshBounds = accelerator.GetMeshBounds();
+  Vector lastHit = (meshBounds.minPoint + meshBounds.maxPoint) * 0.5;
   double lastHitEpsilon = 0.0;
-  auto rayGenerator = RayGenerator(kdTree.GetMeshBounds());
+  auto rayGenerator = RayGenerator(meshBounds);
 
   for (int raysTested = 0; raysTested < benchmarkRaysCount; raysTested++) {
     const Ray ray = rayGenerator.GenerateRay(lastHit, lastHitEpsilon);
 
-    KdTree::Intersection intersection;
-    bool hitFound = kdTree.Intersect(ray, intersection);
+    typename Accelerator::Intersection intersection;
+    bool hitFound = accelerator.Intersect(ray, intersection);
 
     if (hitFound) {
       lastHit = ray.GetPoint(intersection.t);
@@ -107,22 +154,771 @@ int BenchmarkKdTree(const KdTree& kdTree)
   return timer.ElapsedMilliseconds();
 }
 
+// The rays are generated with the hits found by the accelerator, so all of
+// them are tested by the brute force intersector at once. While the hits
+// match, the rays are the same as if they were generated with the brute
+// force hits, and the first mismatch is reported.
+template <typename Accelerator>
+void ValidateAccelerator(const Accelerator& accelerator,
+                         const TriangleMesh& mesh, int raysCount)
+{
+  const BoundingBox& meshBounds = accelerator.GetMeshBounds();
+  Vector lastHit = (meshBounds.minPoint + meshBounds.maxPoint) * 0.5;
+  auto rayGenerator = RayGenerator(meshBounds);
+
+  std::vector<Ray> rays;
+  std::vector<bool> kdTreeHitsFound;
+  std::vector<double> kdTreeDistances;
+  rays.reserve(raysCount);
+
+  for (int raysTested = 0; raysTested < raysCount; raysTested++) {
+    // hit epsilon of the validation rays is always zero
+    const Ray ray = rayGenerator.GenerateRay(lastHit, 0.0);
+
+    typename Accelerator::Intersection kdTreeIntersection;
+    bool kdTreeHitFound = accelerator.Intersect(ray, kdTreeIntersection);
+
+    rays.push_back(ray);
+    kdTreeHitsFound.push_back(kdTreeHitFound);
+    kdTreeDistances.push_back(kdTreeIntersection.t);
+
+    if (kdTreeHitFound)
+      lastHit = ray.GetPoint(kdTreeIntersection.t);
+  }
+
+  const int threadsCount =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  std::vector<double> bruteForceDistances;
+  BruteForceIntersector(mesh).Intersect(rays, bruteForceDistances,
+                                        threadsCount);
+
+  for (size_t i = 0; i < rays.size(); i++) {
+    bool bruteForceHitFound =
+        bruteForceDistances[i] < std::numeric_limits<double>::infinity();
+
+    if (kdTreeHitsFound[i] != bruteForceHitFound ||
+        kdTreeDistances[i] != bruteForceDistances[i]) {
+      const auto& o = rays[i].GetOrigin();
+      const auto& d = rays[i].GetDirection();
+      printf("KdTree accelerator test failure:\n"
+             "KdTree hit: %s\n"
+             "actual hit: %s\n"
+             "KdTree T %.16g [%a]\n"
+             "actual T %.16g [%a]\n"
+             "ray origin: (%a, %a, %a)\n"
+             "ray direction: (%a, %a, %a)\n",
+             kdTreeHitsFound[i] ? "true" : "false",
+             bruteForceHitFound ? "true" : "false", kdTreeDistances[i],
+             kdTreeDistances[i], bruteForceDistances[i],
+             bruteForceDistances[i], o.x, o.y, o.z, d.x, d.y, d.z);
+      ValidationError("KdTree traversal error detected");
+    }
+  }
+}
+
+// Coherent rays are generated in groups of tileSize x tileSize rays that
+// start at the same origin and hit a small region of the mesh bounds, like
+// primary rays of a camera tile. The rays are traced as single rays one
+// after another, there is no packet traversal: the measured difference from
+// random rays is the cache locality of the group.
+template <typename Accelerator>
+int BenchmarkAcceleratorCoherentSingleRays(const Accelerator& accelerator)
+{
+  enum { tileSize = 4 };
+
+  Timer timer;
+
+  const BoundingBox& meshBounds = accelerator.GetMeshBounds();
+  auto diagonal = meshBounds.maxPoint - meshBounds.minPoint;
+  double delta = 2.0 * diagonal.Length();
+  double spacing = 0.002 * diagonal.Length();
+
+  const int tilesCount =
+      coherentBenchmarkRaysCount / (tileSize * tileSize);
+
+  for (int tile = 0; tile < tilesCount; tile++) {
+    Vector origin;
+    origin.x = RandFromRange(meshBounds.minPoint.x - delta,
+                             meshBounds.maxPoint.x + delta);
+    origin.y = RandFromRange(meshBounds.minPoint.y - delta,
+                             meshBounds.maxPoint.y + delta);
+    origin.z = RandFromRange(meshBounds.minPoint.z - delta,
+                             meshBounds.maxPoint.z + delta);
+
+    Vector target;
+    target.x = RandFromRange(meshBounds.minPoint.x, meshBounds.maxPoint.x);
+    target.y = RandFromRange(meshBounds.minPoint.y, meshBounds.maxPoint.y);
+    target.z = RandFromRange(meshBounds.minPoint.z, meshBounds.maxPoint.z);
+
+    // tile plane basis
+    Vector w = (target - origin).GetNormalized();
+    Vector u = CrossProduct(std::abs(w.x) < 0.9 ? Vector(1, 0, 0)
+                                                : Vector(0, 1, 0),
+                            w)
+                   .GetNormalized();
+    Vector v = CrossProduct(w, u);
+
+    for (int i = 0; i < tileSize; i++) {
+      for (int k = 0; k < tileSize; k++) {
+        Vector offset = u * ((i - 0.5 * tileSize) * spacing) +
+                        v * ((k - 0.5 * tileSize) * spacing);
+
+        const Ray ray(origin, (target + offset - origin).GetNormalized());
+
+        typename Accelerator::Intersection intersection;
+        accelerator.Intersect(ray, intersection);
+      }
+    }
+  }
+  return timer.ElapsedMilliseconds();
+}
+} // namespace
+
+int BenchmarkKdTree(const KdTree& kdTree)
+{
+  return BenchmarkAccelerator(kdTree);
+}
+
+int BenchmarkKdTree(const RopeKdTree& kdTree)
+{
+  return BenchmarkAccelerator(kdTree);
+}
+
+int BenchmarkKdTree(const Bvh& bvh)
+{
+  return BenchmarkAccelerator(bvh);
+}
+
+int BenchmarkKdTree(const CompressedKdTree& kdTree)
+{
+  return BenchmarkAccelerator(kdTree);
+}
+
+int BenchmarkKdTreeCoherentSingleRays(const KdTree& kdTree)
+{
+  return BenchmarkAcceleratorCoherentSingleRays(kdTree);
+}
+
+int BenchmarkKdTreeCoherentSingleRays(const RopeKdTree& kdTree)
+{
+  return BenchmarkAcceleratorCoherentSingleRays(kdTree);
+}
+
 void ValidateKdTree(const KdTree& kdTree, int raysCount)
 {
+  ValidateAccelerator(kdTree, kdTree.GetMesh(), raysCount);
+}
+
+void ValidateKdTree(const RopeKdTree& kdTree, int raysCount)
+{
+  ValidateAccelerator(kdTree, kdTree.GetMesh(), raysCount);
+}
+
+void ValidateKdTree(const Bvh& bvh, int raysCount)
+{
+  ValidateAccelerator(bvh, bvh.GetMesh(), raysCount);
+}
+
+void ValidateKdTree(const CompressedKdTree& kdTree, int raysCount)
+{
+  // the decoded mesh is only kept for the brute force intersector
+  ValidateAccelerator(kdTree, kdTree.GetCompressedMesh().Decode(), raysCount);
+}
+
+std::vector<Ray> GenerateBenchmarkRays(const KdTree& kdTree, int raysCount)
+{
+  const BoundingBox& meshBounds = kdTree.GetMeshBounds();
+  Vector lastHit = (meshBounds.minPoint + meshBounds.maxPoint) * 0.5;
+  double lastHitEpsilon = 0.0;
+  auto rayGenerator = RayGenerator(meshBounds);
+
+  std::vector<Ray> rays;
+  rays.reserve(raysCount);
+
+  for (int raysGenerated = 0; raysGenerated < raysCount; raysGenerated++) {
+    rays.push_back(rayGenerator.GenerateRay(lastHit, lastHitEpsilon));
+
+    KdTree::Intersection intersection;
+    if (kdTree.Intersect(rays.back(), intersection)) {
+      lastHit = rays.back().GetPoint(intersection.t);
+      lastHitEpsilon = intersection.epsilon;
+    }
+  }
+  return rays;
+}
+
+void GenerateRayStreamBatch(const KdTree& kdTree, uint64_t batchIndex,
+                            int raysCount, std::vector<Ray>& rays)
+{
+  const TriangleMesh& mesh = kdTree.GetMesh();
+  const BoundingBox& meshBounds = kdTree.GetMeshBounds();
+  const double surfaceEpsilon =
+      1e-3 * (meshBounds.maxPoint - meshBounds.minPoint).Length();
+  auto rayGenerator = RayGenerator(meshBounds);
+  PhiloxGenerator generator(batchIndex);
+
+  rays.clear();
+  rays.reserve(raysCount);
+
+  for (int i = 0; i < raysCount; i++) {
+    // random point of a random triangle in place of the previous hit
+    int32_t triangleIndex =
+        static_cast<int32_t>(generator.NextUint32() % mesh.GetTrianglesCount());
+    const auto& p = mesh.triangles[triangleIndex].points;
+    Vector p0(mesh.vertices[p[0].vertexIndex]);
+    Vector p1(mesh.vertices[p[1].vertexIndex]);
+    Vector p2(mesh.vertices[p[2].vertexIndex]);
+
+    double b1 = generator.NextDouble();
+    double b2 = generator.NextDouble();
+    if (b1 + b2 > 1.0) {
+      b1 = 1.0 - b1;
+      b2 = 1.0 - b2;
+    }
+    Vector surfacePoint = p0 + (p1 - p0) * b1 + (p2 - p0) * b2;
+
+    rays.push_back(
+        rayGenerator.GenerateRay(surfacePoint, surfaceEpsilon, generator));
+  }
+}
+
+int BenchmarkKdTreeRayStream(const KdTree& kdTree, int raysCount,
+                             int& generationTimeMsec, int64_t& hitsCount)
+{
+  enum { batchSize = 65536 };
+
+  std::vector<Ray> rays;
+  double generationSeconds = 0.0;
+  double traversalSeconds = 0.0;
+  hitsCount = 0;
+
+  for (int first = 0; first < raysCount; first += batchSize) {
+    Timer generationTimer;
+    GenerateRayStreamBatch(kdTree, first / batchSize,
+                           std::min(int(batchSize), raysCount - first), rays);
+    generationSeconds += generationTimer.ElapsedSeconds();
+
+    Timer traversalTimer;
+    for (const Ray& ray : rays) {
+      KdTree::Intersection intersection;
+      if (kdTree.Intersect(ray, intersection))
+        hitsCount++;
+    }
+    traversalSeconds += traversalTimer.ElapsedSeconds();
+  }
+
+  generationTimeMsec = static_cast<int>(generationSeconds * 1000.0);
+  return static_cast<int>(traversalSeconds * 1000.0);
+}
+
+namespace {
+template <typename Accelerator>
+int BenchmarkAcceleratorRayBuffer(
+    const Accelerator& accelerator, const std::vector<Ray>& rays,
+    std::vector<KdTree::Intersection>& intersections)
+{
+  intersections.resize(rays.size());
+
+  Timer timer;
+  for (size_t i = 0; i < rays.size(); i++) {
+    intersections[i] = KdTree::Intersection();
+    accelerator.Intersect(rays[i], intersections[i]);
+  }
+  return timer.ElapsedMilliseconds();
+}
+} // namespace
+
+int BenchmarkKdTreeRayBuffer(const KdTree& kdTree, const std::vector<Ray>& rays,
+                             std::vector<KdTree::Intersection>& intersections)
+{
+  return BenchmarkAcceleratorRayBuffer(kdTree, rays, intersections);
+}
+
+int BenchmarkKdTreeRayBuffer(const CompressedKdTree& kdTree,
+                             const std::vector<Ray>& rays,
+                             std::vector<KdTree::Intersection>& intersections)
+{
+  return BenchmarkAcceleratorRayBuffer(kdTree, rays, intersections);
+}
+
+int BenchmarkKdTreeRayBuffer(const SceneBundle& sceneBundle,
+                             const std::vector<Ray>& rays,
+                             std::vector<KdTree::Intersection>& intersections)
+{
+  return BenchmarkAcceleratorRayBuffer(sceneBundle, rays, intersections);
+}
+
+double BenchmarkIntersectTriangle(const TriangleMesh& mesh,
+                                  uint64_t& resultsHash)
+{
+  enum { trianglesCount = 1024, testsCount = 1 << 25 };
+
+  std::vector<Triangle> triangles;
+  std::vector<Ray> rays;
+  for (int i = 0; i < trianglesCount; i++) {
+    int32_t triangleIndex = static_cast<int32_t>(
+        int64_t(i) * mesh.GetTrianglesCount() / trianglesCount);
+    const auto& p = mesh.triangles[triangleIndex].points;
+    Triangle triangle = {{Vector(mesh.vertices[p[0].vertexIndex]),
+                          Vector(mesh.vertices[p[1].vertexIndex]),
+                          Vector(mesh.vertices[p[2].vertexIndex])}};
+    triangles.push_back(triangle);
+
+    // aim at the point around the triangle
+    Vector center = (triangle.points[0] + triangle.points[1] +
+                     triangle.points[2]) / 3.0;
+    double size = (triangle.points[1] - triangle.points[0]).Length() +
+                  (triangle.points[2] - triangle.points[0]).Length();
+    Vector target = center + UniformSampleSphere() * (0.5 * size);
+    Vector origin = target + UniformSampleSphere() * (10.0 * size);
+    rays.push_back(Ray(origin, (target - origin).GetNormalized()));
+  }
+
+  resultsHash = 0;
+  Timer timer;
+  for (int i = 0; i < testsCount; i++) {
+    // each ray is tested against its own and the next triangle
+    int rayIndex = i % trianglesCount;
+    int triangleIndex = (rayIndex + (i / trianglesCount) % 2) % trianglesCount;
+
+    Triangle::Intersection intersection;
+    if (IntersectTriangle(rays[rayIndex], triangles[triangleIndex],
+                          intersection)) {
+      uint64_t bits;
+      memcpy(&bits, &intersection.t, sizeof(bits));
+      resultsHash = CombineHashes(resultsHash, bits);
+    }
+  }
+  return timer.ElapsedSeconds() * 1e9 / testsCount;
+}
+
+namespace {
+#ifdef VECTOR_SSE2
+// Two consecutive vectors are three registers (x0 y0) (z0 x1) (y1 z1),
+// they are transposed to (x0 x1) (y0 y1) (z0 z1).
+void LoadPair(const Vector* v, __m128d& x, __m128d& y, __m128d& z)
+{
+  const double* p = &v->x;
+  __m128d v0 = _mm_loadu_pd(p);
+  __m128d v1 = _mm_loadu_pd(p + 2);
+  __m128d v2 = _mm_loadu_pd(p + 4);
+  x = _mm_shuffle_pd(v0, v1, 2);
+  y = _mm_shuffle_pd(v0, v2, 1);
+  z = _mm_shuffle_pd(v1, v2, 2);
+}
+
+void StorePair(Vector* v, __m128d x, __m128d y, __m128d z)
+{
+  double* p = &v->x;
+  _mm_storeu_pd(p, _mm_shuffle_pd(x, y, 0));
+  _mm_storeu_pd(p + 2, _mm_shuffle_pd(z, x, 2));
+  _mm_storeu_pd(p + 4, _mm_shuffle_pd(y, z, 3));
+}
+#endif
+
+// Batch kernels for arrays of vectors, results are the same as of the single
+// vector functions. The SSE2 versions process two vectors per iteration.
+void DotProducts(const Vector* a, const Vector* b, double* results,
+                 size_t count)
+{
+  size_t i = 0;
+#ifdef VECTOR_SSE2
+  for (; i + 2 <= count; i += 2) {
+    __m128d ax, ay, az, bx, by, bz;
+    LoadPair(a + i, ax, ay, az);
+    LoadPair(b + i, bx, by, bz);
+    __m128d xy = _mm_add_pd(_mm_mul_pd(ax, bx), _mm_mul_pd(ay, by));
+    _mm_storeu_pd(results + i, _mm_add_pd(xy, _mm_mul_pd(az, bz)));
+  }
+#endif
+  for (; i < count; i++) {
+    results[i] = DotProduct(a[i], b[i]);
+  }
+}
+
+void CrossProducts(const Vector* a, const Vector* b, Vector* results,
+                   size_t count)
+{
+  size_t i = 0;
+#ifdef VECTOR_SSE2
+  for (; i + 2 <= count; i += 2) {
+    __m128d ax, ay, az, bx, by, bz;
+    LoadPair(a + i, ax, ay, az);
+    LoadPair(b + i, bx, by, bz);
+    StorePair(results + i, _mm_sub_pd(_mm_mul_pd(ay, bz), _mm_mul_pd(az, by)),
+              _mm_sub_pd(_mm_mul_pd(az, bx), _mm_mul_pd(ax, bz)),
+              _mm_sub_pd(_mm_mul_pd(ax, by), _mm_mul_pd(ay, bx)));
+  }
+#endif
+  for (; i < count; i++) {
+    results[i] = CrossProduct(a[i], b[i]);
+  }
+}
+} // namespace
+
+BatchKernelTimes BenchmarkBatchKernels(const TriangleMesh& mesh)
+{
+  enum { vectorsCount = 4096, passesCount = 1 << 12 };
+
+  // two edges of each triangle
+  std::vector<Vector> edges1, edges2;
+  for (int i = 0; i < vectorsCount; i++) {
+    int32_t triangleIndex = static_cast<int32_t>(
+        int64_t(i) * mesh.GetTrianglesCount() / vectorsCount);
+    const auto& p = mesh.triangles[triangleIndex].points;
+    Vector p0(mesh.vertices[p[0].vertexIndex]);
+    edges1.push_back(Vector(mesh.vertices[p[1].vertexIndex]) - p0);
+    edges2.push_back(Vector(mesh.vertices[p[2].vertexIndex]) - p0);
+  }
+
+  std::vector<double> dotProducts[2];
+  std::vector<Vector> crossProducts[2];
+  double timesNsec[4];
+  for (int k = 0; k < 2; k++) {
+    dotProducts[k].resize(vectorsCount);
+    crossProducts[k].resize(vectorsCount);
+
+    Timer timer;
+    for (int pass = 0; pass < passesCount; pass++) {
+      if (k == 0) {
+        for (int i = 0; i < vectorsCount; i++)
+          dotProducts[k][i] = DotProduct(edges1[i], edges2[i]);
+      }
+      else {
+        DotProducts(edges1.data(), edges2.data(), dotProducts[k].data(),
+                    vectorsCount);
+      }
+    }
+    timesNsec[k] = timer.ElapsedSeconds() * 1e9;
+
+    timer = Timer();
+    for (int pass = 0; pass < passesCount; pass++) {
+      if (k == 0) {
+        for (int i = 0; i < vectorsCount; i++)
+          crossProducts[k][i] = CrossProduct(edges1[i], edges2[i]);
+      }
+      else {
+        CrossProducts(edges1.data(), edges2.data(), crossProducts[k].data(),
+                      vectorsCount);
+      }
+    }
+    timesNsec[k + 2] = timer.ElapsedSeconds() * 1e9;
+  }
+
+  const double callsCount = double(passesCount) * vectorsCount;
+  BatchKernelTimes times;
+  times.dotProductNsec = timesNsec[0] / callsCount;
+  times.dotProductsNsec = timesNsec[1] / callsCount;
+  times.crossProductNsec = timesNsec[2] / callsCount;
+  times.crossProductsNsec = timesNsec[3] / callsCount;
+  times.resultsMatch =
+      memcmp(dotProducts[0].data(), dotProducts[1].data(),
+             vectorsCount * sizeof(double)) == 0 &&
+      memcmp(crossProducts[0].data(), crossProducts[1].data(),
+             vectorsCount * sizeof(Vector)) == 0;
+  return times;
+}
+
+namespace {
+// The slab test as it was before the branchless version, kept as the
+// reference for the box test benchmark.
+BoundingBox::Intersection IntersectBoxReference(const BoundingBox& bounds,
+                                                const Ray& ray)
+{
+  double t0 = 0.0;
+  double t1 = std::numeric_limits<double>::infinity();
+
+  for (int i = 0; i < 3; i++) {
+    double tNear =
+        (bounds.minPoint[i] - ray.GetOrigin()[i]) * ray.GetInvDirection()[i];
+    double tFar =
+        (bounds.maxPoint[i] - ray.GetOrigin()[i]) * ray.GetInvDirection()[i];
+
+    if (tNear > tFar)
+      std::swap(tNear, tFar);
+
+    t0 = tNear > t0 ? tNear : t0;
+    t1 = tFar < t1 ? tFar : t1;
+    if (t0 > t1)
+      return {false, 0.0, 0.0};
+  }
+  return {true, t0, t1};
+}
+
+uint64_t HashBoxIntersection(uint64_t hash, double t0, double t1)
+{
+  uint64_t bits[2];
+  memcpy(&bits[0], &t0, sizeof(double));
+  memcpy(&bits[1], &t1, sizeof(double));
+  return CombineHashes(CombineHashes(hash, bits[0]), bits[1]);
+}
+} // namespace
+
+BoxTestTimes BenchmarkBoxTest(const TriangleMesh& mesh)
+{
+  enum { boxesCount = 1024, raysCount = 1024, passesCount = 1 << 14 };
+
+  // boxes of the triangles scaled around the centers
+  std::vector<BoundingBox> boxes;
+  for (int i = 0; i < boxesCount; i++) {
+    int32_t triangleIndex = static_cast<int32_t>(
+        int64_t(i) * mesh.GetTrianglesCount() / boxesCount);
+    BoundingBox bounds(mesh.GetTriangleBounds(triangleIndex));
+    Vector center = (bounds.minPoint + bounds.maxPoint) * 0.5;
+    Vector halfSize = (bounds.maxPoint - bounds.minPoint) * 2.0;
+    boxes.push_back(BoundingBox(center - halfSize, center + halfSize));
+  }
+
+  // The ray generator makes axis aligned directions and, with zero hit
+  // epsilon, starts some rays on the box corner, so NaN slab distances are
+  // tested too.
+  std::vector<Ray> rays;
+  for (int i = 0; i < raysCount; i++) {
+    const BoundingBox& bounds = boxes[i / RayPacket::size % boxesCount];
+    rays.push_back(RayGenerator(bounds).GenerateRay(bounds.minPoint, 0.0));
+  }
+
+  // in each pass the rays of the packet are tested against the same box
+  auto getBox = [&boxes](int rayIndex, int pass) -> const BoundingBox& {
+    return boxes[(rayIndex / RayPacket::size + pass) % boxesCount];
+  };
+
+  BoxTestTimes times;
+  uint64_t referenceHash = 0;
+  Timer timer;
+  for (int pass = 0; pass < passesCount; pass++) {
+    for (int i = 0; i < raysCount; i++) {
+      auto result = IntersectBoxReference(getBox(i, pass), rays[i]);
+      if (result.found) {
+        referenceHash =
+            HashBoxIntersection(referenceHash, result.t0, result.t1);
+      }
+    }
+  }
+  const double testsCount = double(passesCount) * raysCount;
+  times.referenceNsec = timer.ElapsedSeconds() * 1e9 / testsCount;
+
+  uint64_t singleRayHash = 0;
+  timer = Timer();
+  for (int pass = 0; pass < passesCount; pass++) {
+    for (int i = 0; i < raysCount; i++) {
+      auto result = getBox(i, pass).Intersect(rays[i]);
+      if (result.found) {
+        singleRayHash =
+            HashBoxIntersection(singleRayHash, result.t0, result.t1);
+      }
+    }
+  }
+  times.singleRayNsec = timer.ElapsedSeconds() * 1e9 / testsCount;
+
+  std::vector<RayPacket> packets(raysCount / RayPacket::size);
+  for (size_t i = 0; i < packets.size(); i++)
+    packets[i].Set(&rays[i * RayPacket::size], RayPacket::size);
+
+  uint64_t packetHash = 0;
+  timer = Timer();
+  for (int pass = 0; pass < passesCount; pass++) {
+    for (size_t i = 0; i < packets.size(); i++) {
+      double t0[RayPacket::size], t1[RayPacket::size];
+      int hitMask = getBox(int(i * RayPacket::size), pass)
+                        .Intersect(packets[i], t0, t1);
+      for (int k = 0; k < RayPacket::size; k++) {
+        if (hitMask & (1 << k))
+          packetHash = HashBoxIntersection(packetHash, t0[k], t1[k]);
+      }
+    }
+  }
+  times.packetNsec = timer.ElapsedSeconds() * 1e9 / testsCount;
+
+  times.resultsMatch =
+      singleRayHash == referenceHash && packetHash == referenceHash;
+  return times;
+}
+
+namespace {
+// Fills the values in chunks of varying size, so the chunks start at
+// different positions of the generator state.
+template <typename Generator>
+void FillInChunks(Generator& generator, uint32_t* values, size_t count)
+{
+  size_t chunkSize = 1;
+  while (count > 0) {
+    size_t n = std::min(chunkSize, count);
+    generator.Fill(values, n);
+    values += n;
+    count -= n;
+    chunkSize = chunkSize * 5 % 101;
+  }
+}
+
+template <typename Generator>
+bool FillMatchesNextUint32(Generator generator)
+{
+  Generator generator2 = generator;
+  std::vector<uint32_t> values(100000);
+  FillInChunks(generator, values.data(), values.size());
+  for (uint32_t value : values) {
+    if (generator2.NextUint32() != value)
+      return false;
+  }
+  return true;
+}
+
+template <typename Generator>
+double MeasureNextUint32(Generator generator, uint32_t& resultsHash)
+{
+  enum { valuesCount = 1 << 26 };
+  Timer timer;
+  for (int i = 0; i < valuesCount; i++)
+    resultsHash ^= generator.NextUint32();
+  return timer.ElapsedSeconds() * 1e9 / valuesCount;
+}
+
+template <typename Generator>
+double MeasureFill(Generator generator, uint32_t& resultsHash)
+{
+  enum { valuesCount = 1 << 26, bufferSize = 4096 };
+  std::vector<uint32_t> buffer(bufferSize);
+  Timer timer;
+  for (int i = 0; i < valuesCount; i += bufferSize) {
+    generator.Fill(buffer.data(), bufferSize);
+    resultsHash ^= buffer[(i / bufferSize) % bufferSize];
+  }
+  return timer.ElapsedSeconds() * 1e9 / valuesCount;
+}
+} // namespace
+
+RandomGeneratorTimes BenchmarkRandomGenerators()
+{
+  // known values of the reference implementations
+  std::vector<uint32_t> values(10000);
+  MersenneTwister().Fill(values.data(), values.size());
+  AssertEquals(values.back(), 4123659995u, "error in MersenneTwister");
+
+  uint32_t block[4];
+  PhiloxGenerator::GenerateBlock(0, 0, block);
+  AssertEqualsHex(block[0], 0x6627e8d5, "error in PhiloxGenerator");
+  AssertEqualsHex(block[3], 0x9b00dbd8, "error in PhiloxGenerator");
+
+  if (!FillMatchesNextUint32(MersenneTwister(12345)) ||
+      !FillMatchesNextUint32(PhiloxGenerator(12345, 3)))
+    ValidationError("random generator Fill does not match NextUint32");
+
+  RandomGeneratorTimes times;
+  uint32_t resultsHash = 0;
+  times.mersenneTwisterNextNsec =
+      MeasureNextUint32(MersenneTwister(), resultsHash);
+  times.mersenneTwisterFillNsec = MeasureFill(MersenneTwister(), resultsHash);
+  times.philoxNextNsec = MeasureNextUint32(PhiloxGenerator(0), resultsHash);
+  times.philoxFillNsec = MeasureFill(PhiloxGenerator(0), resultsHash);
+  times.resultsHash = resultsHash;
+  return times;
+}
+
+int BenchmarkKdTreeInterleaved(
+    const KdTree& kdTree, const std::vector<Ray>& rays, int groupSize,
+    std::vector<KdTree::Intersection>& intersections)
+{
+  intersections.resize(rays.size());
+
+  Timer timer;
+  kdTree.IntersectInterleaved(rays.data(), intersections.data(),
+                              static_cast<int32_t>(rays.size()), groupSize);
+  return timer.ElapsedMilliseconds();
+}
+
+int BenchmarkKdTreeThreads(const std::vector<const KdTree*>& kdTrees,
+                           const std::vector<Ray>& rays, int threadsCount)
+{
+  auto traceRays = [&kdTrees, &rays](size_t begin, size_t end) {
+    const KdTree& kdTree = *kdTrees[GetCurrentNumaNode() % kdTrees.size()];
+    for (size_t i = begin; i < end; i++) {
+      KdTree::Intersection intersection;
+      kdTree.Intersect(rays[i], intersection);
+    }
+  };
+
+  Timer timer;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threadsCount; i++) {
+    threads.push_back(std::thread(traceRays, rays.size() * i / threadsCount,
+                                  rays.size() * (i + 1) / threadsCount));
+  }
+  for (auto& thread : threads)
+    thread.join();
+  return timer.ElapsedMilliseconds();
+}
+
+void ValidateIntersections(
+    const std::vector<KdTree::Intersection>& intersections,
+    const std::vector<KdTree::Intersection>& expectedIntersections)
+{
+  AssertEquals(intersections.size(), expectedIntersections.size(),
+               "invalid number of intersections");
+
+  for (size_t i = 0; i < intersections.size(); i++) {
+    if (intersections[i].t != expectedIntersections[i].t ||
+        intersections[i].epsilon != expectedIntersections[i].epsilon) {
+      printf("ray %d: T %.16g, expected T %.16g\n", static_cast<int>(i),
+             intersections[i].t, expectedIntersections[i].t);
+      ValidationError("intersections don't match");
+    }
+  }
+}
+
+int64_t BenchmarkKdTreeMultiHit(const KdTree& kdTree, int32_t maxHits,
+                                int& timeMsec)
+{
+  Timer timer;
+
   Vector lastHit =
       (kdTree.GetMeshBounds().minPoint + kdTree.GetMeshBounds().maxPoint) * 0.5;
   double lastHitEpsilon = 0.0;
   auto rayGenerator = RayGenerator(kdTree.GetMeshBounds());
 
+  std::vector<KdTree::Hit> hits(maxHits);
+  int64_t hitsCount = 0;
+
+  for (int raysTested = 0; raysTested < multiHitBenchmarkRaysCount;
+       raysTested++) {
+    const Ray ray = rayGenerator.GenerateRay(lastHit, lastHitEpsilon);
+
+    int32_t rayHitsCount = kdTree.IntersectAll(ray, hits.data(), maxHits);
+    hitsCount += rayHitsCount;
+
+    if (rayHitsCount > 0) {
+      lastHit = ray.GetPoint(hits[0].t);
+      lastHitEpsilon = hits[0].epsilon;
+    }
+  }
+  timeMsec = timer.ElapsedMilliseconds();
+  return hitsCount;
+}
+
+void ValidateKdTreeMultiHit(const KdTree& kdTree, int raysCount)
+{
+  enum { maxHits = 4 };
+
+  Vector lastHit =
+      (kdTree.GetMeshBounds().minPoint + kdTree.GetMeshBounds().maxPoint) * 0.5;
+  double lastHitEpsilon = 0.0;
+  auto rayGenerator = RayGenerator(kdTree.GetMeshBounds());
+
+  std::vector<KdTree::Hit> allHits(kdTree.GetMesh().GetTrianglesCount());
+  std::vector<KdTree::Hit> bruteForceHits;
+  std::vector<int32_t> triangleIndices;
+  std::vector<int32_t> bruteForceTriangleIndices;
+
   for (int raysTested = 0; raysTested < raysCount; raysTested++) {
     const Ray ray = rayGenerator.GenerateRay(lastHit, lastHitEpsilon);
 
-    KdTree::Intersection kdTreeIntersection;
-    bool kdTreeHitFound = kdTree.Intersect(ray, kdTreeIntersection);
+    int32_t allHitsCount = kdTree.IntersectAll(
+        ray, allHits.data(), static_cast<int32_t>(allHits.size()));
 
-    KdTree::Intersection bruteForceIntersection;
-    bool bruteForceHitFound = false;
+    KdTree::Hit closestHits[maxHits];
+    int32_t closestHitsCount = kdTree.IntersectAll(ray, closestHits, maxHits);
 
+    bruteForceHits.clear();
     for (int32_t i = 0; i < kdTree.GetMesh().GetTrianglesCount(); i++) {
       const auto& p = kdTree.GetMesh().triangles[i].points;
 
@@ -132,35 +928,108 @@ void ValidateKdTree(const KdTree& kdTree, int raysCount)
            Vector(kdTree.GetMesh().vertices[p[2].vertexIndex])}};
 
       Triangle::Intersection intersection;
-      bool hitFound = IntersectTriangle(ray, triangle, intersection);
+      if (IntersectTriangle(ray, triangle, intersection))
+        bruteForceHits.push_back({intersection.t, intersection.epsilon, i});
+    }
+    std::stable_sort(bruteForceHits.begin(), bruteForceHits.end(),
+                     [](const KdTree::Hit& a, const KdTree::Hit& b) {
+                       return a.t < b.t;
+                     });
+
+    auto bruteForceHitsCount = static_cast<int32_t>(bruteForceHits.size());
+    bool valid = allHitsCount == bruteForceHitsCount &&
+                 closestHitsCount == std::min<int32_t>(maxHits, allHitsCount);
+
+    for (int32_t i = 0; valid && i < allHitsCount; i++)
+      valid = allHits[i].t == bruteForceHits[i].t;
 
-      if (hitFound && intersection.t < bruteForceIntersection.t) {
-        bruteForceIntersection.t = intersection.t;
-        bruteForceHitFound = true;
+    for (int32_t i = 0; valid && i < closestHitsCount; i++)
+      valid = closestHits[i].t == allHits[i].t;
+
+    // each hit triangle is reported exactly once, also when several leaves
+    // reference it
+    if (valid) {
+      triangleIndices.clear();
+      bruteForceTriangleIndices.clear();
+      for (int32_t i = 0; i < allHitsCount; i++) {
+        triangleIndices.push_back(allHits[i].triangleIndex);
+        bruteForceTriangleIndices.push_back(bruteForceHits[i].triangleIndex);
+      }
+      std::sort(triangleIndices.begin(), triangleIndices.end());
+      std::sort(bruteForceTriangleIndices.begin(),
+                bruteForceTriangleIndices.end());
+      valid = triangleIndices == bruteForceTriangleIndices;
+
+      for (int32_t i = 0; valid && i < closestHitsCount; i++) {
+        valid = std::binary_search(triangleIndices.begin(),
+                                   triangleIndices.end(),
+                                   closestHits[i].triangleIndex);
       }
     }
 
-    if (kdTreeHitFound != bruteForceHitFound ||
-        kdTreeIntersection.t != bruteForceIntersection.t) {
+    if (!valid) {
       const auto& o = ray.GetOrigin();
       const auto& d = ray.GetDirection();
-      printf("KdTree accelerator test failure:\n"
-             "KdTree hit: %s\n"
-             "actual hit: %s\n"
-             "KdTree T %.16g [%a]\n"
-             "actual T %.16g [%a]\n"
+      printf("KdTree multi-hit test failure:\n"
+             "KdTree hits: %d (closest %d)\n"
+             "actual hits: %d\n"
              "ray origin: (%a, %a, %a)\n"
              "ray direction: (%a, %a, %a)\n",
-             kdTreeHitFound ? "true" : "false",
-             bruteForceHitFound ? "true" : "false", kdTreeIntersection.t,
-             kdTreeIntersection.t, bruteForceIntersection.t,
-             bruteForceIntersection.t, o.x, o.y, o.z, d.x, d.y, d.z);
-      ValidationError("KdTree traversal error detected");
+             allHitsCount, closestHitsCount, bruteForceHitsCount, o.x, o.y,
+             o.z, d.x, d.y, d.z);
+      ValidationError("KdTree multi-hit traversal error detected");
     }
 
-    if (bruteForceHitFound) {
-      lastHit = ray.GetPoint(bruteForceIntersection.t);
-      lastHitEpsilon = bruteForceIntersection.epsilon;
+    if (bruteForceHitsCount > 0) {
+      lastHit = ray.GetPoint(bruteForceHits[0].t);
+      lastHitEpsilon = bruteForceHits[0].epsilon;
     }
   }
 }
+
+void PrintTraversalStats(const KdTree::TraversalStats& stats,
+                         const std::string& modelName)
+{
+  double raysCount = static_cast<double>(std::max<int64_t>(stats.raysCount, 1));
+
+  printf("traversal stats [%-6s]: %lld rays\n", modelName.c_str(),
+         static_cast<long long>(stats.raysCount));
+  printf("  interior nodes per ray: %.2f\n",
+         stats.interiorNodesVisited / raysCount);
+  printf("  leaves per ray: %.2f\n", stats.leavesVisited / raysCount);
+  printf("  triangle tests per ray: %.2f\n", stats.triangleTests / raysCount);
+  printf("  stack pushes per ray: %.2f\n", stats.stackPushes / raysCount);
+  printf("  max stack depth: %d\n", stats.maxStackDepth);
+  printf("  leaf cache lines per ray: %.2f (%.2f per leaf)\n",
+         stats.leafCacheLines / raysCount,
+         stats.leafCacheLines /
+             static_cast<double>(std::max<int64_t>(stats.leavesVisited, 1)));
+
+  // histograms show percentage of rays for each range of per-ray values
+  printf("  %-13s %9s %9s %9s %9s\n", "per ray", "interior", "leaves",
+         "triangles", "depth");
+
+  for (int i = 0; i < KdTree::TraversalStats::histogramBucketsCount; i++) {
+    int64_t counts[4] = {
+        stats.interiorNodesHistogram[i], stats.leavesHistogram[i],
+        stats.triangleTestsHistogram[i], stats.stackDepthHistogram[i]};
+
+    if (counts[0] == 0 && counts[1] == 0 && counts[2] == 0 && counts[3] == 0)
+      continue;
+
+    std::string range;
+    if (i == 0)
+      range = "0";
+    else if (i == 1)
+      range = "1";
+    else if (i == KdTree::TraversalStats::histogramBucketsCount - 1)
+      range = std::to_string(1 << (i - 1)) + "+";
+    else
+      range = std::to_string(1 << (i - 1)) + "-" +
+              std::to_string((1 << i) - 1);
+
+    printf("  %-13s %8.2f%% %8.2f%% %8.2f%% %8.2f%%\n", range.c_str(),
+           100.0 * counts[0] / raysCount, 100.0 * counts[1] / raysCount,
+           100.0 * counts[2] / raysCount, 100.0 * counts[3] / raysCount);
+  }
+}
@@ -1,8 +1,125 @@
 #pragma once
 
-class KdTree;
+#include "kdtree.h"
+#include <cstdint>
+#include <string>
+#include <vector>
 
 enum { benchmarkRaysCount = 10000000 };
+enum { multiHitBenchmarkRaysCount = 1000000 };
+enum { coherentBenchmarkRaysCount = 1000000 };
+enum { rayBufferBenchmarkRaysCount = 1000000 };
+
+class Bvh;
+class CompressedKdTree;
+class RopeKdTree;
+class SceneBundle;
 
 int BenchmarkKdTree(const KdTree& kdTree);
+int BenchmarkKdTree(const RopeKdTree& kdTree);
+int BenchmarkKdTree(const Bvh& bvh);
+int BenchmarkKdTree(const CompressedKdTree& kdTree);
+
+int BenchmarkKdTreeCoherentSingleRays(const KdTree& kdTree);
+int BenchmarkKdTreeCoherentSingleRays(const RopeKdTree& kdTree);
+
 void ValidateKdTree(const KdTree& kdTree, int raysCount);
+void ValidateKdTree(const RopeKdTree& kdTree, int raysCount);
+void ValidateKdTree(const Bvh& bvh, int raysCount);
+void ValidateKdTree(const CompressedKdTree& kdTree, int raysCount);
+
+// Generates rays of the benchmark workload into a buffer. The rays that
+// start from the previous hit use the hits found by the kdTree, so buffered
+// rays are the same as in BenchmarkKdTree but can be traced independently.
+std::vector<Ray> GenerateBenchmarkRays(const KdTree& kdTree, int raysCount);
+
+// Generates a batch of independent rays of the benchmark workload. The rays
+// that start from the previous hit in BenchmarkKdTree start from a random
+// point of a random triangle instead, so no ray depends on the traversal of
+// another one. Each batch has its own PhiloxGenerator stream, the batches can
+// be generated in any order or on different threads.
+void GenerateRayStreamBatch(const KdTree& kdTree, uint64_t batchIndex,
+                            int raysCount, std::vector<Ray>& rays);
+
+// Traces raysCount rays generated in batches by GenerateRayStreamBatch. Only
+// the traversal is timed, the returned time does not include the ray
+// generation, which is stored in generationTimeMsec. That is the cost of
+// the stream generator itself (PhiloxGenerator and random triangle
+// sampling), not of the MersenneTwister rays of the dependent chain.
+int BenchmarkKdTreeRayStream(const KdTree& kdTree, int raysCount,
+                             int& generationTimeMsec, int64_t& hitsCount);
+
+int BenchmarkKdTreeRayBuffer(const KdTree& kdTree, const std::vector<Ray>& rays,
+                             std::vector<KdTree::Intersection>& intersections);
+int BenchmarkKdTreeRayBuffer(const CompressedKdTree& kdTree,
+                             const std::vector<Ray>& rays,
+                             std::vector<KdTree::Intersection>& intersections);
+int BenchmarkKdTreeRayBuffer(const SceneBundle& sceneBundle,
+                             const std::vector<Ray>& rays,
+                             std::vector<KdTree::Intersection>& intersections);
+int BenchmarkKdTreeInterleaved(
+    const KdTree& kdTree, const std::vector<Ray>& rays, int groupSize,
+    std::vector<KdTree::Intersection>& intersections);
+
+// Traces the rays on threadsCount threads. Each thread uses the tree
+// replica for the NUMA node it runs on: kdTrees[node % kdTrees.size()].
+int BenchmarkKdTreeThreads(const std::vector<const KdTree*>& kdTrees,
+                           const std::vector<Ray>& rays, int threadsCount);
+
+void ValidateIntersections(
+    const std::vector<KdTree::Intersection>& intersections,
+    const std::vector<KdTree::Intersection>& expectedIntersections);
+
+// Returns the number of hits found, elapsed time is stored in timeMsec.
+int64_t BenchmarkKdTreeMultiHit(const KdTree& kdTree, int32_t maxHits,
+                                int& timeMsec);
+void ValidateKdTreeMultiHit(const KdTree& kdTree, int raysCount);
+
+// Measures IntersectTriangle alone on triangles of the mesh, rays start near
+// the triangles and about half of the tests find a hit. Returns nanoseconds
+// per test, resultsHash identifies the results of all tests.
+double BenchmarkIntersectTriangle(const TriangleMesh& mesh,
+                                  uint64_t& resultsHash);
+
+struct BatchKernelTimes {
+  double dotProductNsec;
+  double dotProductsNsec;
+  double crossProductNsec;
+  double crossProductsNsec;
+  bool resultsMatch;
+};
+
+// Compares the DotProducts and CrossProducts batch kernels with loops over
+// DotProduct and CrossProduct on the triangle edges of the mesh, the arrays
+// stay in the cache. The results have to be bit-identical, the times are
+// nanoseconds per vector.
+BatchKernelTimes BenchmarkBatchKernels(const TriangleMesh& mesh);
+
+struct BoxTestTimes {
+  double referenceNsec;
+  double singleRayNsec;
+  double packetNsec;
+  bool resultsMatch;
+};
+
+// Measures the ray/box slab test on boxes around the triangles of the mesh,
+// about one test in eight finds a hit. The single ray and the packet tests
+// are compared with the previous implementation with the swap and the early
+// exit, the times are nanoseconds per ray.
+BoxTestTimes BenchmarkBoxTest(const TriangleMesh& mesh);
+
+struct RandomGeneratorTimes {
+  double mersenneTwisterNextNsec;
+  double mersenneTwisterFillNsec;
+  double philoxNextNsec;
+  double philoxFillNsec;
+  uint32_t resultsHash;
+};
+
+// Checks the generators against the known values of the reference
+// implementations and that Fill gives the same values as NextUint32, then
+// measures nanoseconds per generated value.
+RandomGeneratorTimes BenchmarkRandomGenerators();
+
+void PrintTraversalStats(const KdTree::TraversalStats& stats,
+                         const std::string& modelName);
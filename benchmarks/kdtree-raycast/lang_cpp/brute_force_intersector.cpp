@@ -0,0 +1,300 @@
+#include "brute_force_intersector.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include <limits>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+// Lanes wrap the SIMD register type, so the triangle test below is written
+// once with the operators in the same order as in IntersectTriangle.
+#if defined(__AVX2__)
+struct Lanes {
+  enum { count = 4 };
+  __m256d value;
+
+  static Lanes Load(const double* values)
+  {
+    return {_mm256_loadu_pd(values)};
+  }
+
+  static Lanes Set(double value)
+  {
+    return {_mm256_set1_pd(value)};
+  }
+
+  void Store(double* values) const
+  {
+    _mm256_storeu_pd(values, value);
+  }
+};
+
+inline Lanes operator+(Lanes a, Lanes b)
+{
+  return {_mm256_add_pd(a.value, b.value)};
+}
+
+inline Lanes operator-(Lanes a, Lanes b)
+{
+  return {_mm256_sub_pd(a.value, b.value)};
+}
+
+inline Lanes operator*(Lanes a, Lanes b)
+{
+  return {_mm256_mul_pd(a.value, b.value)};
+}
+
+inline Lanes operator/(Lanes a, Lanes b)
+{
+  return {_mm256_div_pd(a.value, b.value)};
+}
+
+inline Lanes operator|(Lanes a, Lanes b)
+{
+  return {_mm256_or_pd(a.value, b.value)};
+}
+
+// Comparison results are lane masks, false for NaN like scalar comparisons.
+inline Lanes operator<(Lanes a, Lanes b)
+{
+  return {_mm256_cmp_pd(a.value, b.value, _CMP_LT_OQ)};
+}
+
+inline Lanes operator>(Lanes a, Lanes b)
+{
+  return {_mm256_cmp_pd(a.value, b.value, _CMP_GT_OQ)};
+}
+
+inline Lanes operator==(Lanes a, Lanes b)
+{
+  return {_mm256_cmp_pd(a.value, b.value, _CMP_EQ_OQ)};
+}
+
+// Lanes of a where mask is set and not excluded, lanes of b otherwise.
+inline Lanes Select(Lanes mask, Lanes excluded, Lanes a, Lanes b)
+{
+  Lanes selected = {_mm256_andnot_pd(excluded.value, mask.value)};
+  return {_mm256_blendv_pd(b.value, a.value, selected.value)};
+}
+#elif defined(__SSE2__) || defined(_M_X64)
+struct Lanes {
+  enum { count = 2 };
+  __m128d value;
+
+  static Lanes Load(const double* values)
+  {
+    return {_mm_loadu_pd(values)};
+  }
+
+  static Lanes Set(double value)
+  {
+    return {_mm_set1_pd(value)};
+  }
+
+  void Store(double* values) const
+  {
+    _mm_storeu_pd(values, value);
+  }
+};
+
+inline Lanes operator+(Lanes a, Lanes b)
+{
+  return {_mm_add_pd(a.value, b.value)};
+}
+
+inline Lanes operator-(Lanes a, Lanes b)
+{
+  return {_mm_sub_pd(a.value, b.value)};
+}
+
+inline Lanes operator*(Lanes a, Lanes b)
+{
+  return {_mm_mul_pd(a.value, b.value)};
+}
+
+inline Lanes operator/(Lanes a, Lanes b)
+{
+  return {_mm_div_pd(a.value, b.value)};
+}
+
+inline Lanes operator|(Lanes a, Lanes b)
+{
+  return {_mm_or_pd(a.value, b.value)};
+}
+
+// Comparison results are lane masks, false for NaN like scalar comparisons.
+inline Lanes operator<(Lanes a, Lanes b)
+{
+  return {_mm_cmplt_pd(a.value, b.value)};
+}
+
+inline Lanes operator>(Lanes a, Lanes b)
+{
+  return {_mm_cmpgt_pd(a.value, b.value)};
+}
+
+inline Lanes operator==(Lanes a, Lanes b)
+{
+  return {_mm_cmpeq_pd(a.value, b.value)};
+}
+
+// Lanes of a where mask is set and not excluded, lanes of b otherwise.
+inline Lanes Select(Lanes mask, Lanes excluded, Lanes a, Lanes b)
+{
+  __m128d selected = _mm_andnot_pd(excluded.value, mask.value);
+  return {_mm_or_pd(_mm_and_pd(selected, a.value),
+                    _mm_andnot_pd(selected, b.value))};
+}
+#else
+struct Lanes {
+  enum { count = 1 };
+};
+#endif
+} // namespace
+
+BruteForceIntersector::BruteForceIntersector(const TriangleMesh& mesh)
+{
+  const int64_t meshTrianglesCount = mesh.GetTrianglesCount();
+  trianglesCount =
+      (meshTrianglesCount + Lanes::count - 1) / Lanes::count * Lanes::count;
+
+  // padding triangles have zero edges, the test never finds a hit for them
+  for (int k = 0; k < 3; k++) {
+    point0[k].resize(trianglesCount);
+    edge1[k].resize(trianglesCount);
+    edge2[k].resize(trianglesCount);
+  }
+
+  for (int64_t i = 0; i < meshTrianglesCount; i++) {
+    const auto& p = mesh.triangles[i].points;
+    Vector p0(mesh.vertices[p[0].vertexIndex]);
+    Vector e1 = Vector(mesh.vertices[p[1].vertexIndex]) - p0;
+    Vector e2 = Vector(mesh.vertices[p[2].vertexIndex]) - p0;
+    for (int k = 0; k < 3; k++) {
+      point0[k][i] = p0[k];
+      edge1[k][i] = e1[k];
+      edge2[k][i] = e2[k];
+    }
+  }
+}
+
+double BruteForceIntersector::Intersect(const Ray& ray) const
+{
+  double distance;
+  IntersectGroup<1>(&ray, &distance);
+  return distance;
+}
+
+template <int groupSize>
+void BruteForceIntersector::IntersectGroup(const Ray* rays,
+                                           double* distances) const
+{
+  const double infinity = std::numeric_limits<double>::infinity();
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+  Lanes ox[groupSize], oy[groupSize], oz[groupSize];
+  Lanes dx[groupSize], dy[groupSize], dz[groupSize];
+  Lanes closest[groupSize];
+  for (int k = 0; k < groupSize; k++) {
+    const Vector& o = rays[k].GetOrigin();
+    const Vector& d = rays[k].GetDirection();
+    ox[k] = Lanes::Set(o.x);
+    oy[k] = Lanes::Set(o.y);
+    oz[k] = Lanes::Set(o.z);
+    dx[k] = Lanes::Set(d.x);
+    dy[k] = Lanes::Set(d.y);
+    dz[k] = Lanes::Set(d.z);
+    closest[k] = Lanes::Set(infinity);
+  }
+  const Lanes zero = Lanes::Set(0.0);
+  const Lanes one = Lanes::Set(1.0);
+
+  for (int64_t i = 0; i < trianglesCount; i += Lanes::count) {
+    const Lanes p0x = Lanes::Load(&point0[0][i]);
+    const Lanes p0y = Lanes::Load(&point0[1][i]);
+    const Lanes p0z = Lanes::Load(&point0[2][i]);
+    const Lanes e1x = Lanes::Load(&edge1[0][i]);
+    const Lanes e1y = Lanes::Load(&edge1[1][i]);
+    const Lanes e1z = Lanes::Load(&edge1[2][i]);
+    const Lanes e2x = Lanes::Load(&edge2[0][i]);
+    const Lanes e2y = Lanes::Load(&edge2[1][i]);
+    const Lanes e2z = Lanes::Load(&edge2[2][i]);
+
+    for (int k = 0; k < groupSize; k++) {
+      Lanes px = dy[k] * e2z - dz[k] * e2y;
+      Lanes py = dz[k] * e2x - dx[k] * e2z;
+      Lanes pz = dx[k] * e2y - dy[k] * e2x;
+      Lanes divisor = e1x * px + e1y * py + e1z * pz;
+      Lanes invDivisor = one / divisor;
+
+      Lanes tx = ox[k] - p0x;
+      Lanes ty = oy[k] - p0y;
+      Lanes tz = oz[k] - p0z;
+      Lanes b1 = invDivisor * (tx * px + ty * py + tz * pz);
+
+      Lanes qx = ty * e1z - tz * e1y;
+      Lanes qy = tz * e1x - tx * e1z;
+      Lanes qz = tx * e1y - ty * e1x;
+      Lanes b2 = invDivisor * (dx[k] * qx + dy[k] * qy + dz[k] * qz);
+      Lanes distance = invDivisor * (e2x * qx + e2y * qy + e2z * qz);
+
+      // the early exits of IntersectTriangle, NaN values pass them there too
+      Lanes miss = (divisor == zero) | (b1 < zero) | (b1 > one) |
+                   (b2 < zero) | (b1 + b2 > one) | (distance < zero);
+      closest[k] = Select(distance < closest[k], miss, distance, closest[k]);
+    }
+  }
+
+  for (int k = 0; k < groupSize; k++) {
+    double lanes[Lanes::count];
+    closest[k].Store(lanes);
+    distances[k] = infinity;
+    for (double distance : lanes) {
+      if (distance < distances[k])
+        distances[k] = distance;
+    }
+  }
+#else
+  for (int k = 0; k < groupSize; k++) {
+    distances[k] = infinity;
+    for (int64_t i = 0; i < trianglesCount; i++) {
+      Triangle::Intersection intersection;
+      bool hitFound = IntersectTriangle(
+          rays[k], Vector(point0[0][i], point0[1][i], point0[2][i]),
+          Vector(edge1[0][i], edge1[1][i], edge1[2][i]),
+          Vector(edge2[0][i], edge2[1][i], edge2[2][i]), intersection);
+      if (hitFound && intersection.t < distances[k])
+        distances[k] = intersection.t;
+    }
+  }
+#endif
+}
+
+void BruteForceIntersector::Intersect(const std::vector<Ray>& rays,
+                                      std::vector<double>& distances,
+                                      int threadsCount) const
+{
+  distances.resize(rays.size());
+  auto intersectRays = [this, &rays, &distances](size_t begin, size_t end) {
+    size_t i = begin;
+    for (; i + maxGroupSize <= end; i += maxGroupSize)
+      IntersectGroup<maxGroupSize>(&rays[i], &distances[i]);
+    for (; i < end; i++)
+      distances[i] = Intersect(rays[i]);
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < threadsCount; i++) {
+    threads.push_back(std::thread(intersectRays,
+                                  rays.size() * i / threadsCount,
+                                  rays.size() * (i + 1) / threadsCount));
+  }
+  intersectRays(0, rays.size() / threadsCount);
+  for (auto& thread : threads)
+    thread.join();
+}
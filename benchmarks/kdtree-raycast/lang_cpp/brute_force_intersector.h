@@ -0,0 +1,43 @@
+#pragma once
+
+#include "large_array.h"
+#include "ray.h"
+#include <cstdint>
+#include <vector>
+
+class TriangleMesh;
+
+// Reference intersector that tests the ray against every triangle of the
+// mesh. Triangles are stored as structure of arrays of the first point and
+// the edges, the test runs on 2 (SSE2) or 4 (AVX2) triangles at once and
+// does the same double precision operations as IntersectTriangle, so the
+// closest hit distance is exactly the same as of the scalar loop.
+class BruteForceIntersector {
+public:
+  explicit BruteForceIntersector(const TriangleMesh& mesh);
+
+  // Returns distance to the closest hit or infinity if there is no hit.
+  double Intersect(const Ray& ray) const;
+
+  // Intersects the rays on threadsCount threads, distances[i] is the result
+  // of Intersect(rays[i]). Rays are processed in groups, it's faster than
+  // calling Intersect for each ray.
+  void Intersect(const std::vector<Ray>& rays, std::vector<double>& distances,
+                 int threadsCount) const;
+
+private:
+  // Tests a group of rays on each loaded block of triangles, this reduces
+  // memory traffic. Larger groups run out of SIMD registers.
+  enum { maxGroupSize = 2 };
+
+  template <int groupSize>
+  void IntersectGroup(const Ray* rays, double* distances) const;
+
+private:
+  // padded to the multiple of the lanes count with degenerate triangles
+  int64_t trianglesCount = 0;
+
+  LargeVector<double> point0[3];
+  LargeVector<double> edge1[3];
+  LargeVector<double> edge2[3];
+};
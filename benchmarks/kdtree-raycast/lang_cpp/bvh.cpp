@@ -0,0 +1,147 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cassert>
+
+namespace {
+// Relative error bound that makes ray/box test conservative (see PBRT,
+// 3.9.2 Conservative Ray-Bounds Intersections).
+const double boxTestErrorBound =
+    1.0 + 6.0 * std::numeric_limits<double>::epsilon();
+} // namespace
+
+Bvh::Bvh(std::vector<Node>&& nodes, std::vector<int32_t>&& triangleIndices,
+         const TriangleMesh& mesh)
+: nodes(std::move(nodes))
+, triangleIndices(std::move(triangleIndices))
+, mesh(mesh)
+, meshBounds(mesh.GetBounds())
+{
+}
+
+bool Bvh::Intersect(const Ray& ray, Intersection& intersection) const
+{
+  auto boundsIntersection = meshBounds.Intersect(ray);
+  if (!boundsIntersection.found)
+    return false;
+
+  struct TraversalInfo {
+    int32_t child;
+    int32_t trianglesCount;
+    double tNear;
+  };
+  TraversalInfo traversalStack[traversalStackSize];
+  int stackSize = 0;
+
+  traversalStack[stackSize++] = {0, 0, boundsIntersection.t0};
+
+  const auto& origin = ray.GetOrigin();
+  const auto& invDirection = ray.GetInvDirection();
+
+  Triangle::Intersection closestIntersection;
+
+  while (stackSize > 0) {
+    const TraversalInfo info = traversalStack[--stackSize];
+    if (info.tNear > closestIntersection.t)
+      continue;
+
+    if (info.trianglesCount > 0) {
+      IntersectLeafTriangles(ray, info.child, info.trianglesCount,
+                             closestIntersection);
+      continue;
+    }
+
+    const Node& node = nodes[info.child];
+
+    // test all four child boxes
+    double t0[4] = {0.0, 0.0, 0.0, 0.0};
+    double t1[4];
+    std::fill(t1, t1 + 4, closestIntersection.t);
+
+    for (int axis = 0; axis < 3; axis++) {
+      for (int i = 0; i < 4; i++) {
+        double tNear = (node.boundsMin[axis][i] - origin[axis]) *
+                       invDirection[axis];
+        double tFar = (node.boundsMax[axis][i] - origin[axis]) *
+                      invDirection[axis];
+
+        if (tNear > tFar)
+          std::swap(tNear, tFar);
+
+        tFar *= boxTestErrorBound;
+
+        // comparisons are written to ignore NaNs (0 * infinity)
+        t0[i] = tNear > t0[i] ? tNear : t0[i];
+        t1[i] = tFar < t1[i] ? tFar : t1[i];
+      }
+    }
+
+    // push hit children so that the nearest one is processed first
+    TraversalInfo hits[4];
+    int hitsCount = 0;
+
+    for (int i = 0; i < 4 && node.children[i] != Node::unusedChild; i++) {
+      if (t0[i] > t1[i])
+        continue;
+
+      TraversalInfo hit = {node.children[i], node.trianglesCount[i], t0[i]};
+
+      int k = hitsCount++;
+      while (k > 0 && hits[k - 1].tNear < hit.tNear) {
+        hits[k] = hits[k - 1];
+        k--;
+      }
+      hits[k] = hit;
+    }
+
+    assert(stackSize + hitsCount <= traversalStackSize);
+    for (int i = 0; i < hitsCount; i++)
+      traversalStack[stackSize++] = hits[i];
+  }
+
+  if (closestIntersection.t == std::numeric_limits<double>::infinity())
+    return false;
+
+  intersection.t = closestIntersection.t;
+  intersection.epsilon = closestIntersection.epsilon;
+  return true;
+}
+
+void Bvh::IntersectLeafTriangles(
+    const Ray& ray, int32_t firstTriangle, int32_t trianglesCount,
+    Triangle::Intersection& closestIntersection) const
+{
+  for (int32_t i = 0; i < trianglesCount; i++) {
+    int32_t triangleIndex = triangleIndices[firstTriangle + i];
+    const auto& p = mesh.triangles[triangleIndex].points;
+
+    Triangle triangle = {{Vector(mesh.vertices[p[0].vertexIndex]),
+                          Vector(mesh.vertices[p[1].vertexIndex]),
+                          Vector(mesh.vertices[p[2].vertexIndex])}};
+
+    Triangle::Intersection intersection;
+    bool hitFound = IntersectTriangle(ray, triangle, intersection);
+    if (hitFound && intersection.t < closestIntersection.t) {
+      closestIntersection = intersection;
+    }
+  }
+}
+
+const TriangleMesh& Bvh::GetMesh() const
+{
+  return mesh;
+}
+
+const BoundingBox& Bvh::GetMeshBounds() const
+{
+  return meshBounds;
+}
+
+int32_t Bvh::GetNodesCount() const
+{
+  return static_cast<int32_t>(nodes.size());
+}
+
+size_t Bvh::GetMemoryUsage() const
+{
+  return nodes.size() * sizeof(Node) + triangleIndices.size() * 4;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "ray.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include "vector.h"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// 4-wide bounding volume hierarchy. Provides the same query interface as
+// KdTree so both accelerators can be benchmarked on the same workload.
+class Bvh {
+  struct Node;
+
+public:
+  struct Intersection {
+    double t = std::numeric_limits<double>::infinity();
+    double epsilon = 0.0;
+  };
+
+public:
+  Bvh(std::vector<Node>&& nodes, std::vector<int32_t>&& triangleIndices,
+      const TriangleMesh& mesh);
+
+  bool Intersect(const Ray& ray, Intersection& intersection) const;
+
+  const TriangleMesh& GetMesh() const;
+  const BoundingBox& GetMeshBounds() const;
+
+  int32_t GetNodesCount() const;
+  size_t GetMemoryUsage() const;
+
+private:
+  void IntersectLeafTriangles(
+      const Ray& ray, int32_t firstTriangle, int32_t trianglesCount,
+      Triangle::Intersection& closestIntersection) const;
+
+private:
+  friend class BvhBuilder;
+
+  enum { maxTraversalDepth = 64 };
+  enum { traversalStackSize = 3 * maxTraversalDepth + 4 };
+
+  struct Node {
+    enum : int32_t { unusedChild = -1 };
+
+    // Child bounds in structure of arrays layout: boundsMin[axis][child].
+    float boundsMin[3][4];
+    float boundsMax[3][4];
+
+    // For interior child it's an index of the child node, for leaf child
+    // it's an offset in triangleIndices array. Unused slots are at the end
+    // and are marked with unusedChild value.
+    int32_t children[4];
+
+    // 0 for interior child nodes.
+    int32_t trianglesCount[4];
+  };
+
+private:
+  const std::vector<Node> nodes;
+  const std::vector<int32_t> triangleIndices;
+  const TriangleMesh& mesh;
+  const BoundingBox meshBounds;
+};
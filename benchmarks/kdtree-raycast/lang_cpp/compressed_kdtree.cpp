@@ -0,0 +1,66 @@
+#include "compressed_kdtree.h"
+#include "triangle.h"
+#include <limits>
+
+namespace {
+KdTree BuildDecodedKdTree(const CompressedMesh& mesh,
+                          const KdTreeBuilder::BuildParams& buildParams)
+{
+  TriangleMesh decodedMesh = mesh.Decode();
+  return KdTreeBuilder(decodedMesh, buildParams).BuildTree();
+}
+} // namespace
+
+CompressedKdTree::CompressedKdTree(
+    const CompressedMesh& mesh, const KdTreeBuilder::BuildParams& buildParams)
+: mesh(mesh)
+, kdTree(BuildDecodedKdTree(mesh, buildParams), emptyMesh)
+{
+}
+
+bool CompressedKdTree::Intersect(const Ray& ray,
+                                 Intersection& intersection) const
+{
+  Triangle::Intersection closestIntersection;
+  kdTree.Traverse(ray, [&](KdTree::Node leaf) {
+    IntersectLeafTriangles(ray, leaf, closestIntersection);
+    return closestIntersection.t;
+  });
+
+  if (closestIntersection.t == std::numeric_limits<double>::infinity())
+    return false;
+
+  intersection.t = closestIntersection.t;
+  intersection.epsilon = closestIntersection.epsilon;
+  return true;
+}
+
+const CompressedMesh& CompressedKdTree::GetCompressedMesh() const
+{
+  return mesh;
+}
+
+const BoundingBox& CompressedKdTree::GetMeshBounds() const
+{
+  return kdTree.meshBounds;
+}
+
+void CompressedKdTree::IntersectLeafTriangles(
+    const Ray& ray, KdTree::Node leaf,
+    Triangle::Intersection& closestIntersection) const
+{
+  const int32_t trianglesCount = leaf.GetTrianglesCount();
+  for (int32_t i = 0; i < trianglesCount; i++) {
+    int32_t triangleIndex = (trianglesCount == 1)
+                                ? leaf.GetIndex()
+                                : kdTree.triangleIndices[leaf.GetIndex() + i];
+
+    Triangle triangle = mesh.GetTriangle(triangleIndex);
+
+    Triangle::Intersection intersection;
+    bool hitFound = IntersectTriangle(ray, triangle, intersection);
+    if (hitFound && intersection.t < closestIntersection.t) {
+      closestIntersection = intersection;
+    }
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "compressed_mesh.h"
+#include "kdtree.h"
+#include "kdtree_builder.h"
+#include "ray.h"
+
+// Traverses the nodes of a KdTree but intersects triangles of
+// CompressedMesh, the triangles are decoded in the leaves. Intersections
+// are the same as KdTree produces for the decoded mesh.
+class CompressedKdTree {
+public:
+  using Intersection = KdTree::Intersection;
+
+  // Builds the tree for mesh.Decode(): quantization moves vertices, so the
+  // leaves of the tree built for the original mesh can miss the decoded
+  // triangles. The decoded mesh is freed when the tree is built, only
+  // nodes and triangle indices are kept.
+  CompressedKdTree(const CompressedMesh& mesh,
+                   const KdTreeBuilder::BuildParams& buildParams);
+
+  bool Intersect(const Ray& ray, Intersection& intersection) const;
+
+  const CompressedMesh& GetCompressedMesh() const;
+  const BoundingBox& GetMeshBounds() const;
+
+private:
+  void IntersectLeafTriangles(
+      const Ray& ray, KdTree::Node leaf,
+      Triangle::Intersection& closestIntersection) const;
+
+private:
+  const CompressedMesh& mesh;
+  // the tree refers to the empty mesh, Intersect does not access it
+  TriangleMesh emptyMesh;
+  KdTree kdTree;
+};
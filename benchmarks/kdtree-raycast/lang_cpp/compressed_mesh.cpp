@@ -0,0 +1,150 @@
+#include "common.h"
+#include "compressed_mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+CompressedMesh::CompressedMesh(const TriangleMesh& mesh, Precision precision)
+: precision(precision)
+, trianglesCount(mesh.GetTrianglesCount())
+, verticesCount(static_cast<int32_t>(mesh.vertices.size()))
+{
+  // quantize vertices, the bounds include unreferenced vertices too
+  BoundingBox_f bounds;
+  for (const auto& vertex : mesh.vertices)
+    bounds.Extend(vertex);
+
+  const int bits = (precision == Precision::Bits16) ? 16 : 21;
+  const uint32_t maxValue = (1u << bits) - 1;
+
+  origin = bounds.minPoint;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = bounds.maxPoint[axis] - bounds.minPoint[axis];
+    scale[axis] = (extent > 0.0f) ? extent / maxValue : 0.0f;
+  }
+
+  if (precision == Precision::Bits16)
+    vertices16.resize(3 * mesh.vertices.size());
+  else
+    vertices21.resize(mesh.vertices.size());
+
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    uint32_t q[3];
+    for (int axis = 0; axis < 3; axis++) {
+      double value = 0.0;
+      if (scale[axis] > 0.0f)
+        value = (mesh.vertices[i][axis] - origin[axis]) / double(scale[axis]);
+      q[axis] = static_cast<uint32_t>(
+          std::min<double>(std::max(std::round(value), 0.0), maxValue));
+    }
+    if (precision == Precision::Bits16) {
+      for (int axis = 0; axis < 3; axis++)
+        vertices16[3 * i + axis] = static_cast<uint16_t>(q[axis]);
+    }
+    else {
+      vertices21[i] = uint64_t(q[0]) | (uint64_t(q[1]) << 21) |
+                      (uint64_t(q[2]) << 42);
+    }
+  }
+
+  for (int32_t i = 0; i < verticesCount; i++) {
+    Vector_f error = GetVertex(i) - mesh.vertices[i];
+    for (int axis = 0; axis < 3; axis++)
+      maxError = std::max(maxError, std::abs(error[axis]));
+  }
+
+  // encode vertex indices
+  const int32_t blocksCount = (trianglesCount + blockSize - 1) / blockSize;
+  indexBlocks.resize(blocksCount);
+  indexData.reserve(3 * static_cast<size_t>(trianglesCount));
+
+  for (int32_t block = 0; block < blocksCount; block++) {
+    const int32_t first = block * blockSize;
+    const int32_t last = std::min(first + blockSize, trianglesCount);
+
+    int32_t minIndex = std::numeric_limits<int32_t>::max();
+    int32_t maxIndex = 0;
+    for (int32_t i = first; i < last; i++) {
+      for (const auto& point : mesh.triangles[i].points) {
+        minIndex = std::min(minIndex, point.vertexIndex);
+        maxIndex = std::max(maxIndex, point.vertexIndex);
+      }
+    }
+
+    if (indexData.size() >= wideBlockFlag - 6 * blockSize)
+      RuntimeError("too large model for compressed mesh");
+
+    IndexBlock& header = indexBlocks[block];
+    header.baseIndex = minIndex;
+    header.dataOffset = static_cast<uint32_t>(indexData.size());
+
+    if (maxIndex - minIndex <= 0xffff) {
+      for (int32_t i = first; i < last; i++) {
+        for (const auto& point : mesh.triangles[i].points)
+          indexData.push_back(
+              static_cast<uint16_t>(point.vertexIndex - minIndex));
+      }
+    }
+    else {
+      header.dataOffset |= wideBlockFlag;
+      for (int32_t i = first; i < last; i++) {
+        uint16_t values[6];
+        memcpy(values, mesh.triangles[i].points.data(), 12);
+        indexData.insert(indexData.end(), values, values + 6);
+      }
+    }
+  }
+  LargeVector<uint16_t>(indexData).swap(indexData);
+}
+
+int32_t CompressedMesh::GetTrianglesCount() const
+{
+  return trianglesCount;
+}
+
+CompressedMesh::Precision CompressedMesh::GetPrecision() const
+{
+  return precision;
+}
+
+TriangleMesh CompressedMesh::Decode() const
+{
+  TriangleMesh mesh;
+  mesh.vertices.resize(verticesCount);
+  for (int32_t i = 0; i < verticesCount; i++)
+    mesh.vertices[i] = GetVertex(i);
+
+  mesh.triangles.resize(trianglesCount);
+  for (int32_t i = 0; i < trianglesCount; i++) {
+    std::array<int32_t, 3> indices = GetVertexIndices(i);
+    for (int k = 0; k < 3; k++)
+      mesh.triangles[i].points[k].vertexIndex = indices[k];
+  }
+  return mesh;
+}
+
+float CompressedMesh::GetMaxError() const
+{
+  return maxError;
+}
+
+size_t CompressedMesh::GetMemoryUsage() const
+{
+  return vertices16.size() * sizeof(uint16_t) +
+         vertices21.size() * sizeof(uint64_t) +
+         indexBlocks.size() * sizeof(IndexBlock) +
+         indexData.size() * sizeof(uint16_t);
+}
+
+double CompressedMesh::GetWideBlocksFraction() const
+{
+  if (indexBlocks.empty())
+    return 0.0;
+
+  size_t wideBlocks = 0;
+  for (const auto& block : indexBlocks) {
+    if (block.dataOffset & wideBlockFlag)
+      wideBlocks++;
+  }
+  return double(wideBlocks) / indexBlocks.size();
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "large_array.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+#include "vector.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+// Read-only compressed copy of TriangleMesh for meshes that do not fit in
+// memory together with the tree. Vertex coordinates are quantized relative
+// to the mesh bounds: 16 bits per coordinate (6 bytes per vertex) or 21 bits
+// (one 8 byte word per vertex). Triangle vertex indices are stored per block
+// of 64 triangles as 16-bit deltas from the smallest index in the block;
+// blocks with larger spread keep 32-bit indices. With vertices ordered by
+// locality (see ReorderMeshForLocality) almost all blocks use 16-bit deltas
+// and a triangle takes a bit more than 6 bytes instead of 12.
+//
+// Any triangle can be decoded independently of the others with a couple of
+// loads, so the decoder is used directly by the traversal code.
+class CompressedMesh {
+public:
+  enum class Precision { Bits16, Bits21 };
+
+  CompressedMesh(const TriangleMesh& mesh, Precision precision);
+
+  int32_t GetTrianglesCount() const;
+  Precision GetPrecision() const;
+
+  // Returns triangle with dequantized vertex positions. The values are
+  // exactly the same as in the mesh returned by Decode.
+  Triangle GetTriangle(int32_t triangleIndex) const;
+
+  // Uncompressed mesh with dequantized vertices (without normals).
+  TriangleMesh Decode() const;
+
+  // Max distance along any axis between original and dequantized vertex.
+  float GetMaxError() const;
+
+  size_t GetMemoryUsage() const;
+  // Fraction of triangle blocks that could not use 16-bit deltas.
+  double GetWideBlocksFraction() const;
+
+private:
+  enum { blockSize = 64 };
+  enum : uint32_t { wideBlockFlag = 0x80000000u };
+
+  struct IndexBlock {
+    int32_t baseIndex;
+    // offset of the block in indexData, wideBlockFlag is set for blocks
+    // with 32-bit indices
+    uint32_t dataOffset;
+  };
+
+  Vector_f GetVertex(int32_t vertexIndex) const;
+  std::array<int32_t, 3> GetVertexIndices(int32_t triangleIndex) const;
+
+private:
+  Precision precision;
+  int32_t trianglesCount = 0;
+  int32_t verticesCount = 0;
+  Vector_f origin;
+  Vector_f scale;
+  float maxError = 0.0f;
+
+  LargeVector<uint16_t> vertices16; // 3 values per vertex
+  LargeVector<uint64_t> vertices21; // x | y << 21 | z << 42
+  LargeVector<IndexBlock> indexBlocks;
+  LargeVector<uint16_t> indexData;
+};
+
+inline Vector_f CompressedMesh::GetVertex(int32_t vertexIndex) const
+{
+  uint32_t q[3];
+  if (precision == Precision::Bits16) {
+    const uint16_t* v = &vertices16[3 * static_cast<size_t>(vertexIndex)];
+    q[0] = v[0];
+    q[1] = v[1];
+    q[2] = v[2];
+  }
+  else {
+    uint64_t v = vertices21[vertexIndex];
+    q[0] = static_cast<uint32_t>(v & 0x1fffff);
+    q[1] = static_cast<uint32_t>((v >> 21) & 0x1fffff);
+    q[2] = static_cast<uint32_t>(v >> 42);
+  }
+  return Vector_f(origin.x + static_cast<float>(q[0]) * scale.x,
+                  origin.y + static_cast<float>(q[1]) * scale.y,
+                  origin.z + static_cast<float>(q[2]) * scale.z);
+}
+
+inline std::array<int32_t, 3>
+CompressedMesh::GetVertexIndices(int32_t triangleIndex) const
+{
+  const IndexBlock& block = indexBlocks[triangleIndex / blockSize];
+  const size_t k = triangleIndex % blockSize;
+  std::array<int32_t, 3> indices;
+
+  if (block.dataOffset & wideBlockFlag) {
+    size_t offset = (block.dataOffset & ~wideBlockFlag) + 6 * k;
+    memcpy(indices.data(), &indexData[offset], 12);
+  }
+  else {
+    const uint16_t* deltas = &indexData[block.dataOffset + 3 * k];
+    indices[0] = block.baseIndex + deltas[0];
+    indices[1] = block.baseIndex + deltas[1];
+    indices[2] = block.baseIndex + deltas[2];
+  }
+  return indices;
+}
+
+inline Triangle CompressedMesh::GetTriangle(int32_t triangleIndex) const
+{
+  std::array<int32_t, 3> indices = GetVertexIndices(triangleIndex);
+  Triangle triangle = {{Vector(GetVertex(indices[0])),
+                        Vector(GetVertex(indices[1])),
+                        Vector(GetVertex(indices[2]))}};
+  return triangle;
+}
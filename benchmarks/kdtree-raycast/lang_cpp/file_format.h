@@ -0,0 +1,81 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+// Common parts of the binary files: kdtree file, compressed kdtree file,
+// mesh file and scene bundle. The headers start with 8 byte magic and
+// 4 byte version, all headers except the mesh file one continue with the
+// byte order mark.
+
+enum : uint32_t { byteOrderMark = 0x01020304 };
+enum { sectionAlignment = 64 };
+
+// Rounds the offset up to sectionAlignment.
+uint64_t AlignOffset(uint64_t offset);
+
+// Copies the header from the beginning of the file, returns false if the
+// file is shorter than the header.
+template <typename Header>
+bool ReadFileHeader(const MappedFile& file, Header& header)
+{
+  if (file.GetSize() < sizeof(Header))
+    return false;
+  memcpy(&header, file.GetData(), sizeof(Header));
+  return true;
+}
+
+// Zeroes the header and sets magic, version and byte order mark.
+template <typename Header>
+void InitFileHeader(Header& header, const char (&magic)[8], uint32_t version)
+{
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic, sizeof(header.magic));
+  header.version = version;
+  header.byteOrderMark = byteOrderMark;
+}
+
+// Returns false for a file of another format, version or byte order.
+template <typename Header>
+bool CheckFileHeader(const Header& header, const char (&magic)[8],
+                     uint32_t version)
+{
+  return memcmp(header.magic, magic, sizeof(header.magic)) == 0 &&
+         header.version == version && header.byteOrderMark == byteOrderMark;
+}
+
+// Writes zero padding up to the offset and then the section data, position
+// is the current position in the file and is moved past the section.
+void WriteSection(std::ofstream& file, uint64_t& position, uint64_t offset,
+                  const void* data, uint64_t size);
+
+// Moves the written temporary file to its final name, the old file with
+// this name is replaced. The temporary file is deleted if this fails.
+bool ReplaceWithTemporaryFile(const std::string& temporaryFileName,
+                              const std::string& fileName);
+
+// Creates the file with the content written by writeContent(file). The
+// content is written to a temporary file first, so readers never see
+// partial file. Returns false if the file can't be written.
+template <typename WriteContent>
+bool WriteFileAtomically(const std::string& fileName,
+                         WriteContent writeContent)
+{
+  const std::string temporaryFileName = fileName + ".tmp";
+  {
+    std::ofstream file(temporaryFileName,
+                       std::ios_base::out | std::ios_base::binary);
+    if (file)
+      writeContent(file);
+    if (!file) {
+      file.close();
+      std::remove(temporaryFileName.c_str());
+      return false;
+    }
+  }
+  return ReplaceWithTemporaryFile(temporaryFileName, fileName);
+}
@@ -1,18 +1,65 @@
 #include "common.h"
 #include "kdtree.h"
 #include "triangle.h"
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 
-KdTree::KdTree(std::vector<Node>&& nodes,
-               std::vector<int32_t>&& triangleIndices, const TriangleMesh& mesh)
-: nodes(std::move(nodes))
-, triangleIndices(std::move(triangleIndices))
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#endif
+
+#ifdef KDTREE_TRAVERSAL_STATS
+KdTree::TraversalStats KdTree::traversalStats;
+#endif
+
+namespace {
+inline void Prefetch(const void* address)
+{
+#ifdef _MSC_VER
+  _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+  __builtin_prefetch(address);
+#endif
+}
+} // namespace
+
+KdTree::KdTree(LargeVector<Node>&& nodes,
+               LargeVector<int32_t>&& triangleIndices, const TriangleMesh& mesh)
+: nodesStorage(std::move(nodes))
+, triangleIndicesStorage(std::move(triangleIndices))
+, nodes(nodesStorage.data(), nodesStorage.size())
+, triangleIndices(triangleIndicesStorage.data(), triangleIndicesStorage.size())
 , mesh(mesh)
 , meshBounds(mesh.GetBounds())
 {
 }
 
+KdTree::KdTree(const KdTree& kdTree, const TriangleMesh& mesh)
+: nodesStorage(kdTree.nodes.begin(), kdTree.nodes.end())
+, triangleIndicesStorage(kdTree.triangleIndices.begin(),
+                         kdTree.triangleIndices.end())
+, nodes(nodesStorage.data(), nodesStorage.size())
+, triangleIndices(triangleIndicesStorage.data(), triangleIndicesStorage.size())
+, mesh(mesh)
+, meshBounds(kdTree.meshBounds)
+{
+}
+
+KdTree::KdTree(const KdTree& kdTree, const TriangleMesh& mesh,
+               const std::vector<int32_t>& triangleRemap)
+: KdTree(kdTree, mesh)
+{
+  // single triangle leaves store triangle index in the node
+  for (auto& node : nodesStorage) {
+    if (node.IsLeaf() && node.GetTrianglesCount() == 1)
+      node.InitLeafWithSingleTriangle(triangleRemap[node.GetIndex()]);
+  }
+  for (auto& index : triangleIndicesStorage) {
+    index = triangleRemap[index];
+  }
+}
+
 KdTree::KdTree(const std::string& fileName, const TriangleMesh& mesh)
 : mesh(mesh)
 , meshBounds(mesh.GetBounds())
@@ -27,11 +74,10 @@ KdTree::KdTree(const std::string& fileName, const TriangleMesh& mesh)
   if (!file)
     RuntimeError("failed to read nodes count: " + fileName);
 
-  auto& mutableNodes = const_cast<std::vector<Node>&>(nodes);
-  mutableNodes.resize(nodesCount);
+  nodesStorage.resize(nodesCount);
 
   auto nodesBytesCount = nodesCount * sizeof(Node);
-  file.read(reinterpret_cast<char*>(mutableNodes.data()), nodesBytesCount);
+  file.read(reinterpret_cast<char*>(nodesStorage.data()), nodesBytesCount);
   if (!file)
     RuntimeError("failed to read kdTree nodes: " + fileName);
 
@@ -41,13 +87,52 @@ KdTree::KdTree(const std::string& fileName, const TriangleMesh& mesh)
   if (!file)
     RuntimeError("failed to read triangle indices count: " + fileName);
 
-  auto& mutableIndices = const_cast<std::vector<int32_t>&>(triangleIndices);
-  mutableIndices.resize(indicesCount);
+  triangleIndicesStorage.resize(indicesCount);
 
   auto indicesBytesCount = indicesCount * 4;
-  file.read(reinterpret_cast<char*>(mutableIndices.data()), indicesBytesCount);
+  file.read(reinterpret_cast<char*>(triangleIndicesStorage.data()),
+            indicesBytesCount);
   if (!file)
     RuntimeError("failed to read kdTree triangle indices: " + fileName);
+
+  nodes = ConstArrayView<Node>(nodesStorage.data(), nodesStorage.size());
+  triangleIndices = ConstArrayView<int32_t>(triangleIndicesStorage.data(),
+                                            triangleIndicesStorage.size());
+}
+
+// Moved vectors keep their buffers, so the views stay valid.
+KdTree::KdTree(KdTree&& other)
+: nodesStorage(std::move(other.nodesStorage))
+, triangleIndicesStorage(std::move(other.triangleIndicesStorage))
+, mappedFile(std::move(other.mappedFile))
+, nodes(other.nodes)
+, triangleIndices(other.triangleIndices)
+, mesh(other.mesh)
+, meshBounds(other.meshBounds)
+{
+}
+
+KdTree::KdTree(std::unique_ptr<MappedFile> mappedFile,
+               ConstArrayView<Node> nodes,
+               ConstArrayView<int32_t> triangleIndices,
+               const TriangleMesh& mesh, const BoundingBox& meshBounds)
+: mappedFile(std::move(mappedFile))
+, nodes(nodes)
+, triangleIndices(triangleIndices)
+, mesh(mesh)
+, meshBounds(meshBounds)
+{
+}
+
+KdTree::KdTree(KdTree&& kdTree, const TriangleMesh& mesh)
+: nodesStorage(std::move(kdTree.nodesStorage))
+, triangleIndicesStorage(std::move(kdTree.triangleIndicesStorage))
+, mappedFile(std::move(kdTree.mappedFile))
+, nodes(kdTree.nodes)
+, triangleIndices(kdTree.triangleIndices)
+, mesh(mesh)
+, meshBounds(kdTree.meshBounds)
+{
 }
 
 void KdTree::SaveToFile(const std::string& fileName) const
@@ -78,109 +163,177 @@ void KdTree::SaveToFile(const std::string& fileName) const
 
 bool KdTree::Intersect(const Ray& ray, Intersection& intersection) const
 {
-  auto boundsIntersection = meshBounds.Intersect(ray);
-  if (!boundsIntersection.found)
+  // the counters are not updated without KDTREE_TRAVERSAL_STATS
+  RayTraversalStats rayStats;
+
+  Triangle::Intersection closestIntersection;
+  Traverse(ray,
+           [&](Node leaf) {
+             IntersectLeafTriangles(ray, leaf, closestIntersection);
+             return closestIntersection.t;
+           },
+           &rayStats);
+
+  KDTREE_STATS(traversalStats.AddRay(rayStats));
+
+  if (closestIntersection.t == std::numeric_limits<double>::infinity())
     return false;
 
-  struct TraversalInfo {
+  intersection.t = closestIntersection.t;
+  intersection.epsilon = closestIntersection.epsilon;
+  return true;
+}
+
+int32_t KdTree::IntersectAll(const Ray& ray, Hit* hits, int32_t maxHits) const
+{
+  assert(maxHits > 0);
+  int32_t hitsCount = 0;
+
+  // when the buffer is full only hits closer than the last one can be added
+  Traverse(ray, [&](Node leaf) {
+    IntersectLeafTrianglesAll(ray, leaf, hits, maxHits, hitsCount);
+    return (hitsCount < maxHits) ? std::numeric_limits<double>::infinity()
+                                 : hits[maxHits - 1].t;
+  });
+  return hitsCount;
+}
+
+void KdTree::IntersectInterleaved(const Ray* rays,
+                                  Intersection* intersections,
+                                  int32_t raysCount, int groupSize) const
+{
+  assert(groupSize > 0 && groupSize <= maxInterleavedRays);
+
+  // Each ray advances as a small state machine. Leaf processing is split in
+  // stages because of the dependent loads: triangle indices, then triangle
+  // vertex indices, then vertices.
+  enum Stage { traverseNode, prefetchVertices, intersectLeaf, finished };
+
+  struct RayState {
+    const Ray* ray;
+    Intersection* intersection;
+    Stage stage;
     const Node* node;
     double tMin;
     double tMax;
+    Triangle::Intersection closestIntersection;
+    TraversalEntry traversalStack[maxTraversalDepth];
+    int traversalStackSize;
+  };
+  RayState states[maxInterleavedRays];
+
+  int32_t nextRay = 0;
+
+  // starts the next ray from the batch or marks the slot as finished
+  auto startRay = [&](RayState& state) {
+    while (nextRay < raysCount) {
+      const Ray& ray = rays[nextRay];
+      Intersection& intersection = intersections[nextRay];
+      nextRay++;
+
+      intersection = Intersection();
+      auto boundsIntersection = meshBounds.Intersect(ray);
+      if (!boundsIntersection.found)
+        continue;
+
+      state.ray = &ray;
+      state.intersection = &intersection;
+      state.stage = traverseNode;
+      state.node = &nodes[0];
+      state.tMin = boundsIntersection.t0;
+      state.tMax = boundsIntersection.t1;
+      state.closestIntersection = Triangle::Intersection();
+      state.traversalStackSize = 0;
+      return;
+    }
+    state.stage = finished;
   };
-  TraversalInfo traversalStack[maxTraversalDepth];
-  int traversalStackSize = 0;
-
-  double tMin = boundsIntersection.t0;
-  double tMax = boundsIntersection.t1;
-
-  Triangle::Intersection closestIntersection;
-  auto node = &nodes[0];
-
-  while (closestIntersection.t > tMin) {
-    if (node->IsInteriorNode()) {
-      int axis = node->GetSplitAxis();
 
-      double distanceToSplitPlane =
-          node->GetSplitPosition() - ray.GetOrigin()[axis];
+  auto finishRay = [&](RayState& state) {
+    const double infinity = std::numeric_limits<double>::infinity();
+    if (state.closestIntersection.t != infinity) {
+      state.intersection->t = state.closestIntersection.t;
+      state.intersection->epsilon = state.closestIntersection.epsilon;
+    }
+    startRay(state);
+  };
 
-      auto belowChild = node + 1;
-      auto aboveChild = &nodes[node->GetAboveChild()];
+  auto getLeafTriangle = [this](Node leaf, int32_t i) {
+    return (leaf.GetTrianglesCount() == 1)
+               ? leaf.GetIndex()
+               : triangleIndices[leaf.GetIndex() + i];
+  };
 
-      if (distanceToSplitPlane != 0.0) { // general case
-        const Node *firstChild, *secondChild;
+  int activeRays = 0;
+  for (int i = 0; i < groupSize; i++) {
+    startRay(states[i]);
+    if (states[i].stage != finished)
+      activeRays++;
+  }
 
-        if (distanceToSplitPlane > 0.0) {
-          firstChild = belowChild;
-          secondChild = aboveChild;
-        }
-        else {
-          firstChild = aboveChild;
-          secondChild = belowChild;
-        }
+  while (activeRays > 0) {
+    for (int i = 0; i < groupSize; i++) {
+      RayState& state = states[i];
 
-        // tSplit != 0 (since distanceToSplitPlane != 0)
-        double tSplit = distanceToSplitPlane * ray.GetInvDirection()[axis];
-        if (tSplit >= tMax || tSplit < 0.0)
-          node = firstChild;
-        else if (tSplit <= tMin)
-          node = secondChild;
-        else { // tMin < tSplit < tMax
-          assert(traversalStackSize < maxTraversalDepth);
-          traversalStack[traversalStackSize++] = {secondChild, tSplit, tMax};
-          node = firstChild;
-          tMax = tSplit;
+      switch (state.stage) {
+      case traverseNode:
+        if (state.closestIntersection.t <= state.tMin) {
+          finishRay(state);
+          break;
         }
-      }
-      else { // special case, distanceToSplitPlane == 0.0
-        if (ray.GetDirection()[axis] > 0.0) {
-          if (tMin > 0.0)
-            node = aboveChild;
-          else { // tMin == 0.0
-            assert(traversalStackSize < maxTraversalDepth);
-            traversalStack[traversalStackSize++] = {aboveChild, 0.0, tMax};
-            // check single point [0.0, 0.0]
-            node = belowChild;
-            tMax = 0.0;
-          }
+        if (state.node->IsInteriorNode()) {
+          state.node = TraverseInteriorNode(
+              *state.ray, state.node, state.tMin, state.tMax,
+              state.traversalStack, state.traversalStackSize);
+          Prefetch(state.node);
         }
-        else if (ray.GetDirection()[axis] < 0.0) {
-          if (tMin > 0.0)
-            node = belowChild;
-          else { // tMin == 0.0
-            assert(traversalStackSize < maxTraversalDepth);
-            traversalStack[traversalStackSize++] = {belowChild, 0.0, tMax};
-            // check single point [0.0, 0.0]
-            node = aboveChild;
-            tMax = 0.0;
-          }
+        else if (state.node->GetTrianglesCount() == 0) {
+          state.stage = intersectLeaf;
         }
-        else { // ray.direction[axis] == 0.0
-          // for both nodes check [tMin, tMax] range
-          assert(traversalStackSize < maxTraversalDepth);
-          traversalStack[traversalStackSize++] = {aboveChild, tMin, tMax};
-          node = belowChild;
+        else {
+          if (state.node->GetTrianglesCount() == 1)
+            Prefetch(&mesh.triangles[state.node->GetIndex()]);
+          else
+            Prefetch(&triangleIndices[state.node->GetIndex()]);
+          state.stage = prefetchVertices;
         }
-      }
-    }
-    else { // leaf node
-      IntersectLeafTriangles(ray, *node, closestIntersection);
+        break;
 
-      if (traversalStackSize == 0)
+      case prefetchVertices:
+        for (int32_t k = 0; k < state.node->GetTrianglesCount(); k++) {
+          int32_t triangleIndex = getLeafTriangle(*state.node, k);
+          const auto& p = mesh.triangles[triangleIndex].points;
+          Prefetch(&mesh.vertices[p[0].vertexIndex]);
+          Prefetch(&mesh.vertices[p[1].vertexIndex]);
+          Prefetch(&mesh.vertices[p[2].vertexIndex]);
+        }
+        state.stage = intersectLeaf;
         break;
 
-      --traversalStackSize;
-      node = traversalStack[traversalStackSize].node;
-      tMin = traversalStack[traversalStackSize].tMin;
-      tMax = traversalStack[traversalStackSize].tMax;
-    }
-  } // while (closestIntersection.t > tMin)
+      case intersectLeaf:
+        IntersectLeafTriangles(*state.ray, *state.node,
+                               state.closestIntersection);
 
-  if (closestIntersection.t == std::numeric_limits<double>::infinity())
-    return false;
+        if (state.traversalStackSize == 0) {
+          finishRay(state);
+          break;
+        }
+        --state.traversalStackSize;
+        state.node = state.traversalStack[state.traversalStackSize].node;
+        state.tMin = state.traversalStack[state.traversalStackSize].tMin;
+        state.tMax = state.traversalStack[state.traversalStackSize].tMax;
+        Prefetch(state.node);
+        state.stage = traverseNode;
+        break;
 
-  intersection.t = closestIntersection.t;
-  intersection.epsilon = closestIntersection.epsilon;
-  return true;
+      case finished:
+        continue;
+      }
+
+      if (state.stage == finished)
+        activeRays--;
+    }
+  }
 }
 
 void KdTree::IntersectLeafTriangles(
@@ -218,6 +371,114 @@ void KdTree::IntersectLeafTriangles(
   }
 }
 
+void KdTree::IntersectLeafTrianglesAll(const Ray& ray, Node leaf, Hit* hits,
+                                       int32_t maxHits,
+                                       int32_t& hitsCount) const
+{
+  const int32_t leafTrianglesCount = leaf.GetTrianglesCount();
+
+  for (int32_t i = 0; i < leafTrianglesCount; i++) {
+    int32_t triangleIndex = (leafTrianglesCount == 1)
+                                ? leaf.GetIndex()
+                                : triangleIndices[leaf.GetIndex() + i];
+
+    const auto& p = mesh.triangles[triangleIndex].points;
+
+    Triangle triangle = {{Vector(mesh.vertices[p[0].vertexIndex]),
+                          Vector(mesh.vertices[p[1].vertexIndex]),
+                          Vector(mesh.vertices[p[2].vertexIndex])}};
+
+    Triangle::Intersection intersection;
+    if (!IntersectTriangle(ray, triangle, intersection))
+      continue;
+
+    // The hit is farther than all stored hits and there is no room for it.
+    // This also rejects duplicates of the hits that were pushed out of the
+    // buffer since their distance is not less than the last stored hit.
+    if (hitsCount == maxHits && intersection.t >= hits[maxHits - 1].t)
+      continue;
+
+    // Find insertion position. The same triangle referenced by several
+    // leaves produces exactly the same t, so duplicates are searched only
+    // among the hits with equal distance.
+    int32_t position = hitsCount;
+    bool duplicate = false;
+    while (position > 0 && hits[position - 1].t >= intersection.t) {
+      if (hits[position - 1].t == intersection.t &&
+          hits[position - 1].triangleIndex == triangleIndex) {
+        duplicate = true;
+        break;
+      }
+      position--;
+    }
+    if (duplicate)
+      continue;
+
+    if (hitsCount < maxHits)
+      hitsCount++;
+
+    for (int32_t k = hitsCount - 1; k > position; k--)
+      hits[k] = hits[k - 1];
+
+    hits[position] = {intersection.t, intersection.epsilon, triangleIndex};
+  }
+}
+
+#ifdef KDTREE_TRAVERSAL_STATS
+int32_t KdTree::CountLeafCacheLines(Node leaf) const
+{
+  std::vector<uintptr_t> lines;
+  for (int32_t i = 0; i < leaf.GetTrianglesCount(); i++) {
+    int32_t triangleIndex = (leaf.GetTrianglesCount() == 1)
+                                ? leaf.GetIndex()
+                                : triangleIndices[leaf.GetIndex() + i];
+    const auto& triangle = mesh.triangles[triangleIndex];
+    lines.push_back(reinterpret_cast<uintptr_t>(&triangle.points[0]) / 64);
+    lines.push_back(reinterpret_cast<uintptr_t>(&triangle.points[2]) / 64);
+    for (const auto& point : triangle.points) {
+      const auto& vertex = mesh.vertices[point.vertexIndex];
+      lines.push_back(reinterpret_cast<uintptr_t>(&vertex) / 64);
+      // vertex might cross the cache line boundary
+      lines.push_back(reinterpret_cast<uintptr_t>(&vertex.z) / 64);
+    }
+  }
+  std::sort(lines.begin(), lines.end());
+  return static_cast<int32_t>(std::unique(lines.begin(), lines.end()) -
+                              lines.begin());
+}
+#endif
+
+void KdTree::TraversalStats::Reset()
+{
+  *this = TraversalStats();
+}
+
+void KdTree::TraversalStats::AddRay(const RayTraversalStats& rayStats)
+{
+  raysCount++;
+  interiorNodesVisited += rayStats.interiorNodesVisited;
+  leavesVisited += rayStats.leavesVisited;
+  triangleTests += rayStats.triangleTests;
+  stackPushes += rayStats.stackPushes;
+  maxStackDepth = std::max(maxStackDepth, rayStats.maxStackDepth);
+  leafCacheLines += rayStats.leafCacheLines;
+
+  interiorNodesHistogram[GetHistogramBucket(rayStats.interiorNodesVisited)]++;
+  leavesHistogram[GetHistogramBucket(rayStats.leavesVisited)]++;
+  triangleTestsHistogram[GetHistogramBucket(rayStats.triangleTests)]++;
+  stackDepthHistogram[GetHistogramBucket(rayStats.maxStackDepth)]++;
+}
+
+int KdTree::TraversalStats::GetHistogramBucket(int32_t value)
+{
+  int bucket = 0;
+  while (value > 0 && bucket < histogramBucketsCount - 1) {
+    value >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
 const TriangleMesh& KdTree::GetMesh() const
 {
   return mesh;
@@ -240,3 +501,8 @@ uint64_t KdTree::GetHash() const
   }
   return hash;
 }
+
+size_t KdTree::GetMemoryUsage() const
+{
+  return nodes.size() * sizeof(Node) + triangleIndices.size() * 4;
+}
@@ -1,14 +1,81 @@
 #pragma once
 
 #include "bounding_box.h"
+#include "large_array.h"
+#include "mapped_file.h"
 #include "ray.h"
 #include "triangle.h"
 #include "triangle_mesh.h"
 #include "vector.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 
+// Define KDTREE_TRAVERSAL_STATS (e.g. -DKDTREE_TRAVERSAL_STATS) to collect
+// traversal counters in KdTree::Intersect. Without it the counting code is
+// not compiled at all.
+#ifdef KDTREE_TRAVERSAL_STATS
+#define KDTREE_STATS(...) __VA_ARGS__
+#else
+#define KDTREE_STATS(...)
+#endif
+
+// KdTree::Traverse is instantiated for the leaf work of each ray query and
+// must be inlined into it, like the hand written loop it replaced.
+#if defined(_MSC_VER)
+#define KDTREE_FORCE_INLINE __forceinline
+#else
+#define KDTREE_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+class SceneBundle;
+
+// Read-only view of an array owned by somebody else.
+template <typename T>
+class ConstArrayView {
+public:
+  ConstArrayView() = default;
+
+  ConstArrayView(const T* elements, size_t elementsCount)
+  : elements(elements)
+  , elementsCount(elementsCount)
+  {
+  }
+
+  const T& operator[](size_t index) const
+  {
+    return elements[index];
+  }
+
+  const T* data() const
+  {
+    return elements;
+  }
+
+  size_t size() const
+  {
+    return elementsCount;
+  }
+
+  const T* begin() const
+  {
+    return elements;
+  }
+
+  const T* end() const
+  {
+    return elements + elementsCount;
+  }
+
+private:
+  const T* elements = nullptr;
+  size_t elementsCount = 0;
+};
+
 class KdTree {
   struct Node;
 
@@ -18,28 +85,157 @@ public:
     double epsilon = 0.0;
   };
 
+  struct Hit {
+    double t;
+    double epsilon;
+    int32_t triangleIndex;
+  };
+
+  struct RayTraversalStats {
+    int32_t interiorNodesVisited = 0;
+    int32_t leavesVisited = 0;
+    int32_t triangleTests = 0;
+    int32_t stackPushes = 0;
+    int32_t maxStackDepth = 0;
+    int32_t leafCacheLines = 0;
+
+    void StackPush(int32_t stackSize)
+    {
+      stackPushes++;
+      maxStackDepth = std::max(maxStackDepth, stackSize);
+    }
+  };
+
+  struct TraversalStats {
+    // bucket 0 counts zero values, bucket k counts values in [2^(k-1), 2^k),
+    // the last bucket also counts all larger values.
+    enum { histogramBucketsCount = 16 };
+    using Histogram = int64_t[histogramBucketsCount];
+
+    void Reset();
+    void AddRay(const RayTraversalStats& rayStats);
+    static int GetHistogramBucket(int32_t value);
+
+    int64_t raysCount = 0;
+    int64_t interiorNodesVisited = 0;
+    int64_t leavesVisited = 0;
+    int64_t triangleTests = 0;
+    int64_t stackPushes = 0;
+    int32_t maxStackDepth = 0;
+    // distinct 64 byte lines of mesh triangles and vertices read per leaf
+    int64_t leafCacheLines = 0;
+
+    Histogram interiorNodesHistogram = {};
+    Histogram leavesHistogram = {};
+    Histogram triangleTestsHistogram = {};
+    Histogram stackDepthHistogram = {};
+  };
+
+#ifdef KDTREE_TRAVERSAL_STATS
+  // Accumulated by Intersect, not synchronized between threads.
+  static TraversalStats traversalStats;
+#endif
+
 public:
-  KdTree(std::vector<Node>&& nodes, std::vector<int32_t>&& triangleIndices,
+  KdTree(LargeVector<Node>&& nodes, LargeVector<int32_t>&& triangleIndices,
          const TriangleMesh& mesh);
 
+  // Creates a copy of the tree for another instance of the same mesh.
+  // Tree data is allocated according to the current LargeArrayPolicy.
+  KdTree(const KdTree& kdTree, const TriangleMesh& mesh);
+
+  // Creates a copy of the tree for the mesh with reordered triangles,
+  // triangleRemap maps old triangle index to the new one. Leaves keep
+  // their triangle order, so intersection results do not change.
+  KdTree(const KdTree& kdTree, const TriangleMesh& mesh,
+         const std::vector<int32_t>& triangleRemap);
+
   KdTree(const std::string& fileName, const TriangleMesh& mesh);
 
+  KdTree(KdTree&& other);
+
   void SaveToFile(const std::string& fileName) const;
 
   bool Intersect(const Ray& ray, Intersection& intersection) const;
 
+  // Finds up to maxHits closest hits along the ray and stores them in the
+  // provided buffer sorted by t. Each triangle is reported at most once.
+  // Returns the number of stored hits, if it's less than maxHits then all
+  // hits along the ray were found.
+  int32_t IntersectAll(const Ray& ray, Hit* hits, int32_t maxHits) const;
+
+  // Finds closest hits for a batch of independent rays. Traversal of up to
+  // groupSize rays is interleaved: after each step the data needed by the
+  // next step of the ray is prefetched and execution switches to another
+  // ray, so cache misses of one ray overlap with the work on the others.
+  // Rays without hits get intersection with infinite t.
+  void IntersectInterleaved(const Ray* rays, Intersection* intersections,
+                            int32_t raysCount, int groupSize) const;
+
+  enum { maxInterleavedRays = 16 };
+
   const TriangleMesh& GetMesh() const;
   const BoundingBox& GetMeshBounds() const;
 
   uint64_t GetHash() const;
+  size_t GetMemoryUsage() const;
 
 private:
+  struct TraversalEntry {
+    const Node* node;
+    double tMin;
+    double tMax;
+  };
+
+  // Stack traversal shared by the ray queries, they differ only in the work
+  // done in the leaves. Visits the leaves pierced by the ray front to back,
+  // intersectLeaf(leaf) tests the triangles of the leaf and returns the
+  // distance beyond which hits can't change the result anymore, traversal
+  // stops when the next node starts farther. Traversal counters are added
+  // to rayStats if it is not null and KDTREE_TRAVERSAL_STATS is defined.
+  template <typename IntersectLeaf>
+  void Traverse(const Ray& ray, IntersectLeaf intersectLeaf,
+                RayTraversalStats* rayStats = nullptr) const;
+
+  const Node* TraverseInteriorNode(const Ray& ray, const Node* node,
+                                   double& tMin, double& tMax,
+                                   TraversalEntry* stack,
+                                   int& stackSize) const;
+
   void IntersectLeafTriangles(
       const Ray& ray, Node leaf,
       Triangle::Intersection& closestIntersection) const;
 
+  void IntersectLeafTrianglesAll(const Ray& ray, Node leaf, Hit* hits,
+                                 int32_t maxHits, int32_t& hitsCount) const;
+
+#ifdef KDTREE_TRAVERSAL_STATS
+  int32_t CountLeafCacheLines(Node leaf) const;
+#endif
+
 private:
+  friend class CompressedKdTree;
   friend class KdTreeBuilder;
+  friend class RopeKdTree;
+  friend class SceneBundle;
+
+  friend bool SaveKdTreeFile(const std::string& fileName, const KdTree& kdTree,
+                             uint64_t buildParamsHash);
+  friend std::unique_ptr<KdTree>
+  LoadKdTreeFile(const std::string& fileName, const TriangleMesh& mesh,
+                 uint64_t buildParamsHash, bool verifyContent);
+  friend bool SaveCompressedKdTreeFile(const std::string& fileName,
+                                       const KdTree& kdTree,
+                                       uint64_t buildParamsHash);
+  friend std::unique_ptr<KdTree>
+  LoadCompressedKdTreeFile(const std::string& fileName,
+                           const TriangleMesh& mesh, uint64_t buildParamsHash,
+                           bool verifyChecksum, int threadsCount);
+  friend bool SaveSceneBundle(const std::string& fileName,
+                              const KdTree& kdTree, uint64_t buildParamsHash,
+                              bool withTriangleRecords);
+  friend std::unique_ptr<SceneBundle>
+  LoadSceneBundle(const std::string& fileName, bool verifyContent);
 
   enum { maxTraversalDepth = 64 };
 
@@ -122,9 +318,144 @@ private:
     }
   };
 
+  // Tree that uses node and index arrays of the mapped file.
+  KdTree(std::unique_ptr<MappedFile> mappedFile, ConstArrayView<Node> nodes,
+         ConstArrayView<int32_t> triangleIndices, const TriangleMesh& mesh,
+         const BoundingBox& meshBounds);
+
+  // Takes the arrays and the bounds of the tree but refers to another mesh.
+  // CompressedKdTree keeps the tree built for a temporary decoded mesh.
+  KdTree(KdTree&& kdTree, const TriangleMesh& mesh);
+
 private:
-  const std::vector<Node> nodes;
-  const std::vector<int32_t> triangleIndices;
+  // The arrays are either owned by the tree or point to the mapped file.
+  LargeVector<Node> nodesStorage;
+  LargeVector<int32_t> triangleIndicesStorage;
+  std::unique_ptr<MappedFile> mappedFile;
+
+  ConstArrayView<Node> nodes;
+  ConstArrayView<int32_t> triangleIndices;
   const TriangleMesh& mesh;
   const BoundingBox meshBounds;
 };
+
+template <typename IntersectLeaf>
+KDTREE_FORCE_INLINE void KdTree::Traverse(const Ray& ray,
+                                          IntersectLeaf intersectLeaf,
+                                          RayTraversalStats* rayStats) const
+{
+  (void)rayStats; // only used with KDTREE_TRAVERSAL_STATS
+  auto boundsIntersection = meshBounds.Intersect(ray);
+  if (!boundsIntersection.found)
+    return;
+
+  TraversalEntry traversalStack[maxTraversalDepth];
+  int traversalStackSize = 0;
+
+  double tMin = boundsIntersection.t0;
+  double tMax = boundsIntersection.t1;
+
+  double maxDistance = std::numeric_limits<double>::infinity();
+  const Node* node = &nodes[0];
+
+  while (maxDistance > tMin) {
+    if (node->IsInteriorNode()) {
+      KDTREE_STATS(int previousStackSize = traversalStackSize);
+      node = TraverseInteriorNode(ray, node, tMin, tMax, traversalStack,
+                                  traversalStackSize);
+      KDTREE_STATS(if (rayStats != nullptr) {
+        rayStats->interiorNodesVisited++;
+        if (traversalStackSize > previousStackSize)
+          rayStats->StackPush(traversalStackSize);
+      });
+      continue;
+    }
+
+    KDTREE_STATS(if (rayStats != nullptr) {
+      rayStats->leavesVisited++;
+      rayStats->triangleTests += node->GetTrianglesCount();
+      rayStats->leafCacheLines += CountLeafCacheLines(*node);
+    });
+    maxDistance = intersectLeaf(*node);
+
+    if (traversalStackSize == 0)
+      break;
+
+    --traversalStackSize;
+    node = traversalStack[traversalStackSize].node;
+    tMin = traversalStack[traversalStackSize].tMin;
+    tMax = traversalStack[traversalStackSize].tMax;
+  }
+}
+
+// Selects the next node to visit when the traversal reaches interior node.
+// The second child is pushed on the stack if the ray passes through both.
+KDTREE_FORCE_INLINE const KdTree::Node* KdTree::TraverseInteriorNode(
+    const Ray& ray, const Node* node, double& tMin, double& tMax,
+    TraversalEntry* stack, int& stackSize) const
+{
+  int axis = node->GetSplitAxis();
+
+  double distanceToSplitPlane =
+      node->GetSplitPosition() - ray.GetOrigin()[axis];
+
+  auto belowChild = node + 1;
+  auto aboveChild = &nodes[node->GetAboveChild()];
+
+  if (distanceToSplitPlane != 0.0) { // general case
+    const Node *firstChild, *secondChild;
+
+    if (distanceToSplitPlane > 0.0) {
+      firstChild = belowChild;
+      secondChild = aboveChild;
+    }
+    else {
+      firstChild = aboveChild;
+      secondChild = belowChild;
+    }
+
+    // tSplit != 0 (since distanceToSplitPlane != 0)
+    double tSplit = distanceToSplitPlane * ray.GetInvDirection()[axis];
+    if (tSplit >= tMax || tSplit < 0.0)
+      node = firstChild;
+    else if (tSplit <= tMin)
+      node = secondChild;
+    else { // tMin < tSplit < tMax
+      assert(stackSize < maxTraversalDepth);
+      stack[stackSize++] = {secondChild, tSplit, tMax};
+      node = firstChild;
+      tMax = tSplit;
+    }
+  }
+  else { // special case, distanceToSplitPlane == 0.0
+    if (ray.GetDirection()[axis] > 0.0) {
+      if (tMin > 0.0)
+        node = aboveChild;
+      else { // tMin == 0.0
+        assert(stackSize < maxTraversalDepth);
+        stack[stackSize++] = {aboveChild, 0.0, tMax};
+        // check single point [0.0, 0.0]
+        node = belowChild;
+        tMax = 0.0;
+      }
+    }
+    else if (ray.GetDirection()[axis] < 0.0) {
+      if (tMin > 0.0)
+        node = belowChild;
+      else { // tMin == 0.0
+        assert(stackSize < maxTraversalDepth);
+        stack[stackSize++] = {belowChild, 0.0, tMax};
+        // check single point [0.0, 0.0]
+        node = aboveChild;
+        tMax = 0.0;
+      }
+    }
+    else { // ray.direction[axis] == 0.0
+      // for both nodes check [tMin, tMax] range
+      assert(stackSize < maxTraversalDepth);
+      stack[stackSize++] = {aboveChild, tMin, tMax};
+      node = belowChild;
+    }
+  }
+  return node;
+}
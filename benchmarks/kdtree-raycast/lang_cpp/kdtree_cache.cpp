@@ -0,0 +1,54 @@
+#include "common.h"
+#include "kdtree.h"
+#include "kdtree_cache.h"
+#include "kdtree_file.h"
+#include "triangle_mesh.h"
+#include <cinttypes>
+#include <cstdio>
+
+namespace {
+std::string GetCacheFileName(const std::string& cacheDirectory,
+                             uint64_t meshHash, uint64_t buildParamsHash)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "%016" PRIx64 "-%016" PRIx64 ".kdtree.cache",
+           meshHash, buildParamsHash);
+  return JoinPath(cacheDirectory, name);
+}
+} // namespace
+
+std::unique_ptr<KdTree>
+LoadOrBuildKdTree(const std::string& cacheDirectory, const TriangleMesh& mesh,
+                  const KdTreeBuilder::BuildParams& buildParams,
+                  KdTreeCacheStats* stats)
+{
+  KdTreeCacheStats localStats;
+  if (stats == nullptr)
+    stats = &localStats;
+  *stats = KdTreeCacheStats();
+
+  const uint64_t buildParamsHash = buildParams.GetHash();
+  const std::string fileName =
+      GetCacheFileName(cacheDirectory, mesh.GetHash(), buildParamsHash);
+
+  // a damaged cached tree can't crash the traversal: node links and triangle
+  // references are range checked and such a tree is rebuilt and rewritten
+  Timer loadTimer;
+  auto kdTree = LoadKdTreeFile(fileName, mesh, buildParamsHash, true);
+  stats->loadTimeMsec = loadTimer.ElapsedMilliseconds();
+  if (kdTree) {
+    stats->cacheHit = true;
+    return kdTree;
+  }
+
+  Timer buildTimer;
+  auto builder = KdTreeBuilder(mesh, buildParams);
+  kdTree.reset(new KdTree(builder.BuildTree()));
+  stats->buildTimeMsec = buildTimer.ElapsedMilliseconds();
+
+  // the tree is still usable if the cache directory is not writable
+  Timer saveTimer;
+  SaveKdTreeFile(fileName, *kdTree, buildParamsHash);
+  stats->saveTimeMsec = saveTimer.ElapsedMilliseconds();
+  return kdTree;
+}
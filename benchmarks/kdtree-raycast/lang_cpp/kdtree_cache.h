@@ -0,0 +1,27 @@
+#pragma once
+
+#include "kdtree_builder.h"
+#include <memory>
+#include <string>
+
+class KdTree;
+class TriangleMesh;
+
+struct KdTreeCacheStats {
+  bool cacheHit = false;
+  int loadTimeMsec = 0;  // mapping and verification or failed lookup
+  int buildTimeMsec = 0; // only on cache miss
+  int saveTimeMsec = 0;  // only on cache miss
+};
+
+// Returns the tree from the cache directory, on cache miss the tree is built
+// and stored in the cache. Cached trees are kdtree files (see kdtree_file.h)
+// named after the mesh hash and the build parameters hash, so the cache can
+// be shared between different files with the same mesh and a stale tree is
+// never used. The content of the cached tree is verified on load, a damaged
+// cache entry counts as a miss and is overwritten. The mesh must outlive the
+// returned tree.
+std::unique_ptr<KdTree>
+LoadOrBuildKdTree(const std::string& cacheDirectory, const TriangleMesh& mesh,
+                  const KdTreeBuilder::BuildParams& buildParams,
+                  KdTreeCacheStats* stats = nullptr);
@@ -0,0 +1,451 @@
+#include "common.h"
+#include "file_format.h"
+#include "kdtree.h"
+#include "kdtree_codec.h"
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+enum : uint32_t { kdTreeCodecVersion = 1 };
+enum : uint32_t { nodesPerBlock = 1 << 16, indicesPerBlock = 1 << 16 };
+
+const char kdTreeCodecMagic[8] = {'L', 'A', 'K', 'D', 'T', 'R', 'E', 'Z'};
+
+struct CodecFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrderMark;
+  uint64_t meshHash; // TriangleMesh::GetHash()
+  uint64_t buildParamsHash;
+  uint64_t nodesCount;
+  uint64_t triangleIndicesCount;
+  uint64_t nodeBlocksCount;
+  uint64_t indexBlocksCount;
+  uint64_t checksum; // whole file with zero checksum
+};
+
+// Block data: 2 bit node types, 4 byte split positions of interior nodes,
+// varints of interior and leaf nodes in node order. Leaf references are
+// predicted from the previous leaf, the prediction state at the beginning
+// of the block is stored in the block header.
+struct NodeBlock {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t nodesCount;
+  uint32_t interiorNodesCount;
+  uint32_t nextTriangleIndicesOffset;
+  uint32_t previousTriangle;
+  uint32_t padding;
+};
+
+// Block data: varints of zigzag encoded deltas between triangle indices.
+struct IndexBlock {
+  uint64_t offset;
+  uint32_t size;
+  uint32_t indicesCount;
+};
+
+static_assert(sizeof(CodecFileHeader) == 72, "unexpected header layout");
+static_assert(sizeof(NodeBlock) == 32, "unexpected block layout");
+static_assert(sizeof(IndexBlock) == 16, "unexpected block layout");
+
+void WriteVarint(std::vector<uint8_t>& stream, uint32_t value)
+{
+  while (value >= 0x80) {
+    stream.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  stream.push_back(static_cast<uint8_t>(value));
+}
+
+// Differences are computed modulo 2^32, so any value round-trips.
+uint32_t ZigzagDelta(uint32_t value, uint32_t predicted)
+{
+  uint32_t delta = value - predicted;
+  return (delta << 1) ^ (0u - (delta >> 31));
+}
+
+uint32_t UndoZigzagDelta(uint32_t code, uint32_t predicted)
+{
+  return predicted + ((code >> 1) ^ (0u - (code & 1)));
+}
+
+class ByteReader {
+public:
+  ByteReader(const uint8_t* begin, const uint8_t* end)
+  : position(begin)
+  , end(end)
+  {
+  }
+
+  bool ReadVarint(uint32_t& value)
+  {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (position == end)
+        return false;
+      uint8_t byte = *position++;
+      value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  bool IsFinished() const
+  {
+    return position == end;
+  }
+
+private:
+  const uint8_t* position;
+  const uint8_t* end;
+};
+
+// Predicted leaf references: multi-triangle leaves are stored in the order
+// of their triangle indices, single triangle leaves are close to the
+// previous one.
+struct LeafPrediction {
+  uint32_t nextTriangleIndicesOffset = 0;
+  uint32_t previousTriangle = 0;
+
+  uint32_t GetPredictedIndex(uint32_t trianglesCount) const
+  {
+    if (trianglesCount == 0)
+      return 0;
+    return trianglesCount == 1 ? previousTriangle : nextTriangleIndicesOffset;
+  }
+
+  void Update(uint32_t trianglesCount, uint32_t index)
+  {
+    if (trianglesCount == 1)
+      previousTriangle = index;
+    else if (trianglesCount > 1)
+      nextTriangleIndicesOffset = index + trianglesCount;
+  }
+};
+
+// Ranges of the decoded references, a decoded tree never points outside of
+// its arrays or the mesh, as checked by LoadKdTreeFile with verifyContent.
+struct ReferenceLimits {
+  uint64_t nodesCount;
+  uint64_t triangleIndicesCount;
+  uint32_t trianglesCount;
+};
+
+// Node is a private type of KdTree, the template gets it from the callers.
+template <typename Node>
+void EncodeNodeBlock(const Node* nodes, uint32_t nodesCount,
+                     uint32_t firstNode, LeafPrediction& prediction,
+                     NodeBlock& block, std::vector<uint8_t>& data)
+{
+  std::vector<uint8_t> types((nodesCount + 3) / 4);
+  std::vector<uint8_t> splits;
+  std::vector<uint8_t> varints;
+
+  block.nodesCount = nodesCount;
+  block.interiorNodesCount = 0;
+  block.nextTriangleIndicesOffset = prediction.nextTriangleIndicesOffset;
+  block.previousTriangle = prediction.previousTriangle;
+  block.padding = 0;
+
+  for (uint32_t i = 0; i < nodesCount; i++) {
+    const Node& node = nodes[i];
+    types[i / 4] |= static_cast<uint8_t>((node.word0 & 3) << (i % 4 * 2));
+
+    if (node.IsInteriorNode()) {
+      const uint8_t* split = reinterpret_cast<const uint8_t*>(&node.word1);
+      splits.insert(splits.end(), split, split + 4);
+      WriteVarint(varints, (node.word0 >> 2) - (firstNode + i));
+      block.interiorNodesCount++;
+    }
+    else {
+      // empty leaves have zero index unless created by other means
+      uint32_t trianglesCount = node.word0 >> 2;
+      uint32_t predicted = prediction.GetPredictedIndex(trianglesCount);
+      bool hasIndex = node.word1 != predicted;
+      WriteVarint(varints, (trianglesCount << 1) | (hasIndex ? 1 : 0));
+      if (hasIndex)
+        WriteVarint(varints, ZigzagDelta(node.word1, predicted));
+      prediction.Update(trianglesCount, node.word1);
+    }
+  }
+
+  block.offset = data.size();
+  data.insert(data.end(), types.begin(), types.end());
+  data.insert(data.end(), splits.begin(), splits.end());
+  data.insert(data.end(), varints.begin(), varints.end());
+  block.size = static_cast<uint32_t>(data.size() - block.offset);
+}
+
+template <typename Node>
+bool DecodeNodeBlock(const uint8_t* data, const NodeBlock& block,
+                     uint32_t firstNode, const ReferenceLimits& limits,
+                     Node* nodes)
+{
+  const uint32_t typesSize = (block.nodesCount + 3) / 4;
+  const uint64_t splitsSize = uint64_t(block.interiorNodesCount) * 4;
+  if (typesSize + splitsSize > block.size)
+    return false;
+
+  const uint8_t* types = data;
+  const uint8_t* splits = data + typesSize;
+  ByteReader reader(splits + splitsSize, data + block.size);
+
+  LeafPrediction prediction;
+  prediction.nextTriangleIndicesOffset = block.nextTriangleIndicesOffset;
+  prediction.previousTriangle = block.previousTriangle;
+
+  uint32_t interiorNodesCount = 0;
+  for (uint32_t i = 0; i < block.nodesCount; i++) {
+    Node& node = nodes[i];
+    uint32_t type = (types[i / 4] >> (i % 4 * 2)) & 3;
+    uint32_t code;
+    if (!reader.ReadVarint(code))
+      return false;
+
+    if (type != Node::leafNodeFlags) {
+      // above child follows the node
+      if (interiorNodesCount == block.interiorNodesCount || code == 0 ||
+          uint64_t(firstNode) + i + code >= limits.nodesCount)
+        return false;
+      node.word0 = type | ((firstNode + i + code) << 2);
+      memcpy(&node.word1, splits + interiorNodesCount * 4, 4);
+      interiorNodesCount++;
+    }
+    else {
+      uint32_t trianglesCount = code >> 1;
+      uint32_t index = prediction.GetPredictedIndex(trianglesCount);
+      if (code & 1) {
+        uint32_t delta;
+        if (!reader.ReadVarint(delta))
+          return false;
+        index = UndoZigzagDelta(delta, index);
+      }
+      node.word0 = Node::leafNodeFlags | (trianglesCount << 2);
+      node.word1 = index;
+      prediction.Update(trianglesCount, index);
+
+      if (node.GetTrianglesCount() == 1) {
+        if (index >= limits.trianglesCount)
+          return false;
+      }
+      else if (node.GetTrianglesCount() > 1) {
+        if (uint64_t(index) + node.GetTrianglesCount() >
+            limits.triangleIndicesCount)
+          return false;
+      }
+    }
+  }
+  return interiorNodesCount == block.interiorNodesCount && reader.IsFinished();
+}
+
+void EncodeIndexBlock(const int32_t* indices, uint32_t indicesCount,
+                      IndexBlock& block, std::vector<uint8_t>& data)
+{
+  block.offset = data.size();
+  block.indicesCount = indicesCount;
+
+  uint32_t previous = 0;
+  for (uint32_t i = 0; i < indicesCount; i++) {
+    uint32_t index = static_cast<uint32_t>(indices[i]);
+    WriteVarint(data, ZigzagDelta(index, previous));
+    previous = index;
+  }
+  block.size = static_cast<uint32_t>(data.size() - block.offset);
+}
+
+bool DecodeIndexBlock(const uint8_t* data, const IndexBlock& block,
+                      const ReferenceLimits& limits, int32_t* indices)
+{
+  ByteReader reader(data, data + block.size);
+  uint32_t previous = 0;
+  for (uint32_t i = 0; i < block.indicesCount; i++) {
+    uint32_t delta;
+    if (!reader.ReadVarint(delta))
+      return false;
+    previous = UndoZigzagDelta(delta, previous);
+    if (previous >= limits.trianglesCount)
+      return false;
+    indices[i] = static_cast<int32_t>(previous);
+  }
+  return reader.IsFinished();
+}
+
+uint64_t GetBlocksCount(uint64_t elementsCount, uint32_t blockSize)
+{
+  return (elementsCount + blockSize - 1) / blockSize;
+}
+
+uint64_t GetChecksum(CodecFileHeader header, const uint8_t* fileData,
+                     size_t fileSize)
+{
+  header.checksum = 0;
+  uint64_t hash = HashBytes(&header, sizeof(header));
+  return HashBytes(fileData + sizeof(header), fileSize - sizeof(header), hash);
+}
+} // namespace
+
+bool SaveCompressedKdTreeFile(const std::string& fileName,
+                              const KdTree& kdTree, uint64_t buildParamsHash)
+{
+  CodecFileHeader header;
+  InitFileHeader(header, kdTreeCodecMagic, kdTreeCodecVersion);
+  header.meshHash = kdTree.mesh.GetHash();
+  header.buildParamsHash = buildParamsHash;
+  header.nodesCount = kdTree.nodes.size();
+  header.triangleIndicesCount = kdTree.triangleIndices.size();
+  header.nodeBlocksCount = GetBlocksCount(header.nodesCount, nodesPerBlock);
+  header.indexBlocksCount =
+      GetBlocksCount(header.triangleIndicesCount, indicesPerBlock);
+
+  std::vector<NodeBlock> nodeBlocks(header.nodeBlocksCount);
+  std::vector<IndexBlock> indexBlocks(header.indexBlocksCount);
+  std::vector<uint8_t> data;
+
+  LeafPrediction prediction;
+  for (uint64_t i = 0; i < header.nodeBlocksCount; i++) {
+    uint32_t firstNode = static_cast<uint32_t>(i * nodesPerBlock);
+    uint32_t nodesCount = static_cast<uint32_t>(
+        std::min<uint64_t>(nodesPerBlock, header.nodesCount - firstNode));
+    EncodeNodeBlock(kdTree.nodes.data() + firstNode, nodesCount, firstNode,
+                    prediction, nodeBlocks[i], data);
+  }
+  for (uint64_t i = 0; i < header.indexBlocksCount; i++) {
+    uint64_t firstIndex = i * indicesPerBlock;
+    uint32_t indicesCount = static_cast<uint32_t>(std::min<uint64_t>(
+        indicesPerBlock, header.triangleIndicesCount - firstIndex));
+    EncodeIndexBlock(kdTree.triangleIndices.data() + firstIndex, indicesCount,
+                     indexBlocks[i], data);
+  }
+
+  // block offsets are relative to the end of the block tables
+  std::vector<uint8_t> file(sizeof(header));
+  auto append = [&file](const void* bytes, size_t size) {
+    const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+    file.insert(file.end(), begin, begin + size);
+  };
+  append(nodeBlocks.data(), nodeBlocks.size() * sizeof(NodeBlock));
+  append(indexBlocks.data(), indexBlocks.size() * sizeof(IndexBlock));
+  append(data.data(), data.size());
+
+  memcpy(file.data(), &header, sizeof(header));
+  header.checksum = GetChecksum(header, file.data(), file.size());
+  memcpy(file.data(), &header, sizeof(header));
+
+  return WriteFileAtomically(fileName, [&file](std::ofstream& stream) {
+    stream.write(reinterpret_cast<const char*>(file.data()), file.size());
+  });
+}
+
+std::unique_ptr<KdTree> LoadCompressedKdTreeFile(const std::string& fileName,
+                                                 const TriangleMesh& mesh,
+                                                 uint64_t buildParamsHash,
+                                                 bool verifyChecksum,
+                                                 int threadsCount)
+{
+  MappedFile file;
+  CodecFileHeader header;
+  if (!file.Open(fileName, MappedFile::Access::Sequential) ||
+      !ReadFileHeader(file, header))
+    return nullptr;
+
+  if (!CheckFileHeader(header, kdTreeCodecMagic, kdTreeCodecVersion) ||
+      header.buildParamsHash != buildParamsHash ||
+      header.meshHash != mesh.GetHash())
+    return nullptr;
+
+  // block tables and block bounds are checked without overflow for any
+  // header values
+  const uint64_t fileSize = file.GetSize();
+  if (header.nodesCount == 0 ||
+      header.nodesCount > uint64_t(KdTree::Node::maxNodesCount) ||
+      header.triangleIndicesCount > uint64_t(INT32_MAX) ||
+      header.nodeBlocksCount !=
+          GetBlocksCount(header.nodesCount, nodesPerBlock) ||
+      header.indexBlocksCount !=
+          GetBlocksCount(header.triangleIndicesCount, indicesPerBlock))
+    return nullptr;
+
+  const uint64_t tablesSize = header.nodeBlocksCount * sizeof(NodeBlock) +
+                              header.indexBlocksCount * sizeof(IndexBlock);
+  if (sizeof(header) + tablesSize > fileSize)
+    return nullptr;
+
+  if (verifyChecksum &&
+      GetChecksum(header, file.GetData(), fileSize) != header.checksum)
+    return nullptr;
+
+  std::vector<NodeBlock> nodeBlocks(header.nodeBlocksCount);
+  std::vector<IndexBlock> indexBlocks(header.indexBlocksCount);
+  const uint8_t* tables = file.GetData() + sizeof(header);
+  memcpy(nodeBlocks.data(), tables, nodeBlocks.size() * sizeof(NodeBlock));
+  memcpy(indexBlocks.data(), tables + nodeBlocks.size() * sizeof(NodeBlock),
+         indexBlocks.size() * sizeof(IndexBlock));
+
+  const uint8_t* data = tables + tablesSize;
+  const uint64_t dataSize = fileSize - sizeof(header) - tablesSize;
+
+  LargeVector<KdTree::Node> nodes(header.nodesCount);
+  LargeVector<int32_t> triangleIndices(header.triangleIndicesCount);
+
+  ReferenceLimits limits;
+  limits.nodesCount = header.nodesCount;
+  limits.triangleIndicesCount = header.triangleIndicesCount;
+  limits.trianglesCount = static_cast<uint32_t>(mesh.GetTrianglesCount());
+
+  // node blocks go first, they are the larger ones
+  const uint64_t blocksCount = nodeBlocks.size() + indexBlocks.size();
+  std::atomic<uint64_t> nextBlock(0);
+  std::atomic<bool> failed(false);
+
+  auto decodeBlocks = [&]() {
+    for (uint64_t i = nextBlock++; i < blocksCount && !failed;
+         i = nextBlock++) {
+      bool decoded;
+      if (i < nodeBlocks.size()) {
+        const NodeBlock& block = nodeBlocks[i];
+        uint32_t firstNode = static_cast<uint32_t>(i * nodesPerBlock);
+        decoded =
+            block.offset <= dataSize && block.size <= dataSize - block.offset &&
+            block.nodesCount ==
+                std::min<uint64_t>(nodesPerBlock,
+                                   header.nodesCount - firstNode) &&
+            DecodeNodeBlock(data + block.offset, block, firstNode, limits,
+                            nodes.data() + firstNode);
+      }
+      else {
+        uint64_t blockIndex = i - nodeBlocks.size();
+        const IndexBlock& block = indexBlocks[blockIndex];
+        uint64_t firstIndex = blockIndex * indicesPerBlock;
+        decoded =
+            block.offset <= dataSize && block.size <= dataSize - block.offset &&
+            block.indicesCount ==
+                std::min<uint64_t>(indicesPerBlock,
+                                   header.triangleIndicesCount - firstIndex) &&
+            DecodeIndexBlock(data + block.offset, block, limits,
+                             triangleIndices.data() + firstIndex);
+      }
+      if (!decoded)
+        failed = true;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < threadsCount; i++)
+    threads.push_back(std::thread(decodeBlocks));
+  decodeBlocks();
+  for (auto& thread : threads)
+    thread.join();
+
+  if (failed)
+    return nullptr;
+
+  return std::unique_ptr<KdTree>(
+      new KdTree(std::move(nodes), std::move(triangleIndices), mesh));
+}
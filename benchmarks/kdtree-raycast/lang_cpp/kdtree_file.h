@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class KdTree;
+class TriangleMesh;
+
+// Versioned kdtree file. The header stores magic, version, byte order mark,
+// hash of the mesh, hash of the build parameters, mesh bounds and a checksum;
+// node and triangle index arrays follow at 64 byte aligned offsets. The tree
+// loaded from the file uses the arrays directly from the read-only file
+// mapping, so the load time does not depend on the tree size.
+//
+// This format is for caching trees on the local machine, the .kdtree files in
+// the data directories keep the raw format shared with other languages.
+bool SaveKdTreeFile(const std::string& fileName, const KdTree& kdTree,
+                    uint64_t buildParamsHash);
+
+// Returns nullptr if the file is missing, has a different version or byte
+// order, or was built for a different mesh or different build parameters.
+// verifyContent additionally checks the checksum and that node and triangle
+// references are in range, this reads the whole file.
+std::unique_ptr<KdTree> LoadKdTreeFile(const std::string& fileName,
+                                       const TriangleMesh& mesh,
+                                       uint64_t buildParamsHash,
+                                       bool verifyContent);
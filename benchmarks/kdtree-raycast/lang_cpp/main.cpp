@@ -1,11 +1,25 @@
 #include "benchmark.h"
+#include "bvh.h"
+#include "bvh_builder.h"
 #include "common.h"
+#include "compressed_kdtree.h"
+#include "compressed_mesh.h"
 #include "kdtree.h"
+#include "kdtree_builder.h"
+#include "kdtree_cache.h"
+#include "large_array.h"
+#include "mesh_generator.h"
+#include "mesh_reorder.h"
+#include "perf_counter.h"
 #include "random.h"
+#include "rope_kdtree.h"
+#include "scene_bundle.h"
 #include "triangle_mesh.h"
 #include "triangle_mesh_loader.h"
 #include "vector.h"
+#include <limits>
 #include <string>
+#include <thread>
 #include <vector>
 
 int main(int argc, char* argv[])
@@ -21,24 +35,99 @@ int main(int argc, char* argv[])
                                           JoinPath(argv[1], "bunny.kdtree"),
                                           JoinPath(argv[1], "dragon.kdtree")};
 
+  // the dragon model is not distributed with the sources, the generated mesh
+  // of the same size is used instead (the same file kdtree-construction
+  // generates with --generate-data)
+  if (!FileExists(modelFiles[2])) {
+    MeshGeneratorParams params;
+    params.trianglesCount = 871414;
+    int64_t trianglesCount = GenerateMeshStl(modelFiles[2], params);
+    printf("generated %s: %lld triangles\n", modelFiles[2].c_str(),
+           static_cast<long long>(trianglesCount));
+  }
+
+  MeshLoadOptions loadOptions;
+  loadOptions.useFileMapping = !HasCommandLineOption(argc, argv, "--no-mmap");
+  loadOptions.pipelined = HasCommandLineOption(argc, argv, "--pipelined-load");
+  loadOptions.loadNormals = HasCommandLineOption(argc, argv, "--load-normals");
+  if (HasCommandLineOption(argc, argv, "--mesh-cache"))
+    loadOptions.cacheDirectory = GetDirectoryPath(argv[0]);
+
+  // only teapot.kdtree is distributed with the sources, missing trees are
+  // built on the first run and then loaded from the cache
+  const bool useKdTreeCache =
+      HasCommandLineOption(argc, argv, "--kdtree-cache");
+  const auto kdtreeCacheDirectory = GetDirectoryPath(argv[0]);
+
   std::vector<std::unique_ptr<TriangleMesh>> meshes;
   std::vector<std::unique_ptr<KdTree>> kdTrees;
+  int loadTimesMsec[modelsCount];
+  MeshLoadStats loadStats[modelsCount];
+  bool kdtreeCacheUsed[modelsCount];
+  KdTreeCacheStats kdtreeCacheStats[modelsCount];
 
   for (int i = 0; i < modelsCount; i++) {
-    meshes.push_back(LoadTriangleMesh(modelFiles[i]));
-    kdTrees.push_back(
-        std::unique_ptr<KdTree>(new KdTree(kdtreeFiles[i], *meshes.back())));
+    Timer loadTimer;
+    meshes.push_back(
+        LoadTriangleMesh(modelFiles[i], loadOptions, &loadStats[i]));
+    loadTimesMsec[i] = loadTimer.ElapsedMilliseconds();
+
+    kdtreeCacheUsed[i] = useKdTreeCache || !FileExists(kdtreeFiles[i]);
+    if (kdtreeCacheUsed[i]) {
+      kdTrees.push_back(LoadOrBuildKdTree(
+          kdtreeCacheDirectory, *meshes.back(), KdTreeBuilder::BuildParams(),
+          &kdtreeCacheStats[i]));
+    } else {
+      kdTrees.push_back(
+          std::unique_ptr<KdTree>(new KdTree(kdtreeFiles[i], *meshes.back())));
+    }
+  }
+
+  // peak memory is queried before the benchmark allocates anything else
+  if (HasCommandLineOption(argc, argv, "--load-stats")) {
+    for (int i = 0; i < modelsCount; i++) {
+      double seconds = std::max(loadTimesMsec[i], 1) / 1000.0;
+      printf("mesh load [%-6s, %s, %s]: %d ms, %.1f MB/sec\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             loadStats[i].format.c_str(),
+             loadStats[i].pipelined
+                 ? "pipelined"
+                 : (loadStats[i].fileMapped ? "mmap" : "read"),
+             loadTimesMsec[i],
+             (loadStats[i].fileSize / (1024.0 * 1024.0)) / seconds);
+    }
+    for (int i = 0; i < modelsCount; i++) {
+      if (!kdtreeCacheUsed[i])
+        continue;
+      const KdTreeCacheStats& stats = kdtreeCacheStats[i];
+      printf("kdtree cache [%-6s]: ",
+             StripExtension(GetFileName(modelFiles[i])).c_str());
+      if (stats.cacheHit)
+        printf("hit, load %d ms\n", stats.loadTimeMsec);
+      else
+        printf("miss, build %d ms, save %d ms\n", stats.buildTimeMsec,
+               stats.saveTimeMsec);
+    }
+    printf("peak resident set size after loading: %.2f MB\n",
+           GetPeakResidentSetSize() / (1024.0 * 1024.0));
   }
 
   // run benchmark
   int elapsedTime = 0;
+  int timesMsec[modelsCount];
   for (int i = 0; i < modelsCount; i++) {
+    KDTREE_STATS(KdTree::traversalStats.Reset());
+
     int timeMsec = BenchmarkKdTree(*kdTrees[i]);
     elapsedTime += timeMsec;
+    timesMsec[i] = timeMsec;
 
     double speed = (benchmarkRaysCount / 1000000.0) / (timeMsec / 1000.0);
     printf("raycast performance [%-6s]: %.2f MRays/sec\n",
            StripExtension(GetFileName(modelFiles[i])).c_str(), speed);
+
+    KDTREE_STATS(PrintTraversalStats(
+        KdTree::traversalStats, StripExtension(GetFileName(modelFiles[i]))));
   }
 
   // communicate time to master
@@ -48,9 +137,457 @@ int main(int argc, char* argv[])
   // validation
   AssertEquals(RandUint32(), 3404003823u, "error in random generator");
 
-  int raysCount[modelsCount] = {32768, 64, 32};
+  int raysCount[modelsCount] = {32768, 16384, 10240};
   for (int i = 0; i < modelsCount; i++) {
     ValidateKdTree(*kdTrees[i], raysCount[i]);
   }
+
+  // optional measurements, they are not part of the benchmark timing
+  if (HasCommandLineOption(argc, argv, "--multi-hit")) {
+    const KdTree& kdTree = *kdTrees[1]; // bunny
+    ValidateKdTreeMultiHit(kdTree, 64);
+
+    const int32_t trianglesCount = kdTree.GetMesh().GetTrianglesCount();
+    int32_t maxHitsValues[] = {1, 4, 16, trianglesCount};
+
+    for (int32_t maxHits : maxHitsValues) {
+      int timeMsec;
+      int64_t hitsCount = BenchmarkKdTreeMultiHit(kdTree, maxHits, timeMsec);
+      double seconds = std::max(timeMsec, 1) / 1000.0;
+
+      std::string mode = (maxHits == trianglesCount)
+                             ? "all hits"
+                             : "max " + std::to_string(maxHits) + " hits";
+
+      printf("multi-hit performance [bunny, %-11s]: %.2f MHits/sec, "
+             "%.2f MRays/sec\n",
+             mode.c_str(), (hitsCount / 1000000.0) / seconds,
+             (multiHitBenchmarkRaysCount / 1000000.0) / seconds);
+    }
+  }
+
+  if (HasCommandLineOption(argc, argv, "--ropes")) {
+    for (int i = 0; i < modelsCount; i++) {
+      Timer timer;
+      RopeKdTree ropeKdTree(*kdTrees[i]);
+      int buildTimeMsec = timer.ElapsedMilliseconds();
+
+      ValidateKdTree(ropeKdTree, raysCount[i]);
+
+      int ropeTimeMsec = BenchmarkKdTree(ropeKdTree);
+      int coherentTimeMsec =
+          BenchmarkKdTreeCoherentSingleRays(*kdTrees[i]);
+      int ropeCoherentTimeMsec =
+          BenchmarkKdTreeCoherentSingleRays(ropeKdTree);
+
+      auto speed = [](int raysCount, int timeMsec) {
+        return (raysCount / 1000000.0) / (std::max(timeMsec, 1) / 1000.0);
+      };
+
+      printf("rope traversal [%-6s]: ropes built in %d ms\n"
+             "  random rays         : stack %.2f MRays/sec, ropes %.2f "
+             "MRays/sec\n"
+             "  coherent single rays: stack %.2f MRays/sec, ropes %.2f "
+             "MRays/sec\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             buildTimeMsec, speed(benchmarkRaysCount, timesMsec[i]),
+             speed(benchmarkRaysCount, ropeTimeMsec),
+             speed(coherentBenchmarkRaysCount, coherentTimeMsec),
+             speed(coherentBenchmarkRaysCount, ropeCoherentTimeMsec));
+    }
+  }
+
+  if (HasCommandLineOption(argc, argv, "--bvh")) {
+    for (int i = 0; i < modelsCount; i++) {
+      Timer timer;
+      auto builder = BvhBuilder(*meshes[i], BvhBuilder::BuildParams());
+      Bvh bvh = builder.BuildBvh();
+      int buildTimeMsec = timer.ElapsedMilliseconds();
+
+      ValidateKdTree(bvh, raysCount[i]);
+      int bvhTimeMsec = BenchmarkKdTree(bvh);
+
+      auto speed = [](int timeMsec) {
+        return (benchmarkRaysCount / 1000000.0) /
+               (std::max(timeMsec, 1) / 1000.0);
+      };
+
+      printf("bvh [%-6s]: built in %d ms, %.2f MB (kdtree %.2f MB), "
+             "%.2f MRays/sec (kdtree %.2f MRays/sec)\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             buildTimeMsec, bvh.GetMemoryUsage() / (1024.0 * 1024.0),
+             kdTrees[i]->GetMemoryUsage() / (1024.0 * 1024.0),
+             speed(bvhTimeMsec), speed(timesMsec[i]));
+    }
+  }
+
+  // the dependent chain of the main benchmark compared with the traversal of
+  // independent pre-generated rays; the stream generator uses other random
+  // numbers and sampling than the chain, so its time is reported separately
+  if (HasCommandLineOption(argc, argv, "--ray-stream")) {
+    auto speed = [](int timeMsec) {
+      return (benchmarkRaysCount / 1000000.0) /
+             (std::max(timeMsec, 1) / 1000.0);
+    };
+    for (int i = 0; i < modelsCount; i++) {
+      int generationTimeMsec;
+      int64_t hitsCount;
+      int traversalTimeMsec =
+          BenchmarkKdTreeRayStream(*kdTrees[i], benchmarkRaysCount,
+                                   generationTimeMsec, hitsCount);
+      printf("ray stream [%-6s]: traversal %.2f MRays/sec, %.1f%% hits, "
+             "dependent chain %.2f MRays/sec, stream generator's own cost "
+             "%.2f MRays/sec\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             speed(traversalTimeMsec), 100.0 * hitsCount / benchmarkRaysCount,
+             speed(timesMsec[i]), speed(generationTimeMsec));
+    }
+  }
+
+  if (HasCommandLineOption(argc, argv, "--interleaved")) {
+    for (int i = 0; i < modelsCount; i++) {
+      auto rays =
+          GenerateBenchmarkRays(*kdTrees[i], rayBufferBenchmarkRaysCount);
+
+      std::vector<KdTree::Intersection> expectedIntersections;
+      int scalarTimeMsec =
+          BenchmarkKdTreeRayBuffer(*kdTrees[i], rays, expectedIntersections);
+
+      auto speed = [](int timeMsec) {
+        return (rayBufferBenchmarkRaysCount / 1000000.0) /
+               (std::max(timeMsec, 1) / 1000.0);
+      };
+
+      printf("interleaved traversal [%-6s]: scalar %.2f MRays/sec",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             speed(scalarTimeMsec));
+
+      int groupSizes[] = {1, 4, 8, 16};
+      for (int groupSize : groupSizes) {
+        std::vector<KdTree::Intersection> intersections;
+        int timeMsec = BenchmarkKdTreeInterleaved(*kdTrees[i], rays, groupSize,
+                                                  intersections);
+        ValidateIntersections(intersections, expectedIntersections);
+        printf(", group %d: %.2f", groupSize, speed(timeMsec));
+      }
+      printf("\n");
+    }
+  }
+
+  if (HasCommandLineOption(argc, argv, "--large-pages")) {
+    using Pages = LargeArrayPolicy::Pages;
+    using Numa = LargeArrayPolicy::Numa;
+
+    struct Configuration {
+      const char* name;
+      Pages pages;
+      Numa numa;
+      bool replicate;
+    };
+    Configuration configurations[] = {
+        {"4 KB pages", Pages::Default, Numa::Default, false},
+        {"transparent huge pages", Pages::Transparent, Numa::Default, false},
+        {"explicit huge pages", Pages::Explicit, Numa::Default, false},
+        {"huge pages, interleaved", Pages::Transparent, Numa::Interleave,
+         false},
+        {"huge pages, per node replicas", Pages::Transparent, Numa::Bind,
+         true}};
+
+    const int threadsCount =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int numaNodesCount = GetNumaNodesCount();
+    printf("large pages test: %d threads, %d NUMA nodes\n", threadsCount,
+           numaNodesCount);
+
+    for (int i = 0; i < modelsCount; i++) {
+      auto rays =
+          GenerateBenchmarkRays(*kdTrees[i], rayBufferBenchmarkRaysCount);
+
+      for (const auto& configuration : configurations) {
+        ResetLargeArrayStats();
+
+        // copy mesh and tree data to memory allocated with tested policy
+        std::vector<std::unique_ptr<TriangleMesh>> meshReplicas;
+        std::vector<std::unique_ptr<KdTree>> kdTreeReplicas;
+        std::vector<const KdTree*> kdTreePointers;
+
+        int replicasCount = configuration.replicate ? numaNodesCount : 1;
+        for (int node = 0; node < replicasCount; node++) {
+          LargeArrayPolicy policy;
+          policy.pages = configuration.pages;
+          policy.numa = configuration.numa;
+          policy.numaNode = node;
+          ScopedLargeArrayPolicy scopedPolicy(policy);
+
+          meshReplicas.push_back(
+              std::unique_ptr<TriangleMesh>(new TriangleMesh(*meshes[i])));
+          kdTreeReplicas.push_back(std::unique_ptr<KdTree>(
+              new KdTree(*kdTrees[i], *meshReplicas.back())));
+          kdTreePointers.push_back(kdTreeReplicas.back().get());
+        }
+
+        PerfCounter tlbMissCounter(PerfCounter::Event::DataTlbMisses);
+        tlbMissCounter.Start();
+        int timeMsec = BenchmarkKdTreeThreads(kdTreePointers, rays,
+                                              threadsCount);
+        int64_t tlbMisses = tlbMissCounter.Stop();
+
+        const auto& stats = GetLargeArrayStats();
+        double speed = (rayBufferBenchmarkRaysCount / 1000000.0) /
+                       (std::max(timeMsec, 1) / 1000.0);
+
+        printf("[%-6s] %-30s: %.2f MRays/sec, ",
+               StripExtension(GetFileName(modelFiles[i])).c_str(),
+               configuration.name, speed);
+        if (tlbMisses >= 0)
+          printf("%.3f dTLB misses/ray", double(tlbMisses) / rays.size());
+        else
+          printf("dTLB misses n/a");
+        printf(" (large arrays %.1f MB: explicit %.1f, transparent %.1f, "
+               "numa placed %.1f)\n",
+               stats.allocatedBytes / (1024.0 * 1024.0),
+               stats.explicitHugePagesBytes / (1024.0 * 1024.0),
+               stats.transparentHugePagesBytes / (1024.0 * 1024.0),
+               stats.numaPlacedBytes / (1024.0 * 1024.0));
+      }
+    }
+  }
+
+  if (HasCommandLineOption(argc, argv, "--reorder")) {
+    for (int i = 0; i < modelsCount; i++) {
+      Timer timer;
+      TriangleMesh reorderedMesh(*meshes[i]);
+      auto triangleRemap = ReorderMeshForLocality(reorderedMesh);
+      int reorderTimeMsec = timer.ElapsedMilliseconds();
+
+      // the same tree with remapped triangle indices, so both versions
+      // traverse the same nodes and only mesh memory layout is different
+      KdTree reorderedKdTree(*kdTrees[i], reorderedMesh, triangleRemap);
+      const KdTree* testedKdTrees[2] = {kdTrees[i].get(), &reorderedKdTree};
+      const char* names[2] = {"original", "reordered"};
+
+      auto rays =
+          GenerateBenchmarkRays(*kdTrees[i], rayBufferBenchmarkRaysCount);
+      std::vector<KdTree::Intersection> intersections[2];
+
+      printf("mesh reordering [%-6s]: %d ms\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             reorderTimeMsec);
+
+      for (int k = 0; k < 2; k++) {
+        KDTREE_STATS(KdTree::traversalStats.Reset());
+
+        PerfCounter l1Misses(PerfCounter::Event::L1DataCacheMisses);
+        PerfCounter llcMisses(PerfCounter::Event::LastLevelCacheMisses);
+        l1Misses.Start();
+        llcMisses.Start();
+        int timeMsec =
+            BenchmarkKdTreeRayBuffer(*testedKdTrees[k], rays, intersections[k]);
+        int64_t llcMissesCount = llcMisses.Stop();
+        int64_t l1MissesCount = l1Misses.Stop();
+
+        double speed =
+            (rays.size() / 1000000.0) / (std::max(timeMsec, 1) / 1000.0);
+        printf("  %-9s: %.2f MRays/sec", names[k], speed);
+        if (l1MissesCount >= 0 && llcMissesCount >= 0)
+          printf(", %.2f L1D misses/ray, %.3f LLC misses/ray\n",
+                 double(l1MissesCount) / rays.size(),
+                 double(llcMissesCount) / rays.size());
+        else
+          printf(", cache misses n/a\n");
+
+        KDTREE_STATS(printf("  %-9s: %.2f leaf cache lines/ray\n", names[k],
+                            KdTree::traversalStats.leafCacheLines /
+                                double(KdTree::traversalStats.raysCount)));
+      }
+      ValidateIntersections(intersections[1], intersections[0]);
+    }
+  }
+
+  // compressed tree traverses the tree built for the decoded mesh and is
+  // validated against brute force on the decoded mesh, the differences with
+  // the original mesh come from quantization only. The decoded mesh is only
+  // resident while the tree is built and validated, the peak resident set
+  // size includes it.
+  if (HasCommandLineOption(argc, argv, "--compressed-mesh")) {
+    using Precision = CompressedMesh::Precision;
+    for (int i = 0; i < modelsCount; i++) {
+      const TriangleMesh& mesh = *meshes[i];
+      const size_t meshSize =
+          mesh.vertices.size() * sizeof(Vector_f) +
+          mesh.triangles.size() * sizeof(TriangleMesh::Triangle);
+
+      auto rays =
+          GenerateBenchmarkRays(*kdTrees[i], rayBufferBenchmarkRaysCount);
+      std::vector<KdTree::Intersection> intersections;
+      int timeMsec = BenchmarkKdTreeRayBuffer(*kdTrees[i], rays, intersections);
+
+      auto speed = [&rays](int timeMsec) {
+        return (rays.size() / 1000000.0) / (std::max(timeMsec, 1) / 1000.0);
+      };
+      printf("compressed mesh [%-6s]: original %.2f MB, %.2f MRays/sec\n",
+             StripExtension(GetFileName(modelFiles[i])).c_str(),
+             meshSize / (1024.0 * 1024.0), speed(timeMsec));
+
+      for (Precision precision : {Precision::Bits16, Precision::Bits21}) {
+        Timer timer;
+        CompressedMesh compressedMesh(mesh, precision);
+        int compressTimeMsec = timer.ElapsedMilliseconds();
+
+        CompressedKdTree compressedKdTree(compressedMesh,
+                                          KdTreeBuilder::BuildParams());
+        ValidateKdTree(compressedKdTree, raysCount[i]);
+
+        std::vector<KdTree::Intersection> compressedIntersections;
+        int compressedTimeMsec = BenchmarkKdTreeRayBuffer(
+            compressedKdTree, rays, compressedIntersections);
+
+        int64_t hitMismatches = 0;
+        for (size_t k = 0; k < rays.size(); k++) {
+          const double infinity = std::numeric_limits<double>::infinity();
+          if ((intersections[k].t == infinity) !=
+              (compressedIntersections[k].t == infinity))
+            hitMismatches++;
+        }
+
+        printf("  %s bits: %.2f MB (%.1f%% wide index blocks), compressed "
+               "in %d ms, max error %.3g, %.2f MRays/sec, %.4f%% rays "
+               "changed hit/miss, peak resident set size %.2f MB\n",
+               (precision == Precision::Bits16) ? "16" : "21",
+               compressedMesh.GetMemoryUsage() / (1024.0 * 1024.0),
+               compressedMesh.GetWideBlocksFraction() * 100.0,
+               compressTimeMsec, compressedMesh.GetMaxError(),
+               speed(compressedTimeMsec),
+               hitMismatches * 100.0 / rays.size(),
+               GetPeakResidentSetSize() / (1024.0 * 1024.0));
+      }
+    }
+  }
+
+  // bundles are written next to the executable, the time to the first traced
+  // ray includes opening and mapping of the bundle file
+  if (HasCommandLineOption(argc, argv, "--scene-bundle")) {
+    for (int i = 0; i < modelsCount; i++) {
+      const auto name = StripExtension(GetFileName(modelFiles[i]));
+      auto rays =
+          GenerateBenchmarkRays(*kdTrees[i], rayBufferBenchmarkRaysCount);
+      std::vector<KdTree::Intersection> intersections;
+      int timeMsec = BenchmarkKdTreeRayBuffer(*kdTrees[i], rays, intersections);
+
+      auto speed = [&rays](int timeMsec) {
+        return (rays.size() / 1000000.0) / (std::max(timeMsec, 1) / 1000.0);
+      };
+      printf("scene bundle [%-6s]: kdtree %.2f MRays/sec\n", name.c_str(),
+             speed(timeMsec));
+
+      for (bool withTriangleRecords : {false, true}) {
+        const auto bundleFile = JoinPath(
+            GetDirectoryPath(argv[0]),
+            name + (withTriangleRecords ? ".records.bundle" : ".bundle"));
+        if (!SaveSceneBundle(bundleFile, *kdTrees[i], 0, withTriangleRecords))
+          RuntimeError("failed to write scene bundle: " + bundleFile);
+
+        Timer openTimer;
+        auto sceneBundle = LoadSceneBundle(bundleFile, false);
+        if (sceneBundle == nullptr)
+          RuntimeError("failed to open scene bundle: " + bundleFile);
+        KdTree::Intersection firstIntersection;
+        sceneBundle->Intersect(rays[0], firstIntersection);
+        double firstRayMsec = openTimer.ElapsedSeconds() * 1000.0;
+
+        Timer verifyTimer;
+        if (LoadSceneBundle(bundleFile, true) == nullptr)
+          RuntimeError("scene bundle verification failed: " + bundleFile);
+        int verifyTimeMsec = verifyTimer.ElapsedMilliseconds();
+
+        std::vector<KdTree::Intersection> bundleIntersections;
+        int bundleTimeMsec =
+            BenchmarkKdTreeRayBuffer(*sceneBundle, rays, bundleIntersections);
+        ValidateIntersections(bundleIntersections, intersections);
+
+        printf("  %s: %.2f MB, first ray after %.3f ms, verified open %d ms, "
+               "%.2f MRays/sec\n",
+               withTriangleRecords ? "with triangle records" : "mesh only",
+               sceneBundle->GetFileSize() / (1024.0 * 1024.0), firstRayMsec,
+               verifyTimeMsec, speed(bundleTimeMsec));
+      }
+    }
+  }
+
+  // the batch kernels are checked against the single vector functions, the
+  // results hash of IntersectTriangle can be compared between compilers
+  if (HasCommandLineOption(argc, argv, "--vector-kernels")) {
+#ifdef VECTOR_SSE2
+    const char* kernels = "sse2";
+#else
+    const char* kernels = "portable";
+#endif
+    uint64_t resultsHash;
+    double time = BenchmarkIntersectTriangle(*meshes[1], resultsHash);
+    printf("vector kernels: IntersectTriangle %.2f ns, results hash "
+           "0x%016llx\n",
+           time, static_cast<unsigned long long>(resultsHash));
+
+    auto batchTimes = BenchmarkBatchKernels(*meshes[1]);
+    if (!batchTimes.resultsMatch)
+      ValidationError("batch vector kernels results differ");
+    printf("vector kernels [%s]: DotProduct %.2f ns, DotProducts %.2f ns, "
+           "CrossProduct %.2f ns, CrossProducts %.2f ns per vector\n",
+           kernels, batchTimes.dotProductNsec, batchTimes.dotProductsNsec,
+           batchTimes.crossProductNsec, batchTimes.crossProductsNsec);
+  }
+
+  if (HasCommandLineOption(argc, argv, "--box-test")) {
+    auto times = BenchmarkBoxTest(*meshes[1]);
+    printf("box test: reference %.2f ns, single ray %.2f ns, packet %.2f ns "
+           "per ray, results %s\n",
+           times.referenceNsec, times.singleRayNsec, times.packetNsec,
+           times.resultsMatch ? "match" : "differ");
+  }
+
+  if (HasCommandLineOption(argc, argv, "--rng-test")) {
+    auto times = BenchmarkRandomGenerators();
+    printf("random generators: MersenneTwister next %.2f ns, fill %.2f ns, "
+           "Philox next %.2f ns, fill %.2f ns per value, results hash 0x%08x\n",
+           times.mersenneTwisterNextNsec, times.mersenneTwisterFillNsec,
+           times.philoxNextNsec, times.philoxFillNsec, times.resultsHash);
+  }
+
+  // missing meshes are generated into the data directory, the kdtree file is
+  // used if present, otherwise the tree comes from the kdtree cache
+  if (HasCommandLineOption(argc, argv, "--size-sweep")) {
+    const bool large = HasCommandLineOption(argc, argv, "--size-sweep-large");
+    for (int64_t requestedCount : sizeSweepTrianglesCounts) {
+      if (requestedCount > 10000000 && !large)
+        continue;
+
+      const auto name = GetSizeSweepMeshName(requestedCount);
+      const auto meshFile = JoinPath(argv[1], name + ".stl");
+      const auto kdtreeFile = JoinPath(argv[1], name + ".kdtree");
+
+      if (!FileExists(meshFile)) {
+        MeshGeneratorParams params;
+        params.trianglesCount = requestedCount;
+        GenerateMeshStl(meshFile, params);
+      }
+
+      auto mesh = LoadTriangleMesh(meshFile, loadOptions);
+      std::unique_ptr<KdTree> kdTree;
+      if (FileExists(kdtreeFile)) {
+        kdTree.reset(new KdTree(kdtreeFile, *mesh));
+      } else {
+        kdTree = LoadOrBuildKdTree(kdtreeCacheDirectory, *mesh,
+                                   KdTreeBuilder::BuildParams());
+      }
+      ValidateKdTree(*kdTree, 16);
+
+      int timeMsec = BenchmarkKdTree(*kdTree);
+      double speed =
+          (benchmarkRaysCount / 1000000.0) / (std::max(timeMsec, 1) / 1000.0);
+      printf("size sweep [%-10s]: %d triangles, %.2f MB, %.2f MRays/sec\n",
+             name.c_str(), mesh->GetTrianglesCount(),
+             kdTree->GetMemoryUsage() / (1024.0 * 1024.0), speed);
+    }
+  }
   return 0;
 }
@@ -0,0 +1,146 @@
+#include "common.h"
+#include "file_format.h"
+#include "mapped_file.h"
+#include "mesh_file.h"
+#include "triangle_mesh.h"
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace {
+enum : uint32_t { meshFileVersion = 1, hasNormalsFlag = 1 };
+
+const char meshFileMagic[8] = {'L', 'A', 'M', 'E', 'S', 'H', '\0', '\0'};
+
+struct MeshFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t sourceFileSize;
+  int64_t sourceModificationTime;
+  uint32_t verticesCount;
+  uint32_t trianglesCount;
+  uint64_t meshHash;    // TriangleMesh::GetHash()
+  uint64_t contentHash; // meshHash extended with normals
+};
+
+static_assert(sizeof(MeshFileHeader) == 56, "unexpected header layout");
+static_assert(sizeof(Vector_f) == 12, "unexpected vertex layout");
+static_assert(sizeof(TriangleMesh::Triangle) == 12,
+              "unexpected triangle layout");
+
+uint64_t GetContentHash(const TriangleMesh& mesh, uint64_t meshHash)
+{
+  return HashBytes(mesh.normals.data(), mesh.normals.size() * sizeof(Vector_f),
+                   meshHash);
+}
+} // namespace
+
+bool GetMeshSourceInfo(const std::string& fileName, MeshSourceInfo& info)
+{
+#ifdef _WIN32
+  struct _stat64 fileStat;
+  if (_stat64(fileName.c_str(), &fileStat) != 0)
+    return false;
+#else
+  struct stat fileStat;
+  if (stat(fileName.c_str(), &fileStat) != 0)
+    return false;
+#endif
+  info.fileSize = static_cast<uint64_t>(fileStat.st_size);
+  info.modificationTime = static_cast<int64_t>(fileStat.st_mtime);
+  return true;
+}
+
+size_t GetMeshFileSize(const TriangleMesh& mesh, bool withNormals)
+{
+  return sizeof(MeshFileHeader) + mesh.vertices.size() * sizeof(Vector_f) +
+         mesh.triangles.size() * sizeof(TriangleMesh::Triangle) +
+         (withNormals ? mesh.triangles.size() * sizeof(Vector_f) : 0);
+}
+
+bool SaveMeshFile(const std::string& fileName, const TriangleMesh& mesh,
+                  const MeshSourceInfo& source, bool withNormals)
+{
+  withNormals = withNormals && mesh.normals.size() == mesh.triangles.size();
+
+  MeshFileHeader header;
+  memcpy(header.magic, meshFileMagic, sizeof(header.magic));
+  header.version = meshFileVersion;
+  header.flags = withNormals ? uint32_t(hasNormalsFlag) : 0u;
+  header.sourceFileSize = source.fileSize;
+  header.sourceModificationTime = source.modificationTime;
+  header.verticesCount = static_cast<uint32_t>(mesh.vertices.size());
+  header.trianglesCount = static_cast<uint32_t>(mesh.triangles.size());
+  header.meshHash = mesh.GetHash();
+  header.contentHash =
+      withNormals ? GetContentHash(mesh, header.meshHash) : header.meshHash;
+
+  return WriteFileAtomically(fileName, [&](std::ofstream& file) {
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mesh.vertices.data()),
+               mesh.vertices.size() * sizeof(Vector_f));
+    file.write(reinterpret_cast<const char*>(mesh.triangles.data()),
+               mesh.triangles.size() * sizeof(TriangleMesh::Triangle));
+    if (withNormals)
+      file.write(reinterpret_cast<const char*>(mesh.normals.data()),
+                 mesh.normals.size() * sizeof(Vector_f));
+  });
+}
+
+std::unique_ptr<TriangleMesh> LoadMeshFile(const std::string& fileName,
+                                           const MeshSourceInfo& source)
+{
+  MappedFile file;
+  MeshFileHeader header;
+  if (!file.Open(fileName, MappedFile::Access::Sequential) ||
+      !ReadFileHeader(file, header))
+    return nullptr;
+
+  MeshSourceInfo fileSource;
+  fileSource.fileSize = header.sourceFileSize;
+  fileSource.modificationTime = header.sourceModificationTime;
+
+  if (memcmp(header.magic, meshFileMagic, sizeof(header.magic)) != 0 ||
+      header.version != meshFileVersion || !(fileSource == source))
+    return nullptr;
+
+  const bool hasNormals = (header.flags & hasNormalsFlag) != 0;
+  const uint64_t verticesSize = uint64_t(header.verticesCount) * 12;
+  const uint64_t trianglesSize = uint64_t(header.trianglesCount) * 12;
+  const uint64_t normalsSize = hasNormals ? trianglesSize : 0;
+
+  if (file.GetSize() !=
+      sizeof(header) + verticesSize + trianglesSize + normalsSize)
+    return nullptr;
+
+  auto mesh = std::unique_ptr<TriangleMesh>(new TriangleMesh());
+  const uint8_t* data = file.GetData() + sizeof(header);
+
+  mesh->vertices.resize(header.verticesCount);
+  memcpy(mesh->vertices.data(), data, verticesSize);
+  data += verticesSize;
+
+  mesh->triangles.resize(header.trianglesCount);
+  memcpy(mesh->triangles.data(), data, trianglesSize);
+  data += trianglesSize;
+
+  if (hasNormals) {
+    mesh->normals.resize(header.trianglesCount);
+    memcpy(mesh->normals.data(), data, normalsSize);
+  }
+
+  if (mesh->GetHash() != header.meshHash ||
+      (hasNormals && GetContentHash(*mesh, header.meshHash) !=
+                         header.contentHash))
+    return nullptr;
+
+  for (const auto& triangle : mesh->triangles) {
+    for (const auto& point : triangle.points) {
+      if (point.vertexIndex < 0 ||
+          uint32_t(point.vertexIndex) >= header.verticesCount)
+        return nullptr;
+    }
+  }
+  return mesh;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class TriangleMesh;
+
+// Identifies the version of the source file the mesh file was created from.
+struct MeshSourceInfo {
+  uint64_t fileSize = 0;
+  int64_t modificationTime = 0;
+
+  bool operator==(const MeshSourceInfo& other) const
+  {
+    return fileSize == other.fileSize &&
+           modificationTime == other.modificationTime;
+  }
+};
+
+// Returns false if the file does not exist.
+bool GetMeshSourceInfo(const std::string& fileName, MeshSourceInfo& info);
+
+// Native mesh file stores welded vertices, indexed triangles and optionally
+// facet normals behind a versioned header with a content hash. Loading needs
+// no parsing or welding, but it is not zero-copy: see LoadMeshFile.
+bool SaveMeshFile(const std::string& fileName, const TriangleMesh& mesh,
+                  const MeshSourceInfo& source, bool withNormals);
+
+size_t GetMeshFileSize(const TriangleMesh& mesh, bool withNormals);
+
+// Reads the file through a read-only mapping and copies each array into the
+// vectors of a new TriangleMesh, which owns its storage; the mesh does not
+// reference the file afterwards. The copy is validated: returns nullptr if
+// the file is missing, has a different version, was created from another
+// version of the source file, fails the content hash check or has vertex
+// indices out of range. When normals are not stored the mesh has no normals.
+std::unique_ptr<TriangleMesh> LoadMeshFile(const std::string& fileName,
+                                           const MeshSourceInfo& source);
@@ -0,0 +1,102 @@
+#include "bounding_box.h"
+#include "mesh_reorder.h"
+#include "triangle_mesh.h"
+#include "vector.h"
+#include <algorithm>
+
+namespace {
+enum { mortonBitsPerAxis = 21 };
+
+// Inserts two zero bits after each of the 21 low bits of the value.
+uint64_t SpreadBits(uint32_t value)
+{
+  uint64_t x = value & 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffull;
+  x = (x | x << 16) & 0x1f0000ff0000ffull;
+  x = (x | x << 8) & 0x100f00f00f00f00full;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+} // namespace
+
+std::vector<int32_t> ReorderMeshForLocality(TriangleMesh& mesh)
+{
+  const int32_t trianglesCount = mesh.GetTrianglesCount();
+  const BoundingBox_f bounds = mesh.GetBounds();
+  const Vector_f extent = bounds.maxPoint - bounds.minPoint;
+  const float maxCoordinate = static_cast<float>((1 << mortonBitsPerAxis) - 1);
+
+  struct Entry {
+    uint64_t mortonCode;
+    int32_t triangleIndex;
+  };
+
+  std::vector<Entry> entries(trianglesCount);
+  for (int32_t i = 0; i < trianglesCount; i++) {
+    const auto& p = mesh.triangles[i].points;
+    Vector_f centroid = (mesh.vertices[p[0].vertexIndex] +
+                         mesh.vertices[p[1].vertexIndex] +
+                         mesh.vertices[p[2].vertexIndex]) /
+                        3.0f;
+
+    uint64_t mortonCode = 0;
+    for (int k = 0; k < 3; k++) {
+      float t = (extent[k] > 0.0f)
+                    ? (centroid[k] - bounds.minPoint[k]) / extent[k]
+                    : 0.0f;
+      t = std::min(std::max(t, 0.0f), 1.0f);
+      mortonCode |= SpreadBits(static_cast<uint32_t>(t * maxCoordinate)) << k;
+    }
+    entries[i] = {mortonCode, i};
+  }
+
+  // the index breaks ties, so the order does not depend on sort algorithm
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) {
+              return a.mortonCode < b.mortonCode ||
+                     (a.mortonCode == b.mortonCode &&
+                      a.triangleIndex < b.triangleIndex);
+            });
+
+  const bool hasNormals = (mesh.normals.size() == mesh.triangles.size());
+
+  std::vector<int32_t> triangleRemap(trianglesCount);
+  std::vector<int32_t> vertexRemap(mesh.vertices.size(), -1);
+
+  LargeVector<Vector_f> vertices;
+  vertices.reserve(mesh.vertices.size());
+  LargeVector<TriangleMesh::Triangle> triangles(trianglesCount);
+  std::vector<Vector_f> normals(hasNormals ? trianglesCount : 0);
+
+  for (int32_t i = 0; i < trianglesCount; i++) {
+    const int32_t oldIndex = entries[i].triangleIndex;
+    triangleRemap[oldIndex] = i;
+
+    TriangleMesh::Triangle triangle = mesh.triangles[oldIndex];
+    for (auto& point : triangle.points) {
+      int32_t& newVertexIndex = vertexRemap[point.vertexIndex];
+      if (newVertexIndex == -1) {
+        newVertexIndex = static_cast<int32_t>(vertices.size());
+        vertices.push_back(mesh.vertices[point.vertexIndex]);
+      }
+      point.vertexIndex = newVertexIndex;
+    }
+    triangles[i] = triangle;
+
+    if (hasNormals)
+      normals[i] = mesh.normals[oldIndex];
+  }
+
+  // vertices that are not referenced by triangles are kept at the end
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    if (vertexRemap[i] == -1)
+      vertices.push_back(mesh.vertices[i]);
+  }
+
+  mesh.vertices.swap(vertices);
+  mesh.triangles.swap(triangles);
+  if (hasNormals)
+    mesh.normals.swap(normals);
+  return triangleRemap;
+}
@@ -0,0 +1,72 @@
+#include "perf_counter.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+PerfCounter::PerfCounter(Event event)
+{
+#ifdef __linux__
+  uint64_t cache = PERF_COUNT_HW_CACHE_DTLB;
+  if (event == Event::L1DataCacheMisses)
+    cache = PERF_COUNT_HW_CACHE_L1D;
+  else if (event == Event::LastLevelCacheMisses)
+    cache = PERF_COUNT_HW_CACHE_LL;
+
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  fileDescriptor = static_cast<int>(
+      syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+  (void)event;
+#endif
+}
+
+PerfCounter::~PerfCounter()
+{
+#ifdef __linux__
+  if (fileDescriptor != -1)
+    close(fileDescriptor);
+#endif
+}
+
+bool PerfCounter::IsAvailable() const
+{
+  return fileDescriptor != -1;
+}
+
+void PerfCounter::Start()
+{
+#ifdef __linux__
+  if (fileDescriptor != -1) {
+    ioctl(fileDescriptor, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fileDescriptor, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+int64_t PerfCounter::Stop()
+{
+#ifdef __linux__
+  if (fileDescriptor != -1) {
+    ioctl(fileDescriptor, PERF_EVENT_IOC_DISABLE, 0);
+    int64_t count;
+    if (read(fileDescriptor, &count, sizeof(count)) == sizeof(count))
+      return count;
+  }
+#endif
+  return -1;
+}
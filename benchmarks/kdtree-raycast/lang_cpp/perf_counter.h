@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts hardware events in user mode for the calling thread and for the
+// threads it creates after Start(). Uses Linux perf events, on other
+// platforms or when perf events are not permitted the counter is not
+// available and Stop() returns -1.
+class PerfCounter {
+public:
+  enum class Event {
+    DataTlbMisses,        // dTLB load misses
+    L1DataCacheMisses,    // L1 data cache load misses
+    LastLevelCacheMisses, // last level cache load misses
+  };
+
+  explicit PerfCounter(Event event);
+  ~PerfCounter();
+
+  bool IsAvailable() const;
+
+  void Start();
+  int64_t Stop();
+
+private:
+  PerfCounter(const PerfCounter&) = delete;
+  PerfCounter& operator=(const PerfCounter&) = delete;
+
+  int fileDescriptor = -1;
+};
@@ -1,4 +1,10 @@
 #include "random.h"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define RANDOM_SSE2
+#include <emmintrin.h>
+#endif
 
 /*
 Copyright (C) 1997 - 2002, Makoto Matsumoto and Takuji Nishimura,
@@ -37,67 +43,249 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
-static unsigned long mt[N]; /* the array for the state vector  */
-static int mti = N + 1;     /* mti==N+1 means mt[N] is not initialized */
+static_assert(N == 624, "MersenneTwister::stateSize has to be N");
 
 // Random Number Functions
-static void init_genrand(unsigned long seed)
+MersenneTwister::MersenneTwister(uint32_t seed)
 {
-  mt[0] = seed & 0xffffffffUL;
-  for (mti = 1; mti < N; mti++) {
-    mt[mti] = (1812433253UL * (mt[mti - 1] ^ (mt[mti - 1] >> 30)) + mti);
+  state[0] = seed;
+  for (int i = 1; i < N; i++) {
+    state[i] = (1812433253UL * (state[i - 1] ^ (state[i - 1] >> 30)) + i);
     /* See Knuth TAOCP Vol2. 3rd Ed. P.106 for multiplier. */
     /* In the previous versions, MSBs of the seed affect   */
     /* only MSBs of the array mt[].                        */
     /* 2002/01/09 modified by Makoto Matsumoto             */
-    mt[mti] &= 0xffffffffUL;
-    /* for >32 bit machines */
   }
+  index = N;
 }
 
-uint32_t RandUint32()
+/* generate N words at one time */
+void MersenneTwister::GenerateState()
 {
-  unsigned long y;
-  static unsigned long mag01[2] = {0x0UL, MATRIX_A};
+  static const uint32_t mag01[2] = {0x0UL, MATRIX_A};
   /* mag01[x] = x * MATRIX_A  for x=0,1 */
 
-  if (mti >= N) { /* generate N words at one time */
-    int kk;
-
-    if (mti == N + 1)       /* if init_genrand() has not been called, */
-      init_genrand(5489UL); /* default initial seed */
+  uint32_t y;
+  int kk;
 
-    for (kk = 0; kk < N - M; kk++) {
-      y = (mt[kk] & UPPER_MASK) | (mt[kk + 1] & LOWER_MASK);
-      mt[kk] = mt[kk + M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-    }
-    for (; kk < N - 1; kk++) {
-      y = (mt[kk] & UPPER_MASK) | (mt[kk + 1] & LOWER_MASK);
-      mt[kk] = mt[kk + (M - N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-    }
-    y = (mt[N - 1] & UPPER_MASK) | (mt[0] & LOWER_MASK);
-    mt[N - 1] = mt[M - 1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-    mti = 0;
+  for (kk = 0; kk < N - M; kk++) {
+    y = (state[kk] & UPPER_MASK) | (state[kk + 1] & LOWER_MASK);
+    state[kk] = state[kk + M] ^ (y >> 1) ^ mag01[y & 0x1UL];
+  }
+  for (; kk < N - 1; kk++) {
+    y = (state[kk] & UPPER_MASK) | (state[kk + 1] & LOWER_MASK);
+    state[kk] = state[kk + (M - N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
   }
+  y = (state[N - 1] & UPPER_MASK) | (state[0] & LOWER_MASK);
+  state[N - 1] = state[M - 1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-  y = mt[mti++];
+  index = 0;
+}
 
-  /* Tempering */
+static inline uint32_t Temper(uint32_t y)
+{
   y ^= (y >> 11);
   y ^= (y << 7) & 0x9d2c5680UL;
   y ^= (y << 15) & 0xefc60000UL;
   y ^= (y >> 18);
-
   return y;
 }
 
+uint32_t MersenneTwister::NextUint32()
+{
+  if (index >= N)
+    GenerateState();
+  return Temper(state[index++]);
+}
+
+double MersenneTwister::NextDouble()
+{
+  return NextUint32() * (1.0 / 4294967296.0);
+}
+
+double MersenneTwister::NextFromRange(double a, double b)
+{
+  return a + NextDouble() * (b - a);
+}
+
+void MersenneTwister::Fill(uint32_t* values, size_t count)
+{
+  while (count > 0) {
+    if (index >= N)
+      GenerateState();
+
+    const size_t n = std::min(count, static_cast<size_t>(N - index));
+    const uint32_t* words = state + index;
+    for (size_t i = 0; i < n; i++)
+      values[i] = Temper(words[i]);
+
+    index += static_cast<int>(n);
+    values += n;
+    count -= n;
+  }
+}
+
+// Philox4x32-10 constants
+enum : uint32_t {
+  philoxM0 = 0xD2511F53,
+  philoxM1 = 0xCD9E8D57,
+  philoxW0 = 0x9E3779B9,
+  philoxW1 = 0xBB67AE85
+};
+const int philoxRounds = 10;
+
+PhiloxGenerator::PhiloxGenerator(uint64_t key, uint64_t position)
+: key(key)
+{
+  Seek(position);
+}
+
+void PhiloxGenerator::Seek(uint64_t position)
+{
+  counter = position / 4;
+  blockIndex = 4;
+  if (position % 4 != 0) {
+    GenerateBlock(key, counter++, block);
+    blockIndex = static_cast<int>(position % 4);
+  }
+}
+
+void PhiloxGenerator::GenerateBlock(uint64_t key, uint64_t counter,
+                                    uint32_t block[4])
+{
+  uint32_t c0 = static_cast<uint32_t>(counter);
+  uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+  uint32_t c2 = 0;
+  uint32_t c3 = 0;
+  uint32_t k0 = static_cast<uint32_t>(key);
+  uint32_t k1 = static_cast<uint32_t>(key >> 32);
+
+  for (int round = 0; round < philoxRounds; round++) {
+    uint64_t product0 = uint64_t(philoxM0) * c0;
+    uint64_t product1 = uint64_t(philoxM1) * c2;
+    c0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+    c1 = static_cast<uint32_t>(product1);
+    c2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+    c3 = static_cast<uint32_t>(product0);
+    k0 += philoxW0;
+    k1 += philoxW1;
+  }
+  block[0] = c0;
+  block[1] = c1;
+  block[2] = c2;
+  block[3] = c3;
+}
+
+#ifdef RANDOM_SSE2
+// 32 bit products of the lanes, SSE2 multiplies only the even lanes.
+static inline __m128i MultiplyHighLow(__m128i a, __m128i multiplier,
+                                      __m128i& high)
+{
+  const __m128i lowMask = _mm_set_epi32(0, -1, 0, -1);
+  __m128i even = _mm_mul_epu32(a, multiplier);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), multiplier);
+  high = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(lowMask, odd));
+  return _mm_or_si128(_mm_and_si128(even, lowMask), _mm_slli_epi64(odd, 32));
+}
+
+// Blocks of the counters counter .. counter + 3, lane i of the registers is
+// the block i. The blocks are transposed to the block order when stored.
+static void GenerateBlocks4(uint64_t key, uint64_t counter, uint32_t* values)
+{
+  uint32_t low[4], high[4];
+  for (int i = 0; i < 4; i++) {
+    low[i] = static_cast<uint32_t>(counter + i);
+    high[i] = static_cast<uint32_t>((counter + i) >> 32);
+  }
+  __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(low));
+  __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(high));
+  __m128i c2 = _mm_setzero_si128();
+  __m128i c3 = _mm_setzero_si128();
+
+  const __m128i m0 = _mm_set1_epi32(static_cast<int>(philoxM0));
+  const __m128i m1 = _mm_set1_epi32(static_cast<int>(philoxM1));
+  uint32_t k0 = static_cast<uint32_t>(key);
+  uint32_t k1 = static_cast<uint32_t>(key >> 32);
+
+  for (int round = 0; round < philoxRounds; round++) {
+    __m128i high0, high1;
+    __m128i low0 = MultiplyHighLow(c0, m0, high0);
+    __m128i low1 = MultiplyHighLow(c2, m1, high1);
+    c0 = _mm_xor_si128(_mm_xor_si128(high1, c1),
+                       _mm_set1_epi32(static_cast<int>(k0)));
+    c1 = low1;
+    c2 = _mm_xor_si128(_mm_xor_si128(high0, c3),
+                       _mm_set1_epi32(static_cast<int>(k1)));
+    c3 = low0;
+    k0 += philoxW0;
+    k1 += philoxW1;
+  }
+
+  __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+  __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+  __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+  __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+  __m128i* output = reinterpret_cast<__m128i*>(values);
+  _mm_storeu_si128(output + 0, _mm_unpacklo_epi64(t0, t1));
+  _mm_storeu_si128(output + 1, _mm_unpackhi_epi64(t0, t1));
+  _mm_storeu_si128(output + 2, _mm_unpacklo_epi64(t2, t3));
+  _mm_storeu_si128(output + 3, _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+uint32_t PhiloxGenerator::NextUint32()
+{
+  if (blockIndex == 4) {
+    GenerateBlock(key, counter++, block);
+    blockIndex = 0;
+  }
+  return block[blockIndex++];
+}
+
+double PhiloxGenerator::NextDouble()
+{
+  return NextUint32() * (1.0 / 4294967296.0);
+}
+
+double PhiloxGenerator::NextFromRange(double a, double b)
+{
+  return a + NextDouble() * (b - a);
+}
+
+void PhiloxGenerator::Fill(uint32_t* values, size_t count)
+{
+  // the rest of the current block
+  for (; count > 0 && blockIndex < 4; count--)
+    *values++ = block[blockIndex++];
+
+#ifdef RANDOM_SSE2
+  for (; count >= 16; count -= 16) {
+    GenerateBlocks4(key, counter, values);
+    counter += 4;
+    values += 16;
+  }
+#endif
+  for (; count >= 4; count -= 4) {
+    GenerateBlock(key, counter++, values);
+    values += 4;
+  }
+  for (; count > 0; count--)
+    *values++ = NextUint32();
+}
+
+static MersenneTwister generator;
+
+uint32_t RandUint32()
+{
+  return generator.NextUint32();
+}
+
 double RandDouble()
 {
-  return RandUint32() * (1.0 / 4294967296.0);
+  return generator.NextDouble();
 }
 
 double RandFromRange(double a, double b)
 {
-  return a + RandDouble() * (b - a);
+  return generator.NextFromRange(a, b);
 }
@@ -1,7 +1,70 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
+// Mersenne Twister MT19937 with explicit state. The sequence is the same as
+// of the reference implementation (mt19937ar.c) initialized with the seed.
+class MersenneTwister {
+public:
+  enum : uint32_t { defaultSeed = 5489 };
+
+  explicit MersenneTwister(uint32_t seed = defaultSeed);
+
+  uint32_t NextUint32();
+
+  // [0, 1)
+  double NextDouble();
+  double NextFromRange(double a, double b);
+
+  // Stores the next count values, the same as count NextUint32 calls. The
+  // values are tempered in a loop over the state that the compiler
+  // vectorizes.
+  void Fill(uint32_t* values, size_t count);
+
+private:
+  void GenerateState();
+
+private:
+  enum { stateSize = 624 };
+
+  uint32_t state[stateSize];
+  int index; // next state word, stateSize if the state is used up
+};
+
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3"). Values 4 * i .. 4 * i + 3 of the stream are
+// the block computed from counter i and the key. Generators with different
+// keys give independent streams and any position of a stream is computed
+// directly, e.g. each thread can have its own generator. Fill computes four
+// blocks at once with SSE2.
+class PhiloxGenerator {
+public:
+  explicit PhiloxGenerator(uint64_t key, uint64_t position = 0);
+
+  uint32_t NextUint32();
+
+  // [0, 1)
+  double NextDouble();
+  double NextFromRange(double a, double b);
+
+  // Stores the next count values, the same as count NextUint32 calls.
+  void Fill(uint32_t* values, size_t count);
+
+  // The next value is the value at the position of the stream.
+  void Seek(uint64_t position);
+
+  static void GenerateBlock(uint64_t key, uint64_t counter, uint32_t block[4]);
+
+private:
+  uint64_t key;
+  uint64_t counter; // counter of the next block
+  uint32_t block[4];
+  int blockIndex; // next value of the block, 4 if the block is used up
+};
+
+// Global generator, the benchmarks validate its sequence. Not thread safe,
+// threads should use their own generator objects.
 uint32_t RandUint32();
 double RandDouble();
 double RandFromRange(double a, double b);
@@ -12,6 +12,8 @@ public:
   , invDirection(1.0 / direction.x, 1.0 / direction.y, 1.0 / direction.z)
   {
     assert(std::abs(direction.Length() - 1.0) < 1e-6);
+    for (int i = 0; i < 3; i++)
+      directionSigns[i] = std::signbit(direction[i]) ? 1 : 0;
   }
 
   const Vector& GetOrigin() const
@@ -29,6 +31,13 @@ public:
     return invDirection;
   }
 
+  // 1 if the direction is negative along the axis (-0.0 included), the slab
+  // test uses it to select the bounds plane the ray enters through.
+  int GetDirectionSign(int axis) const
+  {
+    return directionSigns[axis];
+  }
+
   void Advance(double t)
   {
     origin = GetPoint(t);
@@ -43,4 +52,28 @@ private:
   Vector origin;
   Vector direction;
   Vector invDirection;
+  int directionSigns[3];
+};
+
+// Up to size rays in structure of arrays layout, used by the packet slab
+// test. Unused lanes repeat the last ray.
+struct RayPacket {
+  enum { size = 4 };
+
+  double origin[3][size];
+  double invDirection[3][size];
+  int count = 0;
+
+  void Set(const Ray* rays, int raysCount)
+  {
+    assert(raysCount > 0 && raysCount <= size);
+    count = raysCount;
+    for (int i = 0; i < size; i++) {
+      const Ray& ray = rays[i < raysCount ? i : raysCount - 1];
+      for (int axis = 0; axis < 3; axis++) {
+        origin[axis][i] = ray.GetOrigin()[axis];
+        invDirection[axis][i] = ray.GetInvDirection()[axis];
+      }
+    }
+  }
 };
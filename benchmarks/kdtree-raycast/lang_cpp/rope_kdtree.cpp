@@ -0,0 +1,179 @@
+#include "rope_kdtree.h"
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+RopeKdTree::RopeKdTree(const KdTree& kdTree)
+: kdTree(kdTree)
+, nodeLeafIndices(kdTree.nodes.size(), -1)
+{
+  Ropes ropes;
+  ropes.fill(noRope);
+  BuildRopes(0, ropes, kdTree.mesh.GetBounds());
+}
+
+void RopeKdTree::BuildRopes(int32_t nodeIndex, Ropes ropes,
+                            const BoundingBox_f& bounds)
+{
+  const KdTree::Node& node = kdTree.nodes[nodeIndex];
+
+  if (node.IsLeaf()) {
+    nodeLeafIndices[nodeIndex] = static_cast<int32_t>(leaves.size());
+    leaves.push_back({bounds, ropes});
+    return;
+  }
+
+  for (int face = 0; face < 6; face++) {
+    if (ropes[face] != noRope)
+      ropes[face] = OptimizeRope(ropes[face], face, bounds);
+  }
+
+  const int axis = node.GetSplitAxis();
+  const float split = node.GetSplitPosition();
+  const int32_t belowChild = nodeIndex + 1;
+  const int32_t aboveChild = node.GetAboveChild();
+
+  BoundingBox_f belowBounds = bounds;
+  belowBounds.maxPoint[axis] = split;
+  Ropes belowRopes = ropes;
+  belowRopes[2 * axis + 1] = aboveChild;
+  BuildRopes(belowChild, belowRopes, belowBounds);
+
+  BoundingBox_f aboveBounds = bounds;
+  aboveBounds.minPoint[axis] = split;
+  Ropes aboveRopes = ropes;
+  aboveRopes[2 * axis] = belowChild;
+  BuildRopes(aboveChild, aboveRopes, aboveBounds);
+}
+
+// Pushes the rope down to the deepest node that still covers the whole face.
+int32_t RopeKdTree::OptimizeRope(int32_t rope, int face,
+                                 const BoundingBox_f& bounds) const
+{
+  const int faceAxis = face / 2;
+  const bool maxFace = (face & 1) != 0;
+
+  while (kdTree.nodes[rope].IsInteriorNode()) {
+    const KdTree::Node& node = kdTree.nodes[rope];
+    const int axis = node.GetSplitAxis();
+    const float split = node.GetSplitPosition();
+
+    if (axis == faceAxis)
+      rope = maxFace ? rope + 1 : node.GetAboveChild();
+    else if (split <= bounds.minPoint[axis])
+      rope = node.GetAboveChild();
+    else if (split >= bounds.maxPoint[axis])
+      rope = rope + 1;
+    else
+      break;
+  }
+  return rope;
+}
+
+bool RopeKdTree::Intersect(const Ray& ray, Intersection& intersection) const
+{
+  auto boundsIntersection = kdTree.meshBounds.Intersect(ray);
+  if (!boundsIntersection.found)
+    return false;
+
+  const auto& nodes = kdTree.nodes;
+  double tEntry = boundsIntersection.t0;
+
+  Triangle::Intersection closestIntersection;
+  int32_t nodeIndex = 0;
+
+  while (closestIntersection.t > tEntry) {
+    // Descend to the leaf that contains the ray point at tEntry. The side of
+    // the split plane is selected by comparing ray parameters, the same way
+    // as the leaf exit distance is computed below, so the ray can't get
+    // stuck between neighbour leaves because of rounding.
+    while (nodes[nodeIndex].IsInteriorNode()) {
+      const KdTree::Node& node = nodes[nodeIndex];
+      int axis = node.GetSplitAxis();
+
+      double distanceToSplitPlane =
+          node.GetSplitPosition() - ray.GetOrigin()[axis];
+
+      // The ray lies in the split plane or starts on it. In both cases the
+      // stack traversal checks both children and we do the same by falling
+      // back to it.
+      if (distanceToSplitPlane == 0.0 &&
+          (tEntry == 0.0 || ray.GetDirection()[axis] == 0.0))
+        return kdTree.Intersect(ray, intersection);
+
+      const int32_t belowChild = nodeIndex + 1;
+      const int32_t aboveChild = node.GetAboveChild();
+
+      if (ray.GetDirection()[axis] > 0.0) {
+        double tSplit = distanceToSplitPlane * ray.GetInvDirection()[axis];
+        nodeIndex = (tEntry < tSplit) ? belowChild : aboveChild;
+      }
+      else if (ray.GetDirection()[axis] < 0.0) {
+        double tSplit = distanceToSplitPlane * ray.GetInvDirection()[axis];
+        nodeIndex = (tEntry < tSplit) ? aboveChild : belowChild;
+      }
+      else { // ray.direction[axis] == 0.0
+        nodeIndex = (distanceToSplitPlane > 0.0) ? belowChild : aboveChild;
+      }
+    }
+
+    kdTree.IntersectLeafTriangles(ray, nodes[nodeIndex], closestIntersection);
+
+    // find exit face
+    const Leaf& leaf = leaves[nodeLeafIndices[nodeIndex]];
+    double tExit = std::numeric_limits<double>::infinity();
+    int exitFace = -1;
+
+    for (int axis = 0; axis < 3; axis++) {
+      double t;
+      int face;
+      if (ray.GetDirection()[axis] > 0.0) {
+        t = (leaf.bounds.maxPoint[axis] - ray.GetOrigin()[axis]) *
+            ray.GetInvDirection()[axis];
+        face = 2 * axis + 1;
+      }
+      else if (ray.GetDirection()[axis] < 0.0) {
+        t = (leaf.bounds.minPoint[axis] - ray.GetOrigin()[axis]) *
+            ray.GetInvDirection()[axis];
+        face = 2 * axis;
+      }
+      else {
+        continue;
+      }
+
+      if (t < tExit) {
+        tExit = t;
+        exitFace = face;
+      }
+    }
+    assert(exitFace != -1);
+
+    nodeIndex = leaf.ropes[exitFace];
+    if (nodeIndex == noRope)
+      break;
+
+    tEntry = std::max(tEntry, tExit);
+  }
+
+  if (closestIntersection.t == std::numeric_limits<double>::infinity())
+    return false;
+
+  intersection.t = closestIntersection.t;
+  intersection.epsilon = closestIntersection.epsilon;
+  return true;
+}
+
+const KdTree& RopeKdTree::GetKdTree() const
+{
+  return kdTree;
+}
+
+const TriangleMesh& RopeKdTree::GetMesh() const
+{
+  return kdTree.GetMesh();
+}
+
+const BoundingBox& RopeKdTree::GetMeshBounds() const
+{
+  return kdTree.GetMeshBounds();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "kdtree.h"
+#include "ray.h"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// KdTree augmented with ropes: each leaf stores its bounds and links to the
+// neighbour nodes adjacent to each of its six faces. Ropes are created by a
+// post-pass over an existing tree and allow traversal without a stack.
+class RopeKdTree {
+public:
+  using Intersection = KdTree::Intersection;
+
+  explicit RopeKdTree(const KdTree& kdTree);
+
+  bool Intersect(const Ray& ray, Intersection& intersection) const;
+
+  const KdTree& GetKdTree() const;
+  const TriangleMesh& GetMesh() const;
+  const BoundingBox& GetMeshBounds() const;
+
+private:
+  // face index is 2 * axis for the face at minimum coordinate and
+  // 2 * axis + 1 for the face at maximum coordinate
+  using Ropes = std::array<int32_t, 6>;
+
+  enum : int32_t { noRope = -1 };
+
+  struct Leaf {
+    BoundingBox_f bounds;
+    Ropes ropes;
+  };
+
+  void BuildRopes(int32_t nodeIndex, Ropes ropes, const BoundingBox_f& bounds);
+  int32_t OptimizeRope(int32_t rope, int face,
+                       const BoundingBox_f& bounds) const;
+
+private:
+  const KdTree& kdTree;
+  std::vector<int32_t> nodeLeafIndices; // -1 for interior nodes
+  std::vector<Leaf> leaves;
+};
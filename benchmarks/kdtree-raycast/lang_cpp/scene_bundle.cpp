@@ -0,0 +1,305 @@
+#include "common.h"
+#include "file_format.h"
+#include "scene_bundle.h"
+#include "triangle.h"
+#include <limits>
+
+namespace {
+enum : uint32_t { sceneBundleVersion = 1 };
+
+const char sceneBundleMagic[8] = {'L', 'A', 'B', 'U', 'N', 'D', 'L', 'E'};
+
+enum Section {
+  verticesSection,
+  trianglesSection,
+  nodesSection,
+  triangleIndicesSection,
+  triangleRecordsSection,
+  sectionsCount
+};
+
+const uint64_t sectionElementSizes[sectionsCount] = {
+    sizeof(Vector_f), sizeof(TriangleMesh::Triangle), 8, 4,
+    sizeof(SceneBundle::TriangleRecord)};
+
+struct SceneBundleHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrderMark;
+  uint64_t meshHash; // TriangleMesh::GetHash()
+  uint64_t buildParamsHash;
+  double meshBounds[6];
+  uint64_t sectionOffsets[sectionsCount];
+  uint64_t sectionCounts[sectionsCount];
+  uint64_t checksum; // header with zero checksum and all sections
+};
+
+static_assert(sizeof(Vector_f) == 12, "unexpected vertex layout");
+static_assert(sizeof(TriangleMesh::Triangle) == 12,
+              "unexpected triangle layout");
+static_assert(sizeof(SceneBundle::TriangleRecord) == 72,
+              "unexpected triangle record layout");
+
+uint64_t GetChecksum(SceneBundleHeader header,
+                     const void* const (&sections)[sectionsCount])
+{
+  header.checksum = 0;
+  uint64_t hash = HashBytes(&header, sizeof(header));
+  for (int i = 0; i < sectionsCount; i++) {
+    hash = HashBytes(sections[i],
+                     header.sectionCounts[i] * sectionElementSizes[i], hash);
+  }
+  return hash;
+}
+} // namespace
+
+SceneBundle::SceneBundle(std::unique_ptr<MappedFile> file,
+                         ConstArrayView<Vector_f> vertices,
+                         ConstArrayView<TriangleMesh::Triangle> triangles,
+                         ConstArrayView<KdTree::Node> nodes,
+                         ConstArrayView<int32_t> triangleIndices,
+                         ConstArrayView<TriangleRecord> triangleRecords,
+                         const BoundingBox& meshBounds)
+: file(std::move(file))
+, vertices(vertices)
+, triangles(triangles)
+, triangleRecords(triangleRecords)
+, kdTree(nullptr, nodes, triangleIndices, emptyMesh, meshBounds)
+{
+}
+
+bool SceneBundle::Intersect(const Ray& ray, Intersection& intersection) const
+{
+  Triangle::Intersection closestIntersection;
+  kdTree.Traverse(ray, [&](KdTree::Node leaf) {
+    IntersectLeafTriangles(ray, leaf, closestIntersection);
+    return closestIntersection.t;
+  });
+
+  if (closestIntersection.t == std::numeric_limits<double>::infinity())
+    return false;
+
+  intersection.t = closestIntersection.t;
+  intersection.epsilon = closestIntersection.epsilon;
+  return true;
+}
+
+const BoundingBox& SceneBundle::GetMeshBounds() const
+{
+  return kdTree.meshBounds;
+}
+
+int32_t SceneBundle::GetTrianglesCount() const
+{
+  return static_cast<int32_t>(triangles.size());
+}
+
+bool SceneBundle::HasTriangleRecords() const
+{
+  return triangleRecords.size() != 0;
+}
+
+size_t SceneBundle::GetFileSize() const
+{
+  return file->GetSize();
+}
+
+void SceneBundle::IntersectLeafTriangles(
+    const Ray& ray, KdTree::Node leaf,
+    Triangle::Intersection& closestIntersection) const
+{
+  const int32_t trianglesCount = leaf.GetTrianglesCount();
+  for (int32_t i = 0; i < trianglesCount; i++) {
+    int32_t triangleIndex = (trianglesCount == 1)
+                                ? leaf.GetIndex()
+                                : kdTree.triangleIndices[leaf.GetIndex() + i];
+
+    Triangle::Intersection intersection;
+    bool hitFound;
+    if (HasTriangleRecords()) {
+      const TriangleRecord& record = triangleRecords[triangleIndex];
+      hitFound = IntersectTriangle(ray, record.point0, record.edge1,
+                                   record.edge2, intersection);
+    }
+    else {
+      const auto& p = triangles[triangleIndex].points;
+      Triangle triangle = {{Vector(vertices[p[0].vertexIndex]),
+                            Vector(vertices[p[1].vertexIndex]),
+                            Vector(vertices[p[2].vertexIndex])}};
+      hitFound = IntersectTriangle(ray, triangle, intersection);
+    }
+
+    if (hitFound && intersection.t < closestIntersection.t) {
+      closestIntersection = intersection;
+    }
+  }
+}
+
+bool SaveSceneBundle(const std::string& fileName, const KdTree& kdTree,
+                     uint64_t buildParamsHash, bool withTriangleRecords)
+{
+  const TriangleMesh& mesh = kdTree.GetMesh();
+
+  std::vector<SceneBundle::TriangleRecord> triangleRecords;
+  if (withTriangleRecords) {
+    triangleRecords.resize(mesh.triangles.size());
+    for (size_t i = 0; i < mesh.triangles.size(); i++) {
+      const auto& p = mesh.triangles[i].points;
+      Vector point0(mesh.vertices[p[0].vertexIndex]);
+      triangleRecords[i].point0 = point0;
+      triangleRecords[i].edge1 =
+          Vector(mesh.vertices[p[1].vertexIndex]) - point0;
+      triangleRecords[i].edge2 =
+          Vector(mesh.vertices[p[2].vertexIndex]) - point0;
+    }
+  }
+
+  const void* sections[sectionsCount] = {
+      mesh.vertices.data(), mesh.triangles.data(), kdTree.nodes.data(),
+      kdTree.triangleIndices.data(), triangleRecords.data()};
+
+  SceneBundleHeader header;
+  InitFileHeader(header, sceneBundleMagic, sceneBundleVersion);
+  header.meshHash = mesh.GetHash();
+  header.buildParamsHash = buildParamsHash;
+  for (int axis = 0; axis < 3; axis++) {
+    header.meshBounds[axis] = kdTree.GetMeshBounds().minPoint[axis];
+    header.meshBounds[axis + 3] = kdTree.GetMeshBounds().maxPoint[axis];
+  }
+  header.sectionCounts[verticesSection] = mesh.vertices.size();
+  header.sectionCounts[trianglesSection] = mesh.triangles.size();
+  header.sectionCounts[nodesSection] = kdTree.nodes.size();
+  header.sectionCounts[triangleIndicesSection] = kdTree.triangleIndices.size();
+  header.sectionCounts[triangleRecordsSection] = triangleRecords.size();
+
+  uint64_t offset = sizeof(header);
+  for (int i = 0; i < sectionsCount; i++) {
+    header.sectionOffsets[i] = AlignOffset(offset);
+    offset = header.sectionOffsets[i] +
+             header.sectionCounts[i] * sectionElementSizes[i];
+  }
+
+  header.checksum = GetChecksum(header, sections);
+
+  return WriteFileAtomically(fileName, [&](std::ofstream& file) {
+    uint64_t position = 0;
+    WriteSection(file, position, 0, &header, sizeof(header));
+    for (int i = 0; i < sectionsCount; i++) {
+      WriteSection(file, position, header.sectionOffsets[i], sections[i],
+                   header.sectionCounts[i] * sectionElementSizes[i]);
+    }
+  });
+}
+
+std::unique_ptr<SceneBundle> LoadSceneBundle(const std::string& fileName,
+                                             bool verifyContent)
+{
+  auto file = std::unique_ptr<MappedFile>(new MappedFile());
+  SceneBundleHeader header;
+  if (!file->Open(fileName) || !ReadFileHeader(*file, header) ||
+      !CheckFileHeader(header, sceneBundleMagic, sceneBundleVersion))
+    return nullptr;
+
+  // sections follow each other in order, the checks do not overflow for any
+  // header values
+  const uint64_t fileSize = file->GetSize();
+  uint64_t offset = sizeof(header);
+  for (int i = 0; i < sectionsCount; i++) {
+    if (header.sectionOffsets[i] != AlignOffset(offset) ||
+        header.sectionOffsets[i] > fileSize ||
+        header.sectionCounts[i] >
+            (fileSize - header.sectionOffsets[i]) / sectionElementSizes[i])
+      return nullptr;
+    offset = header.sectionOffsets[i] +
+             header.sectionCounts[i] * sectionElementSizes[i];
+  }
+
+  const uint64_t trianglesCount = header.sectionCounts[trianglesSection];
+  const uint64_t recordsCount = header.sectionCounts[triangleRecordsSection];
+  if (trianglesCount > uint64_t(INT32_MAX) ||
+      header.sectionCounts[nodesSection] == 0 ||
+      header.sectionCounts[nodesSection] >
+          uint64_t(KdTree::Node::maxNodesCount) ||
+      (recordsCount != 0 && recordsCount != trianglesCount))
+    return nullptr;
+
+  const uint8_t* data = file->GetData();
+  auto getSection = [&header, data](Section section) {
+    return data + header.sectionOffsets[section];
+  };
+
+  ConstArrayView<Vector_f> vertices(
+      reinterpret_cast<const Vector_f*>(getSection(verticesSection)),
+      header.sectionCounts[verticesSection]);
+  ConstArrayView<TriangleMesh::Triangle> triangles(
+      reinterpret_cast<const TriangleMesh::Triangle*>(
+          getSection(trianglesSection)),
+      trianglesCount);
+  ConstArrayView<KdTree::Node> nodes(
+      reinterpret_cast<const KdTree::Node*>(getSection(nodesSection)),
+      header.sectionCounts[nodesSection]);
+  ConstArrayView<int32_t> triangleIndices(
+      reinterpret_cast<const int32_t*>(getSection(triangleIndicesSection)),
+      header.sectionCounts[triangleIndicesSection]);
+  ConstArrayView<SceneBundle::TriangleRecord> triangleRecords(
+      reinterpret_cast<const SceneBundle::TriangleRecord*>(
+          getSection(triangleRecordsSection)),
+      recordsCount);
+
+  if (verifyContent) {
+    const void* sections[sectionsCount];
+    for (int i = 0; i < sectionsCount; i++)
+      sections[i] = getSection(static_cast<Section>(i));
+    if (GetChecksum(header, sections) != header.checksum)
+      return nullptr;
+
+    // same as TriangleMesh::GetHash
+    uint64_t meshHash = HashBytes(vertices.data(),
+                                  vertices.size() * sizeof(Vector_f));
+    meshHash = HashBytes(triangles.data(),
+                         triangles.size() * sizeof(TriangleMesh::Triangle),
+                         meshHash);
+    if (meshHash != header.meshHash)
+      return nullptr;
+
+    for (const auto& triangle : triangles) {
+      for (const auto& point : triangle.points) {
+        if (point.vertexIndex < 0 ||
+            uint64_t(point.vertexIndex) >= vertices.size())
+          return nullptr;
+      }
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const KdTree::Node& node = nodes[i];
+      if (node.IsInteriorNode()) {
+        if (node.GetAboveChild() <= int64_t(i) ||
+            uint64_t(node.GetAboveChild()) >= nodes.size())
+          return nullptr;
+      }
+      else if (node.GetTrianglesCount() == 1) {
+        if (node.GetIndex() < 0 || uint64_t(node.GetIndex()) >= trianglesCount)
+          return nullptr;
+      }
+      else if (node.GetTrianglesCount() > 1) {
+        if (node.GetIndex() < 0 ||
+            uint64_t(node.GetIndex()) + node.GetTrianglesCount() >
+                triangleIndices.size())
+          return nullptr;
+      }
+    }
+    for (int32_t index : triangleIndices) {
+      if (index < 0 || uint64_t(index) >= trianglesCount)
+        return nullptr;
+    }
+  }
+
+  BoundingBox meshBounds;
+  for (int axis = 0; axis < 3; axis++) {
+    meshBounds.minPoint[axis] = header.meshBounds[axis];
+    meshBounds.maxPoint[axis] = header.meshBounds[axis + 3];
+  }
+
+  return std::unique_ptr<SceneBundle>(
+      new SceneBundle(std::move(file), vertices, triangles, nodes,
+                      triangleIndices, triangleRecords, meshBounds));
+}
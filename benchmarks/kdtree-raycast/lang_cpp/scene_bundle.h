@@ -0,0 +1,75 @@
+#pragma once
+
+#include "bounding_box.h"
+#include "kdtree.h"
+#include "mapped_file.h"
+#include "ray.h"
+#include "triangle_mesh.h"
+#include "vector.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Scene that is traced directly from the memory mapped bundle file. The file
+// holds welded vertices, indexed triangles, kdtree nodes, leaf triangle
+// indices and optionally precomputed triangle records, each section 64 byte
+// aligned and stored in the in-memory layout. Opening the bundle validates
+// the header and maps the file, no data is parsed or copied.
+//
+// Intersections are the same as KdTree produces for the mesh the bundle was
+// created from.
+class SceneBundle {
+public:
+  using Intersection = KdTree::Intersection;
+
+  // Triangle data used by the intersection test, stored per triangle. The
+  // edges are computed in the same way as IntersectTriangle does it.
+  struct TriangleRecord {
+    Vector point0;
+    Vector edge1;
+    Vector edge2;
+  };
+
+  bool Intersect(const Ray& ray, Intersection& intersection) const;
+
+  const BoundingBox& GetMeshBounds() const;
+  int32_t GetTrianglesCount() const;
+  bool HasTriangleRecords() const;
+  size_t GetFileSize() const;
+
+private:
+  friend std::unique_ptr<SceneBundle>
+  LoadSceneBundle(const std::string& fileName, bool verifyContent);
+
+  SceneBundle(std::unique_ptr<MappedFile> file,
+              ConstArrayView<Vector_f> vertices,
+              ConstArrayView<TriangleMesh::Triangle> triangles,
+              ConstArrayView<KdTree::Node> nodes,
+              ConstArrayView<int32_t> triangleIndices,
+              ConstArrayView<TriangleRecord> triangleRecords,
+              const BoundingBox& meshBounds);
+
+  void IntersectLeafTriangles(
+      const Ray& ray, KdTree::Node leaf,
+      Triangle::Intersection& closestIntersection) const;
+
+private:
+  std::unique_ptr<MappedFile> file;
+  ConstArrayView<Vector_f> vertices;
+  ConstArrayView<TriangleMesh::Triangle> triangles;
+  ConstArrayView<TriangleRecord> triangleRecords;
+
+  // The tree references the nodes and indices of the mapped file, only its
+  // traversal code is used. The mesh it refers to is empty, triangles are
+  // taken from the bundle.
+  TriangleMesh emptyMesh;
+  KdTree kdTree;
+};
+
+bool SaveSceneBundle(const std::string& fileName, const KdTree& kdTree,
+                     uint64_t buildParamsHash, bool withTriangleRecords);
+
+// Returns nullptr if the file is not a valid bundle. verifyContent checks the
+// checksum and that all references are in range, this reads the whole file.
+std::unique_ptr<SceneBundle> LoadSceneBundle(const std::string& fileName,
+                                             bool verifyContent);
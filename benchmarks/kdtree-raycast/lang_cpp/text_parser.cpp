@@ -0,0 +1,250 @@
+#include "text_parser.h"
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define TEXT_PARSER_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+enum { simdWidth = 16 };
+
+inline bool IsWhitespace(char c)
+{
+  return static_cast<uint8_t>(c) <= ' ';
+}
+
+#ifdef TEXT_PARSER_SSE2
+inline int CountTrailingZeros(uint32_t value)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(value);
+#endif
+}
+
+// Returns bit mask of whitespace bytes among the 16 bytes starting at p.
+inline uint32_t GetWhitespaceMask(const char* p)
+{
+  const __m128i space = _mm_set1_epi8(' ');
+  __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i whitespace = _mm_cmpeq_epi8(_mm_max_epu8(chars, space), space);
+  return static_cast<uint32_t>(_mm_movemask_epi8(whitespace));
+}
+#endif
+
+const char* SkipWhitespace(const char* p, const char* end)
+{
+#ifdef TEXT_PARSER_SSE2
+  while (end - p >= simdWidth) {
+    uint32_t mask = ~GetWhitespaceMask(p) & 0xffff;
+    if (mask != 0)
+      return p + CountTrailingZeros(mask);
+    p += simdWidth;
+  }
+#endif
+  while (p != end && IsWhitespace(*p))
+    p++;
+  return p;
+}
+
+const char* FindWhitespace(const char* p, const char* end)
+{
+#ifdef TEXT_PARSER_SSE2
+  while (end - p >= simdWidth) {
+    uint32_t mask = GetWhitespaceMask(p);
+    if (mask != 0)
+      return p + CountTrailingZeros(mask);
+    p += simdWidth;
+  }
+#endif
+  while (p != end && !IsWhitespace(*p))
+    p++;
+  return p;
+}
+
+bool ParseFloatWithStrtof(const char* begin, const char* end, float& value)
+{
+  std::string text(begin, end);
+  char* parseEnd;
+  value = strtof(text.c_str(), &parseEnd);
+  return parseEnd == text.c_str() + text.size() && !text.empty();
+}
+} // namespace
+
+TextParser::TextParser(const uint8_t* data, size_t size)
+: begin(reinterpret_cast<const char*>(data))
+, current(reinterpret_cast<const char*>(data))
+, end(reinterpret_cast<const char*>(data) + size)
+{
+}
+
+bool TextParser::AtEnd()
+{
+  current = SkipWhitespace(current, end);
+  return current == end;
+}
+
+TextParser::Token TextParser::NextToken()
+{
+  Token token;
+  token.data = SkipWhitespace(current, end);
+  current = FindWhitespace(token.data, end);
+  token.size = static_cast<size_t>(current - token.data);
+  return token;
+}
+
+TextParser::Token TextParser::NextTokenInLine()
+{
+  while (current != end && *current != '\n' && IsWhitespace(*current))
+    current++;
+
+  Token token;
+  token.data = current;
+  if (current != end && *current != '\n') {
+    current = FindWhitespace(current, end);
+    token.size = static_cast<size_t>(current - token.data);
+  }
+  return token;
+}
+
+bool TextParser::ParseFloat(float& value)
+{
+  Token token = NextToken();
+  return ::ParseFloat(token.data, token.data + token.size, value);
+}
+
+void TextParser::SkipLine()
+{
+  size_t size = static_cast<size_t>(end - current);
+  const void* newline = memchr(current, '\n', size);
+  current = newline ? static_cast<const char*>(newline) + 1 : end;
+}
+
+size_t TextParser::GetOffset() const
+{
+  return static_cast<size_t>(current - begin);
+}
+
+bool ParseInteger(const char* begin, const char* end, int64_t& value)
+{
+  const char* p = begin;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+'))
+    negative = (*p++ == '-');
+
+  if (p == end || end - p > 18)
+    return false;
+
+  int64_t result = 0;
+  for (; p != end; p++) {
+    if (*p < '0' || *p > '9')
+      return false;
+    result = result * 10 + (*p - '0');
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+bool ParseFloat(const char* begin, const char* end, float& value)
+{
+  enum { maxDigits = 19, maxExactPowerOf10 = 22 };
+  static const double powersOf10[maxExactPowerOf10 + 1] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  const char* p = begin;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+'))
+    negative = (*p++ == '-');
+
+  uint64_t mantissa = 0;
+  int digitsCount = 0;
+  int exponent = 0;
+  bool truncated = false;
+  bool hasDigits = false;
+
+  for (; p != end && *p >= '0' && *p <= '9'; p++) {
+    hasDigits = true;
+    if (digitsCount < maxDigits) {
+      mantissa = mantissa * 10 + (*p - '0');
+      digitsCount += (mantissa != 0);
+    }
+    else {
+      truncated |= (*p != '0');
+      exponent++;
+    }
+  }
+
+  if (p != end && *p == '.') {
+    for (p++; p != end && *p >= '0' && *p <= '9'; p++) {
+      hasDigits = true;
+      if (digitsCount < maxDigits) {
+        mantissa = mantissa * 10 + (*p - '0');
+        digitsCount += (mantissa != 0);
+        exponent--;
+      }
+      else {
+        truncated |= (*p != '0');
+      }
+    }
+  }
+
+  if (hasDigits && p != end && (*p == 'e' || *p == 'E')) {
+    const char* exponentBegin = p++;
+    bool negativeExponent = false;
+    if (p != end && (*p == '-' || *p == '+'))
+      negativeExponent = (*p++ == '-');
+
+    int explicitExponent = 0;
+    bool hasExponentDigits = false;
+    for (; p != end && *p >= '0' && *p <= '9'; p++) {
+      hasExponentDigits = true;
+      if (explicitExponent < 100000)
+        explicitExponent = explicitExponent * 10 + (*p - '0');
+    }
+    if (!hasExponentDigits)
+      p = exponentBegin;
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+  }
+
+  // inf, nan, hex floats and malformed input
+  if (!hasDigits || p != end)
+    return ParseFloatWithStrtof(begin, end, value);
+
+  if (mantissa == 0) {
+    value = negative ? -0.0f : 0.0f;
+    return true;
+  }
+
+  if (truncated || mantissa > (uint64_t(1) << 53) ||
+      exponent < -maxExactPowerOf10 || exponent > maxExactPowerOf10)
+    return ParseFloatWithStrtof(begin, end, value);
+
+  // both operands are exact, so d is the correctly rounded double
+  double d = static_cast<double>(mantissa);
+  d = (exponent < 0) ? d / powersOf10[-exponent] : d * powersOf10[exponent];
+
+  // Rounding d to float gives the correctly rounded float unless d is exactly
+  // halfway between two floats (the decimal value might be slightly above or
+  // below it) or d is outside of the normal float range.
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  const uint64_t halfwayBits = uint64_t(1) << 28;
+  if ((bits & ((halfwayBits << 1) - 1)) == halfwayBits || d < FLT_MIN ||
+      d > FLT_MAX)
+    return ParseFloatWithStrtof(begin, end, value);
+
+  value = static_cast<float>(negative ? -d : d);
+  return true;
+}
@@ -5,7 +5,14 @@ bool IntersectTriangle(const Ray& ray, const Triangle& triangle,
 {
   Vector edge1 = triangle.points[1] - triangle.points[0];
   Vector edge2 = triangle.points[2] - triangle.points[0];
+  return IntersectTriangle(ray, triangle.points[0], edge1, edge2,
+                           intersection);
+}
 
+bool IntersectTriangle(const Ray& ray, const Vector& point0,
+                       const Vector& edge1, const Vector& edge2,
+                       Triangle::Intersection& intersection)
+{
   Vector p = CrossProduct(ray.GetDirection(), edge2);
   double divisor = DotProduct(edge1, p);
 
@@ -16,7 +23,7 @@ bool IntersectTriangle(const Ray& ray, const Triangle& triangle,
   const double invDivisor = 1.0 / divisor;
 
   // compute barycentric coordinate b1
-  Vector t = ray.GetOrigin() - triangle.points[0];
+  Vector t = ray.GetOrigin() - point0;
   double b1 = invDivisor * DotProduct(t, p);
   if (b1 < 0.0 || b1 > 1.0)
     return false;
@@ -18,3 +18,9 @@ struct Triangle {
 
 bool IntersectTriangle(const Ray& ray, const Triangle& triangle,
                        Triangle::Intersection& intersection);
+
+// The same test for the triangle given by its first point and the edges
+// from it, for callers that store precomputed edges.
+bool IntersectTriangle(const Ray& ray, const Vector& point0,
+                       const Vector& edge1, const Vector& edge2,
+                       Triangle::Intersection& intersection);
@@ -1,8 +1,45 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 
 class TriangleMesh;
 
-std::unique_ptr<TriangleMesh> LoadTriangleMesh(const std::string& fileName);
+struct MeshLoadOptions {
+  // Parse the file directly from a read-only memory mapping. When mapping
+  // is disabled or fails the whole file is read into a temporary buffer.
+  bool useFileMapping = true;
+
+  // Binary STL files are read in chunks by a separate thread while parser
+  // threads process the chunks that are already read, so disk reads overlap
+  // with parsing. Other formats ignore the option.
+  bool pipelined = false;
+
+  // Directory for preprocessed mesh files (see mesh_file.h), empty string
+  // disables caching. The first load parses the source file and stores the
+  // result, later loads read the cache file while the source is unchanged.
+  std::string cacheDirectory;
+  bool cacheNormals = true;
+
+  // Facet normals are stored in the file (STL) or computed (PLY, OBJ) only
+  // on request, the kdtree code does not use them. Without normals the mesh
+  // has an empty normals array.
+  bool loadNormals = false;
+};
+
+struct MeshLoadStats {
+  std::string format;
+  int64_t fileSize = 0;
+  bool fileMapped = false;
+  bool pipelined = false;
+  bool cacheHit = false;
+};
+
+// Loads STL (binary or ascii), binary PLY or OBJ file, the format is selected
+// by the file extension. PLY and OBJ meshes are already indexed, so they are
+// loaded without welding vertices; facet normals are computed if requested.
+std::unique_ptr<TriangleMesh>
+LoadTriangleMesh(const std::string& fileName,
+                 const MeshLoadOptions& options = MeshLoadOptions(),
+                 MeshLoadStats* stats = nullptr);
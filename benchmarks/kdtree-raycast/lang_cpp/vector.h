@@ -3,6 +3,12 @@
 #include <cassert>
 #include <cmath>
 
+// VECTOR_SSE2 enables the SSE2 code paths on x86-64.
+#if defined(__SSE2__) || defined(_M_X64)
+#define VECTOR_SSE2
+#include <emmintrin.h>
+#endif
+
 template <typename T>
 struct TVector {
   T x, y, z;
@@ -1,8 +1,10 @@
 #include "common.h"
 #include "vector.h"
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 std::vector<Vector> ReadNormals(const std::string& fileName)
@@ -28,6 +30,30 @@ inline Vector ReflectVector(const Vector& vector, const Vector& normal)
   return vector - 2.0 * DotProduct(vector, normal) * normal;
 }
 
+// Batch version of ReflectVector for independent vectors, results are the
+// same as of ReflectVector.
+void ReflectVectors(const Vector* vectors, const Vector* normals,
+                    Vector* results, size_t count)
+{
+  size_t i = 0;
+#ifdef VECTOR_SSE2
+  const __m128d two = _mm_set1_pd(2.0);
+  for (; i + 2 <= count; i += 2) {
+    __m128d vx, vy, vz, nx, ny, nz;
+    vector_simd::LoadPair(vectors + i, vx, vy, vz);
+    vector_simd::LoadPair(normals + i, nx, ny, nz);
+    __m128d scale = _mm_mul_pd(
+        two, vector_simd::DotProductPair(vx, vy, vz, nx, ny, nz));
+    vector_simd::StorePair(results + i, _mm_sub_pd(vx, _mm_mul_pd(nx, scale)),
+                           _mm_sub_pd(vy, _mm_mul_pd(ny, scale)),
+                           _mm_sub_pd(vz, _mm_mul_pd(nz, scale)));
+  }
+#endif
+  for (; i < count; i++) {
+    results[i] = ReflectVector(vectors[i], normals[i]);
+  }
+}
+
 inline Vector RefractVector(const Vector& vector, const Vector& normal)
 {
   static const double eta = 0.7;
@@ -64,5 +90,45 @@ int main(int argc, char* argv[])
   if (!vector.Equals(Vector(-0.2653, -0.1665, -0.9497), 1e-3)) {
     ValidationError("invalid final vector value");
   }
+
+  // optional measurement of the kernels on independent vectors that stay in
+  // the cache, each pass reflects the results of the previous one
+  if (HasCommandLineOption(argc, argv, "--vector-kernels")) {
+    enum { size = 4096, passesCount = 10000 };
+    std::vector<Vector> vectors(size);
+    for (size_t i = 0; i < size; i++)
+      vectors[i] = normals[(i + 1) % normals.size()];
+
+    std::vector<Vector> input[2] = {vectors, vectors};
+    std::vector<Vector> output[2] = {vectors, vectors};
+    int timesMsec[2];
+    for (int k = 0; k < 2; k++) {
+      Timer kernelTimer;
+      for (int pass = 0; pass < passesCount; pass++) {
+        if (k == 0) {
+          for (size_t i = 0; i < size; i++)
+            output[k][i] = ReflectVector(input[k][i], normals[i]);
+        }
+        else {
+          ReflectVectors(input[k].data(), normals.data(), output[k].data(),
+                         size);
+        }
+        std::swap(input[k], output[k]);
+      }
+      timesMsec[k] = kernelTimer.ElapsedMilliseconds();
+    }
+    if (input[0] != input[1])
+      ValidationError("ReflectVectors results differ from ReflectVector");
+
+    const double callsCount = double(passesCount) * size;
+    printf("vector kernels [%s]: ReflectVector %.2f ns, ReflectVectors "
+           "%.2f ns per vector\n",
+#ifdef VECTOR_SSE2
+           "sse2",
+#else
+           "portable",
+#endif
+           timesMsec[0] * 1e6 / callsCount, timesMsec[1] * 1e6 / callsCount);
+  }
   return 0;
 }
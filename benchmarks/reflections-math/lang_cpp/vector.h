@@ -3,6 +3,13 @@
 #include <cassert>
 #include <cmath>
 
+// The pair helpers below use SSE2 on x86-64, the callers fall back to the
+// single vector functions elsewhere.
+#if defined(__SSE2__) || defined(_M_X64)
+#define VECTOR_SSE2
+#include <emmintrin.h>
+#endif
+
 template <typename T>
 struct TVector {
   T x, y, z;
@@ -114,3 +121,35 @@ inline TVector<T> CrossProduct(const TVector<T>& a, const TVector<T>& b)
   return TVector<T>(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
                     a.x * b.y - a.y * b.x);
 }
+
+#ifdef VECTOR_SSE2
+namespace vector_simd {
+// Two consecutive vectors are three registers (x0 y0) (z0 x1) (y1 z1),
+// they are transposed to (x0 x1) (y0 y1) (z0 z1).
+inline void LoadPair(const Vector* v, __m128d& x, __m128d& y, __m128d& z)
+{
+  const double* p = &v->x;
+  __m128d v0 = _mm_loadu_pd(p);
+  __m128d v1 = _mm_loadu_pd(p + 2);
+  __m128d v2 = _mm_loadu_pd(p + 4);
+  x = _mm_shuffle_pd(v0, v1, 2);
+  y = _mm_shuffle_pd(v0, v2, 1);
+  z = _mm_shuffle_pd(v1, v2, 2);
+}
+
+inline void StorePair(Vector* v, __m128d x, __m128d y, __m128d z)
+{
+  double* p = &v->x;
+  _mm_storeu_pd(p, _mm_shuffle_pd(x, y, 0));
+  _mm_storeu_pd(p + 2, _mm_shuffle_pd(z, x, 2));
+  _mm_storeu_pd(p + 4, _mm_shuffle_pd(y, z, 3));
+}
+
+inline __m128d DotProductPair(__m128d ax, __m128d ay, __m128d az, __m128d bx,
+                              __m128d by, __m128d bz)
+{
+  return _mm_add_pd(_mm_add_pd(_mm_mul_pd(ax, bx), _mm_mul_pd(ay, by)),
+                    _mm_mul_pd(az, bz));
+}
+} // namespace vector_simd
+#endif
@@ -4,6 +4,7 @@
 #include <chrono>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -23,6 +24,12 @@ public:
     return static_cast<int>(seconds * 1000);
   }
 
+  double ElapsedSeconds() const
+  {
+    auto duration = Clock::now() - begin;
+    return std::chrono::duration_cast<Second>(duration).count();
+  }
+
 private:
   using Clock = std::chrono::high_resolution_clock;
   using Second = std::chrono::duration<double, std::ratio<1>>;
@@ -75,6 +82,16 @@ inline void AssertEqualsHex(uint64_t actual, uint64_t expected,
   }
 }
 
+inline bool HasCommandLineOption(int argc, char* argv[],
+                                 const std::string& option)
+{
+  for (int i = 1; i < argc; i++) {
+    if (argv[i] == option)
+      return true;
+  }
+  return false;
+}
+
 inline std::string JoinPath(std::string path1, std::string path2)
 {
   if (!path1.empty() && (path1.back() == '/' || path1.back() == '\\'))
@@ -126,7 +143,49 @@ inline std::string StripExtension(const std::string& path)
   return (dotPos < slashPos) ? path : path.substr(0, dotPos);
 }
 
+inline bool FileExists(const std::string& path)
+{
+  return std::ifstream(path).good();
+}
+
+// Returns -1 if the file can't be opened.
+inline int64_t GetFileSize(const std::string& path)
+{
+  std::ifstream file(path, std::ios_base::in | std::ios_base::binary |
+                               std::ios_base::ate);
+  return file ? static_cast<int64_t>(file.tellg()) : -1;
+}
+
 inline uint64_t CombineHashes(uint64_t hash1, uint64_t hash2)
 {
   return hash1 ^ (hash2 + 0x9e3779b9 + (hash1 << 6) + (hash1 >> 2));
 }
+
+// Non-cryptographic hash of a memory block. Four independent lanes process
+// 32 bytes per step, so hashing runs close to memory bandwidth.
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+  const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+  uint64_t lanes[4] = {seed, seed + 1, seed + 2, seed + 3};
+  size_t offset = 0;
+  for (; offset + 32 <= size; offset += 32) {
+    for (int i = 0; i < 4; i++) {
+      uint64_t word;
+      memcpy(&word, bytes + offset + i * 8, 8);
+      lanes[i] = (lanes[i] ^ word) * multiplier;
+      lanes[i] ^= lanes[i] >> 32;
+    }
+  }
+
+  uint8_t tail[32] = {};
+  memcpy(tail, bytes + offset, size - offset);
+  uint64_t hash = size;
+  for (int i = 0; i < 4; i++) {
+    uint64_t word;
+    memcpy(&word, tail + i * 8, 8);
+    hash = CombineHashes(hash, (lanes[i] ^ word) * multiplier);
+  }
+  return hash;
+}
@@ -67,6 +67,7 @@ def build_cpp_sources_with_gcc(source_dir, output_dir, compiler_executable):
         '-std=c++11',
         '-m64',
         '-O3',
+        '-pthread',
         '-o',
         os.path.join(output_dir, common.EXECUTABLE_NAME),
         '-I' + os.path.join(common.COMMON_DIR_PATH, 'lang_cpp')
@@ -82,6 +83,7 @@ def build_cpp_sources_with_clang(source_dir, output_dir, compiler_executable):
         '-std=c++11',
         '-m64',
         '-O3',
+        '-pthread',
         '-o',
         os.path.join(output_dir, common.EXECUTABLE_NAME),
         '-I' + os.path.join(common.COMMON_DIR_PATH, 'lang_cpp')